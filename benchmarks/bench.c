@@ -0,0 +1,212 @@
+/**
+ * bench.c
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+
+#ifndef BENCH_MIN_TIME_NS
+#define BENCH_MIN_TIME_NS            200000000ull
+#endif /* BENCH_MIN_TIME_NS */
+
+
+uint64_t bench_tx_bytes;
+uint64_t bench_allocs;
+void (* bench_tx_hook)(struct ucoap_handle * const handle,
+        const uint8_t * buf, const uint32_t len);
+
+static volatile uint64_t sink;
+static uint16_t message_id;
+static uint8_t token;
+
+
+static uint64_t
+now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+void
+bench_header(const char * title) {
+    printf("\n%s\n", title);
+    printf("%-40s %12s %12s %12s\n", "benchmark", "ns/op", "bytes/op", "allocs/op");
+}
+
+
+void
+bench_run(const char * name, bench_fn fn, void * ctx) {
+    uint64_t i;
+    uint64_t iterations;
+    uint64_t bytes;
+    uint64_t allocs;
+    uint64_t start;
+    uint64_t elapsed;
+
+    /* warm up and calibrate */
+    iterations = 1;
+
+    do {
+        iterations *= 2;
+        start = now_ns();
+
+        for (i = 0; i < iterations; i++) {
+            sink += fn(ctx);
+        }
+
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_MIN_TIME_NS / 10);
+
+    iterations = iterations * (BENCH_MIN_TIME_NS / (elapsed ? elapsed : 1) + 1);
+
+    bytes = 0;
+    allocs = bench_allocs;
+    start = now_ns();
+
+    for (i = 0; i < iterations; i++) {
+        bytes += fn(ctx);
+    }
+
+    elapsed = now_ns() - start;
+    allocs = bench_allocs - allocs;
+    sink += bytes;
+
+    printf("%-40s %12.1f %12.1f %12.2f\n", name,
+            (double)elapsed / iterations,
+            (double)bytes / iterations,
+            (double)allocs / iterations);
+}
+
+
+/* Implementation of the 'ucoap' hooks */
+
+enum ucoap_error
+ucoap_tx_data(struct ucoap_handle * const handle, const uint8_t * buf,
+        const uint32_t len) {
+    bench_tx_bytes += len;
+
+    if (bench_tx_hook != NULL) {
+        bench_tx_hook(handle, buf, len);
+    }
+
+    return UCOAP_OK;
+}
+
+
+enum ucoap_error
+ucoap_wait_event(struct ucoap_handle * const handle,
+        const uint32_t timeout_ms) {
+    (void)handle;
+    (void)timeout_ms;
+
+    return UCOAP_TIMEOUT_ERROR;
+}
+
+
+enum ucoap_error
+ucoap_tx_signal(struct ucoap_handle * const handle,
+        const enum ucoap_outsignal signal) {
+    (void)handle;
+    (void)signal;
+
+    return UCOAP_OK;
+}
+
+
+uint16_t
+ucoap_get_message_id(struct ucoap_handle * const handle) {
+    (void)handle;
+
+    return ++message_id;
+}
+
+
+enum ucoap_error
+ucoap_fill_token(struct ucoap_handle * const handle, uint8_t * token_buf,
+        const uint32_t tkl) {
+    uint32_t i;
+
+    (void)handle;
+
+    for (i = 0; i < tkl; i++) {
+        token_buf[i] = ++token;
+    }
+
+    return UCOAP_OK;
+}
+
+
+uint32_t
+ucoap_random(struct ucoap_handle * const handle) {
+    (void)handle;
+
+    return (uint32_t)rand();
+}
+
+
+void
+ucoap_debug_print_packet(struct ucoap_handle * const handle,
+        const char * msg, uint8_t * data, const uint32_t len) {
+    (void)handle;
+    (void)msg;
+    (void)data;
+    (void)len;
+}
+
+
+void
+ucoap_debug_print_options(struct ucoap_handle * const handle,
+        const char * msg, const ucoap_option_data * options) {
+    (void)handle;
+    (void)msg;
+    (void)options;
+}
+
+
+void
+ucoap_debug_print_payload(struct ucoap_handle * const handle,
+        const char * msg, const ucoap_data * const payload) {
+    (void)handle;
+    (void)msg;
+    (void)payload;
+}
+
+
+enum ucoap_error
+ucoap_alloc_mem_block(uint8_t ** block, const uint32_t min_len) {
+    bench_allocs++;
+    *block = malloc(min_len);
+
+    return *block != NULL ? UCOAP_OK : UCOAP_NO_FREE_MEM_ERROR;
+}
+
+
+enum ucoap_error
+ucoap_free_mem_block(uint8_t * block, const uint32_t min_len) {
+    (void)min_len;
+    free(block);
+
+    return UCOAP_OK;
+}
+
+
+void
+mem_copy(void * dst, const void * src, uint32_t cnt) {
+    memcpy(dst, src, cnt);
+}
+
+
+bool
+mem_cmp(const void * dst, const void * src, uint32_t cnt) {
+    return memcmp(dst, src, cnt) == 0;
+}
@@ -0,0 +1,64 @@
+/**
+ * bench.h
+ *
+ * Minimal harness for the benchmarks: timing loop and implementation of
+ * the 'ucoap' hooks which counts transmitted bytes and allocations.
+ *
+ */
+
+
+#ifndef _UCOAP_BENCH_H_
+#define _UCOAP_BENCH_H_
+
+
+#include <stdint.h>
+
+#include "ucoap.h"
+
+
+/**
+ * @brief One operation of a benchmark
+ *
+ * @param ctx - context of the benchmark
+ *
+ * @return count of bytes produced (or consumed) by the operation
+ */
+typedef uint32_t (* bench_fn)(void * ctx);
+
+
+/**
+ * Counters of hooks, updated by 'ucoap_tx_data' and 'ucoap_alloc_mem_block'.
+ */
+extern uint64_t bench_tx_bytes;
+extern uint64_t bench_allocs;
+
+
+/**
+ * @brief Called from 'ucoap_tx_data' if not NULL, e.g. to answer a request.
+ */
+extern void (* bench_tx_hook)(struct ucoap_handle * const handle,
+        const uint8_t * buf, const uint32_t len);
+
+
+/**
+ * @brief Print the header of the results table
+ *
+ * @param title - title of the suite
+ *
+ */
+void bench_header(const char * title);
+
+
+/**
+ * @brief Run the operation long enough to get a stable result and print
+ *        ns/op, bytes/op and allocs/op
+ *
+ * @param name - name of the benchmark
+ * @param fn - operation
+ * @param ctx - context of the operation
+ *
+ */
+void bench_run(const char * name, bench_fn fn, void * ctx);
+
+
+#endif /* _UCOAP_BENCH_H_ */
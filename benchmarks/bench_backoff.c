@@ -0,0 +1,397 @@
+/**
+ * bench_backoff.c
+ *
+ * Simulation of a fleet of clients behind a lossy, congested uplink (e.g.
+ * a cell). All clients start together and run confirmable exchanges back
+ * to back for a fixed time. The library (randomized exponential backoff)
+ * is driven through the asynchronous API on a virtual clock. The previous
+ * schedule of ucoap (fixed initial timeout, linear growth) is reproduced
+ * by a small model on the same channel for comparison. The library with
+ * a shorter ACK_TIMEOUT shows the tuning for random (not congestion) loss.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+
+#define SIM_CLIENTS                  64
+#define SIM_DURATION_MS              (10 * 60 * 1000)
+#define SIM_MAX_EXCHANGES            (1 << 20)
+#define SIM_MAX_PACKETS              4096      /* in flight */
+#define SIM_PACKET_SIZE              32
+
+#define SIM_DELAY_MS                 100       /* one way */
+#define SIM_JITTER_MS                50
+#define SIM_UPLINK_SERVICE_MS        20        /* 50 packets/s */
+#define SIM_UPLINK_QUEUE             16        /* packets */
+
+#define SIM_ACK_TIMEOUT_MS           2000
+#define SIM_SHORT_ACK_TIMEOUT_MS     1000      /* for links with random loss */
+#define SIM_MAX_RETRANSMIT           4
+
+
+typedef struct {
+
+    uint32_t deliver_at;
+    uint32_t client;
+    uint32_t len;
+    uint8_t uplink;
+    uint8_t buf[SIM_PACKET_SIZE];
+
+} sim_packet;
+
+
+typedef struct {
+
+    struct ucoap_handle handle;    /* must be first */
+    ucoap_request_descriptor reqd;
+
+    uint32_t started;              /* start of the current exchange */
+    bool busy;
+
+    /* model of the previous schedule */
+    uint16_t mid;
+    uint32_t deadline;
+    uint32_t retransmition;
+
+} sim_client;
+
+
+typedef struct {
+
+    uint32_t completed;
+    uint32_t failed;
+    uint32_t datagrams;
+    uint32_t latencies[SIM_MAX_EXCHANGES];
+
+} sim_stats;
+
+
+static const struct ucoap_config sim_config = {
+    .max_pdu_size = 64,
+    .ack_timeout_ms = SIM_ACK_TIMEOUT_MS,
+    .resp_timeout_ms = 9000,
+    .max_retransmit = SIM_MAX_RETRANSMIT
+};
+
+static const struct ucoap_config sim_short_config = {
+    .max_pdu_size = 64,
+    .ack_timeout_ms = SIM_SHORT_ACK_TIMEOUT_MS,
+    .resp_timeout_ms = 9000,
+    .max_retransmit = SIM_MAX_RETRANSMIT
+};
+
+static sim_client clients[SIM_CLIENTS];
+static sim_packet packets[SIM_MAX_PACKETS];
+static uint32_t packets_count;
+static sim_stats stats;
+
+static uint32_t sim_now;
+static uint32_t uplink_free_at;
+static uint32_t loss_permille;
+static uint32_t rng_state;
+
+
+static uint32_t
+sim_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+
+    return rng_state;
+}
+
+
+static void
+channel_send(const uint32_t client, const bool uplink,
+        const uint8_t * buf, const uint32_t len) {
+    uint32_t start;
+    sim_packet * packet;
+
+    if (uplink) {
+        stats.datagrams++;
+    }
+
+    if (sim_random() % 1000 < loss_permille) {
+        return;
+    }
+
+    start = sim_now;
+
+    if (uplink) {
+        start = uplink_free_at > sim_now ? uplink_free_at : sim_now;
+
+        /* tail drop of the bottleneck queue */
+        if ((start - sim_now) / SIM_UPLINK_SERVICE_MS >= SIM_UPLINK_QUEUE) {
+            return;
+        }
+
+        uplink_free_at = start + SIM_UPLINK_SERVICE_MS;
+        start = uplink_free_at;
+    }
+
+    if (packets_count == SIM_MAX_PACKETS || len > SIM_PACKET_SIZE) {
+        return;
+    }
+
+    packet = &packets[packets_count++];
+    packet->deliver_at = start + SIM_DELAY_MS + sim_random() % SIM_JITTER_MS;
+    packet->client = client;
+    packet->uplink = uplink;
+    packet->len = len;
+    memcpy(packet->buf, buf, len);
+}
+
+
+/* the server answers every copy of the request by a piggybacked response */
+static void
+server_rx(const sim_packet * const request) {
+    uint32_t tkl;
+    uint8_t response[SIM_PACKET_SIZE];
+
+    tkl = request->buf[0] & 0x0F;
+
+    response[0] = 0x60 | tkl;      /* ver 1, ACK */
+    response[1] = 0x45;            /* 2.05 Content */
+    response[2] = request->buf[2];
+    response[3] = request->buf[3];
+    memcpy(response + 4, request->buf + 4, tkl);
+    response[4 + tkl] = 0xFF;
+    memcpy(response + 5 + tkl, "23.5", 4);
+
+    channel_send(request->client, false, response, 9 + tkl);
+}
+
+
+static void
+exchange_done(sim_client * const client, const bool success) {
+    if (!success) {
+        stats.failed++;
+    } else if (stats.completed < SIM_MAX_EXCHANGES) {
+        stats.latencies[stats.completed++] = sim_now - client->started;
+    }
+
+    client->busy = false;
+}
+
+
+/* ucoap client */
+
+static void
+library_callback(const struct ucoap_request_descriptor * const reqd,
+        const ucoap_result_data * const result) {
+    sim_client * const client = (sim_client *)((uint8_t *)reqd
+            - offsetof(sim_client, reqd));
+
+    exchange_done(client, result->err == UCOAP_OK);
+}
+
+
+static void
+library_tx(struct ucoap_handle * const handle, const uint8_t * buf,
+        const uint32_t len) {
+    channel_send((sim_client *)handle - clients, true, buf, len);
+}
+
+
+static void
+library_start(sim_client * const client) {
+    client->busy = true;
+    client->started = sim_now;
+
+    ucoap_submit_coap_request(&client->handle, &client->reqd, sim_now);
+}
+
+
+static void
+library_rx(sim_client * const client, const sim_packet * const packet) {
+    ucoap_rx_packet(&client->handle, packet->buf, packet->len);
+    ucoap_process(&client->handle, sim_now);
+}
+
+
+static void
+library_tick(sim_client * const client) {
+    uint32_t deadline;
+
+    if (ucoap_next_deadline(&client->handle, &deadline)
+            && (int32_t)(sim_now - deadline) >= 0) {
+        ucoap_process(&client->handle, sim_now);
+    }
+}
+
+
+/* model of the previous schedule: ACK_TIMEOUT + n * ACK_TIMEOUT * 1.3 */
+
+static void
+linear_send(sim_client * const client) {
+    uint8_t request[4] = { 0x40, 0x01 };
+
+    request[2] = client->mid >> 8;
+    request[3] = client->mid;
+
+    channel_send(client - clients, true, request, sizeof(request));
+}
+
+
+static void
+linear_start(sim_client * const client) {
+    client->busy = true;
+    client->started = sim_now;
+    client->mid++;
+    client->retransmition = 0;
+    client->deadline = sim_now + SIM_ACK_TIMEOUT_MS;
+
+    linear_send(client);
+}
+
+
+static void
+linear_rx(sim_client * const client, const sim_packet * const packet) {
+    if (client->busy
+            && ((packet->buf[2] << 8) | packet->buf[3]) == client->mid) {
+        exchange_done(client, true);
+    }
+}
+
+
+static void
+linear_tick(sim_client * const client) {
+    if (!client->busy || (int32_t)(sim_now - client->deadline) < 0) {
+        return;
+    }
+
+    if (client->retransmition == SIM_MAX_RETRANSMIT) {
+        exchange_done(client, false);
+        return;
+    }
+
+    client->retransmition++;
+    client->deadline = sim_now + client->retransmition
+            * (SIM_ACK_TIMEOUT_MS * UCOAP_ACK_RANDOM_FACTOR / 100)
+            + SIM_ACK_TIMEOUT_MS;
+
+    linear_send(client);
+}
+
+
+static int
+compare_latency(const void * a, const void * b) {
+    const uint32_t x = *(const uint32_t *)a;
+    const uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+static void
+simulate(const char * name, const uint32_t loss, const bool library,
+        const struct ucoap_config * const config) {
+    uint32_t i;
+    sim_client * client;
+    sim_packet packet;
+
+    memset(clients, 0, sizeof(clients));
+    memset(&stats, 0, sizeof(stats));
+    packets_count = 0;
+    sim_now = 0;
+    uplink_free_at = 0;
+    loss_permille = loss * 10;
+    rng_state = 0x2545F491;
+    srand(1);
+
+    for (i = 0; i < SIM_CLIENTS; i++) {
+        client = &clients[i];
+        client->handle.name = "sim";
+        client->handle.transport = UCOAP_UDP;
+        client->handle.config = config;
+        client->reqd.type = UCOAP_MESSAGE_CON;
+        client->reqd.code = UCOAP_REQ_GET;
+        client->reqd.tkl = 2;
+        client->reqd.response_callback = library_callback;
+
+        if (library) {
+            ucoap_handle_init(&client->handle, NULL, 0);
+        }
+    }
+
+    bench_tx_hook = library_tx;
+
+    do {
+        /* deliver the packets which are due */
+        for (i = 0; i < packets_count; ) {
+            if (packets[i].deliver_at != sim_now) {
+                i++;
+                continue;
+            }
+
+            packet = packets[i];
+            packets[i] = packets[--packets_count];
+
+            if (packet.uplink) {
+                server_rx(&packet);
+            } else if (library) {
+                library_rx(&clients[packet.client], &packet);
+            } else {
+                linear_rx(&clients[packet.client], &packet);
+            }
+        }
+
+        for (i = 0; i < SIM_CLIENTS; i++) {
+            client = &clients[i];
+
+            if (!client->busy) {
+                library ? library_start(client) : linear_start(client);
+            } else if (library) {
+                library_tick(client);
+            } else {
+                linear_tick(client);
+            }
+        }
+
+        sim_now++;
+    } while (sim_now < SIM_DURATION_MS);
+
+    bench_tx_hook = NULL;
+
+    for (i = 0; library && i < SIM_CLIENTS; i++) {
+        ucoap_handle_deinit(&clients[i].handle);
+    }
+
+    qsort(stats.latencies, stats.completed, sizeof(stats.latencies[0]),
+            compare_latency);
+
+    printf("%-8u %-22s %12.1f %10u %10u %10u %8u %10.2f\n", loss, name,
+            stats.completed * 1000.0 / SIM_DURATION_MS,
+            stats.completed ? stats.latencies[stats.completed / 2] : 0,
+            stats.completed ? stats.latencies[stats.completed * 99 / 100] : 0,
+            stats.completed ? stats.latencies[stats.completed - 1] : 0,
+            stats.failed,
+            (double)stats.datagrams / (stats.completed + stats.failed));
+}
+
+
+int
+main(void) {
+    uint32_t i;
+    static const uint32_t losses[] = { 5, 10, 20, 30 };
+
+    printf("\n%u clients, %u s, ACK_TIMEOUT %u ms, MAX_RETRANSMIT %u, "
+            "uplink %u pkt/s\n", SIM_CLIENTS, SIM_DURATION_MS / 1000,
+            SIM_ACK_TIMEOUT_MS, SIM_MAX_RETRANSMIT, 1000 / SIM_UPLINK_SERVICE_MS);
+    printf("%-8s %-22s %12s %10s %10s %10s %8s %10s\n", "loss, %", "schedule",
+            "goodput/s", "p50, ms", "p99, ms", "max, ms", "failed", "tx/exch");
+
+    for (i = 0; i < sizeof(losses) / sizeof(losses[0]); i++) {
+        simulate("linear (previous)", losses[i], false, &sim_config);
+        simulate("exponential, random", losses[i], true, &sim_config);
+        simulate("exponential, 1 s", losses[i], true, &sim_short_config);
+    }
+
+    return 0;
+}
@@ -0,0 +1,254 @@
+/**
+ * bench_blockwise.c
+ *
+ * Simulation of a firmware download by Block2 over a link with a long
+ * round trip. The transfer is driven through the asynchronous API on a
+ * virtual clock with different windows of blocks in flight; window 1 is
+ * the stop-and-wait transfer which an application drives by hand.
+ *
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+
+#include "ucoap_utils.h"
+#include "ucoap_blockwise.h"
+
+
+#define SIM_RESOURCE_SIZE            (256 * 1024)
+#define SIM_DELAY_MS                 100       /* one way */
+#define SIM_MAX_PACKETS              64        /* in flight */
+#define SIM_PACKET_SIZE              1200
+
+
+typedef struct {
+
+    uint32_t deliver_at;
+    uint32_t len;
+    uint8_t uplink;
+    uint8_t buf[SIM_PACKET_SIZE];
+
+} sim_packet;
+
+
+static const struct ucoap_config sim_config = {
+    .max_pdu_size = 1100,
+    .ack_timeout_ms = 2000,
+    .resp_timeout_ms = 9000,
+    .max_retransmit = 4
+};
+
+static struct ucoap_handle handle = {
+    .name = "sim",
+    .transport = UCOAP_UDP,
+    .config = &sim_config
+};
+
+static sim_packet packets[SIM_MAX_PACKETS];
+static uint32_t packets_count;
+static uint32_t sim_now;
+static uint32_t received;
+static uint32_t requests;
+static bool finished;
+
+
+static void
+channel_send(const bool uplink, const uint8_t * buf, const uint32_t len) {
+    sim_packet * packet;
+
+    if (packets_count == SIM_MAX_PACKETS || len > SIM_PACKET_SIZE) {
+        return;
+    }
+
+    packet = &packets[packets_count++];
+    packet->deliver_at = sim_now + SIM_DELAY_MS;
+    packet->uplink = uplink;
+    packet->len = len;
+    memcpy(packet->buf, buf, len);
+}
+
+
+/* the server answers by a piggybacked block with Size2 */
+static void
+server_rx(const sim_packet * const request) {
+    uint32_t i;
+    uint32_t tkl;
+    uint32_t len;
+    uint32_t offset;
+    uint32_t block_size;
+    uint32_t payload_idx;
+    ucoap_data data;
+    ucoap_blockwise_data bw;
+    ucoap_option_data options[8];
+    ucoap_option_data block2;
+    const ucoap_option_data * opt;
+    uint8_t value[3];
+    uint8_t buf[SIM_PACKET_SIZE + 1];
+    uint8_t response[SIM_PACKET_SIZE];
+
+    tkl = request->buf[0] & 0x0F;
+
+    /* the decoder stops at the payload marker */
+    memcpy(buf, request->buf, request->len);
+    buf[request->len] = 0xFF;
+    data.buf = buf;
+    data.len = request->len + 1;
+
+    if (decoding_options(&data, options, sizeof(options) / sizeof(options[0]),
+            4 + tkl, &payload_idx) != UCOAP_OK) {
+        return;
+    }
+
+    opt = ucoap_find_option_by_number(options, UCOAP_BLOCK2_OPT);
+
+    if (opt == NULL) {
+        return;
+    }
+
+    ucoap_extract_block2_from_opt(opt, &bw);
+
+    block_size = ucoap_decode_szx_to_size(bw.fld.block_szx);
+    offset = bw.fld.num * block_size;
+    len = offset < SIM_RESOURCE_SIZE ? SIM_RESOURCE_SIZE - offset : 0;
+    len = len < block_size ? len : block_size;
+    bw.fld.more = offset + len < SIM_RESOURCE_SIZE;
+
+    ucoap_fill_block2_opt(&block2, &bw, value);
+
+    response[0] = 0x60 | tkl;      /* ver 1, ACK */
+    response[1] = 0x45;            /* 2.05 Content */
+    response[2] = request->buf[2];
+    response[3] = request->buf[3];
+    memcpy(response + 4, request->buf + 4, tkl);
+    i = 4 + tkl;
+
+    /* Block2 (23) and Size2 (28) */
+    response[i++] = 0xD0 | block2.len;
+    response[i++] = UCOAP_BLOCK2_OPT - 13;
+    memcpy(response + i, value, block2.len);
+    i += block2.len;
+
+    response[i++] = ((UCOAP_SIZE2_OPT - UCOAP_BLOCK2_OPT) << 4) | 3;
+    response[i++] = (SIM_RESOURCE_SIZE >> 16) & 0xFF;
+    response[i++] = (SIM_RESOURCE_SIZE >> 8) & 0xFF;
+    response[i++] = SIM_RESOURCE_SIZE & 0xFF;
+
+    response[i++] = 0xFF;
+
+    for (; len > 0; len--) {
+        response[i++] = (uint8_t)(offset++ * 7);
+    }
+
+    channel_send(false, response, i);
+}
+
+
+static void
+library_tx(struct ucoap_handle * const h, const uint8_t * buf,
+        const uint32_t len) {
+    (void)h;
+
+    requests++;
+    channel_send(true, buf, len);
+}
+
+
+static void
+sink(struct ucoap_block_download * const download, const uint32_t offset,
+        const ucoap_data * const data) {
+    (void)download;
+    (void)offset;
+
+    received += data->len;
+}
+
+
+static void
+done(struct ucoap_block_download * const download,
+        const enum ucoap_error err, const uint8_t resp_code) {
+    (void)download;
+    (void)resp_code;
+
+    finished = true;
+
+    if (err != UCOAP_OK) {
+        printf("transfer has failed: %d\n", err);
+    }
+}
+
+
+static void
+simulate(const uint8_t window) {
+    uint32_t i;
+    sim_packet packet;
+    static struct ucoap_block_download download;
+
+    packets_count = 0;
+    sim_now = 0;
+    received = 0;
+    requests = 0;
+    finished = false;
+
+    memset(&download, 0, sizeof(download));
+    download.handle = &handle;
+    download.type = UCOAP_MESSAGE_CON;
+    download.tkl = 2;
+    download.szx = 6;
+    download.window = window;
+    download.sink = sink;
+    download.done = done;
+
+    ucoap_handle_init(&handle, NULL, 0);
+    bench_tx_hook = library_tx;
+
+    ucoap_block_download_start(&download, sim_now);
+
+    while (!finished) {
+        for (i = 0; i < packets_count; ) {
+            if (packets[i].deliver_at != sim_now) {
+                i++;
+                continue;
+            }
+
+            packet = packets[i];
+            packets[i] = packets[--packets_count];
+
+            if (packet.uplink) {
+                server_rx(&packet);
+            } else {
+                ucoap_rx_packet(&handle, packet.buf, packet.len);
+                ucoap_process(&handle, sim_now);
+            }
+        }
+
+        ucoap_process(&handle, sim_now);
+        ucoap_block_download_process(&download, sim_now);
+
+        sim_now++;
+    }
+
+    bench_tx_hook = NULL;
+    ucoap_handle_deinit(&handle);
+
+    printf("%-8u %10u %12.1f %12.1f %10u\n", window, received,
+            sim_now / 1000.0, received / 1.024 / sim_now, requests);
+}
+
+
+int
+main(void) {
+    uint8_t window;
+
+    printf("\n%u KB by 1024-byte blocks, RTT %u ms\n",
+            SIM_RESOURCE_SIZE / 1024, 2 * SIM_DELAY_MS);
+    printf("%-8s %10s %12s %12s %10s\n", "window", "bytes", "time, s", "KB/s", "requests");
+
+    for (window = 1; window <= UCOAP_BLOCK_WINDOW; window++) {
+        simulate(window);
+    }
+
+    return 0;
+}
@@ -0,0 +1,429 @@
+/**
+ * bench_codec.c
+ *
+ * Benchmarks of the codec hot paths over a corpus of typical messages:
+ * small telemetry, long Uri-Path chains and extended option deltas and
+ * lengths.
+ *
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+
+#include "ucoap.h"
+#include "ucoap_utils.h"
+#include "ucoap_helpers.h"
+
+
+#define BENCH_MAX_OPTIONS            16
+#define BENCH_MSG_SIZE               1024
+
+
+typedef struct {
+
+    const char * name;
+
+    uint8_t type;
+    uint8_t code;
+    uint8_t tkl;
+
+    ucoap_option_data options[BENCH_MAX_OPTIONS];
+    uint32_t options_count;
+    ucoap_data payload;
+
+    ucoap_request_descriptor reqd;
+
+    /* encoded as UDP message for the decoding benchmarks */
+    uint8_t msg[BENCH_MSG_SIZE];
+    ucoap_data encoded;
+
+} bench_message;
+
+
+static uint8_t proxy_uri[300];
+static uint8_t vendor_opt[20];
+static uint8_t scratch[BENCH_MSG_SIZE * 4];
+
+static bench_message corpus[3];
+
+static struct ucoap_handle udp_handle = {
+    .name = "bench_udp",
+    .transport = UCOAP_UDP
+};
+
+static struct ucoap_handle tcp_handle = {
+    .name = "bench_tcp",
+    .transport = UCOAP_TCP
+};
+
+/* the same with buffers given once by 'ucoap_handle_init' */
+static struct ucoap_handle udp_persistent_handle = {
+    .name = "bench_udp_persistent",
+    .transport = UCOAP_UDP
+};
+
+static struct ucoap_handle tcp_persistent_handle = {
+    .name = "bench_tcp_persistent",
+    .transport = UCOAP_TCP
+};
+
+/* persistent request buffers, responses are parsed in place */
+static struct ucoap_handle udp_zero_copy_handle = {
+    .name = "bench_udp_zero_copy",
+    .transport = UCOAP_UDP
+};
+
+/* the server answer: Content-Format, ETag, Block2 and 64 bytes of payload */
+static const uint8_t answer_tail[] = {
+    0x41, 0x2a,
+    0x14, 0x11, 0x22, 0x33, 0x44,
+    0xb1, 0x1a,
+    0xff,
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'
+};
+
+static uint8_t answer[BENCH_MSG_SIZE];
+static uint32_t answer_len;
+
+
+static void
+add_option(bench_message * const m, const uint16_t num, const void * value,
+        const uint16_t len) {
+    ucoap_option_data * opt;
+
+    opt = &m->options[m->options_count++];
+    opt->num = num;
+    opt->len = len;
+    opt->value = (uint8_t *)value;
+    opt->next = NULL;
+
+    if (m->options_count > 1) {
+        m->options[m->options_count - 2].next = opt;
+    }
+}
+
+
+static void
+response_callback(const struct ucoap_request_descriptor * const reqd,
+        const ucoap_result_data * const result) {
+    (void)reqd;
+    (void)result;
+}
+
+
+static void
+prepare_corpus(void) {
+    uint32_t i;
+    bench_message * m;
+
+    static const char * path[] = {
+        "api", "v1", "devices", "0042", "sensors", "temperature", "history", "latest"
+    };
+
+    memset(proxy_uri, 'p', sizeof(proxy_uri));
+    memset(vendor_opt, 'v', sizeof(vendor_opt));
+
+    /* small telemetry */
+    m = &corpus[0];
+    m->name = "telemetry";
+    m->type = UCOAP_MESSAGE_NON;
+    m->code = UCOAP_REQ_POST;
+    m->tkl = 2;
+    add_option(m, UCOAP_URI_PATH_OPT, "t", 1);
+    add_option(m, UCOAP_CONTENT_FORMAT_OPT, "\x32", 1);
+    m->payload.buf = (uint8_t *)"{\"t\":21.5,\"h\":40}";
+    m->payload.len = 17;
+
+    /* long Uri-Path chain */
+    m = &corpus[1];
+    m->name = "long-path";
+    m->type = UCOAP_MESSAGE_CON;
+    m->code = UCOAP_REQ_GET;
+    m->tkl = 4;
+    for (i = 0; i < sizeof(path) / sizeof(path[0]); i++) {
+        add_option(m, UCOAP_URI_PATH_OPT, path[i], strlen(path[i]));
+    }
+    add_option(m, UCOAP_ACCEPT_OPT, "\x32", 1);
+
+    /* extended option deltas and lengths */
+    m = &corpus[2];
+    m->name = "extended";
+    m->type = UCOAP_MESSAGE_CON;
+    m->code = UCOAP_REQ_PUT;
+    m->tkl = 8;
+    add_option(m, UCOAP_IF_MATCH_OPT, "\x01\x02\x03\x04", 4);
+    add_option(m, UCOAP_URI_PATH_OPT, "fw", 2);
+    add_option(m, UCOAP_PROXY_URI_OPT, proxy_uri, sizeof(proxy_uri));
+    add_option(m, UCOAP_SIZE1_OPT, "\x00\x01\x00\x00", 4);
+    add_option(m, 2049, vendor_opt, sizeof(vendor_opt));
+    m->payload.buf = proxy_uri;
+    m->payload.len = 128;
+
+    for (i = 0; i < sizeof(corpus) / sizeof(corpus[0]); i++) {
+        m = &corpus[i];
+
+        m->reqd.type = m->type;
+        m->reqd.code = m->code;
+        m->reqd.tkl = m->tkl;
+        m->reqd.options = m->options_count ? m->options : NULL;
+        m->reqd.payload = m->payload;
+        m->reqd.response_callback = NULL;
+
+        /* header without token, options and payload */
+        m->msg[0] = 0x40;
+        m->msg[1] = m->code;
+        m->msg[2] = 0;
+        m->msg[3] = 0;
+        m->encoded.len = 4;
+        m->encoded.len += encoding_options(m->msg + m->encoded.len, m->options);
+        m->encoded.len += fill_payload(m->msg + m->encoded.len, &m->payload);
+        m->encoded.buf = m->msg;
+    }
+}
+
+
+static uint32_t
+op_encoding_options(void * ctx) {
+    bench_message * const m = ctx;
+
+    return encoding_options(scratch, m->options);
+}
+
+
+static uint32_t
+op_decoding_options(void * ctx) {
+    uint32_t payload_idx;
+    bench_message * const m = ctx;
+
+    decoding_options(&m->encoded, (ucoap_option_data *)scratch,
+            sizeof(scratch) / sizeof(ucoap_option_data), 4, &payload_idx);
+
+    return m->encoded.len;
+}
+
+
+/* what a response callback paid to read one option (the last one) ... */
+static uint32_t
+op_option_find(void * ctx) {
+    uint32_t payload_idx;
+    ucoap_option_data * const options = (ucoap_option_data *)scratch;
+    bench_message * const m = ctx;
+
+    decoding_options(&m->encoded, options, sizeof(scratch) / sizeof(ucoap_option_data),
+            4, &payload_idx);
+
+    if (ucoap_find_option_by_number(options, m->options[m->options_count - 1].num) == NULL) {
+        return 0;
+    }
+
+    return m->encoded.len;
+}
+
+
+/* ... and pays with the options walked in place */
+static uint32_t
+op_option_seek(void * ctx) {
+    ucoap_data options;
+    ucoap_data payload;
+    ucoap_option_data option;
+    bench_message * const m = ctx;
+
+    split_options(&m->encoded, 4, &options, &payload);
+
+    if (!ucoap_find_option(&options, m->options[m->options_count - 1].num, &option)) {
+        return 0;
+    }
+
+    return m->encoded.len;
+}
+
+
+static uint32_t
+op_fill_payload(void * ctx) {
+    bench_message * const m = ctx;
+
+    return fill_payload(scratch, &m->payload);
+}
+
+
+static uint32_t
+op_request(void * ctx) {
+    uint64_t sent;
+    struct ucoap_handle * const handle = ctx;
+    bench_message * const m = &corpus[0];
+
+    sent = bench_tx_bytes;
+    m->reqd.type = UCOAP_MESSAGE_NON;
+    m->reqd.response_callback = NULL;
+
+    ucoap_submit_coap_request(handle, &m->reqd, 0);
+
+    return bench_tx_bytes - sent;
+}
+
+
+static void
+answer_udp(struct ucoap_handle * const handle, const uint8_t * buf,
+        const uint32_t len) {
+    uint32_t tkl;
+
+    (void)len;
+
+    tkl = buf[0] & 0x0f;
+
+    /* piggybacked ACK */
+    answer[0] = 0x60 | tkl;
+    answer[1] = UCOAP_RESP_SUCCESS_CONTENT_205;
+    answer[2] = buf[2];
+    answer[3] = buf[3];
+    memcpy(answer + 4, buf + 4, tkl);
+    memcpy(answer + 4 + tkl, answer_tail, sizeof(answer_tail));
+    answer_len = 4 + tkl + sizeof(answer_tail);
+
+    (void)handle;
+}
+
+
+static void
+answer_tcp(struct ucoap_handle * const handle, const uint8_t * buf,
+        const uint32_t len) {
+    uint32_t tkl;
+    uint32_t idx;
+
+    (void)len;
+
+    tkl = buf[0] & 0x0f;
+
+    /* skip Len/TKL, extended length and code of request */
+    idx = 1;
+    switch (buf[0] >> 4) {
+        case 13: idx += 1; break;
+        case 14: idx += 2; break;
+        case 15: idx += 4; break;
+        default: break;
+    }
+    idx++;
+
+    answer[0] = (13 << 4) | tkl;
+    answer[1] = sizeof(answer_tail) - 13;
+    answer[2] = UCOAP_RESP_SUCCESS_CONTENT_205;
+    memcpy(answer + 3, buf + idx, tkl);
+    memcpy(answer + 3 + tkl, answer_tail, sizeof(answer_tail));
+    answer_len = 3 + tkl + sizeof(answer_tail);
+
+    (void)handle;
+}
+
+
+static uint32_t
+op_exchange(void * ctx) {
+    struct ucoap_handle * const handle = ctx;
+    bench_message * const m = &corpus[1];
+
+    bench_tx_hook = handle->transport == UCOAP_UDP ? answer_udp : answer_tcp;
+    m->reqd.type = handle->transport == UCOAP_UDP ? UCOAP_MESSAGE_CON : UCOAP_MESSAGE_NON;
+    m->reqd.response_callback = response_callback;
+
+    ucoap_submit_coap_request(handle, &m->reqd, 0);
+    bench_tx_hook = NULL;
+
+    if (handle == &udp_zero_copy_handle) {
+        ucoap_rx_packet_borrowed(handle, answer, answer_len, 0);
+    } else {
+        ucoap_rx_packet(handle, answer, answer_len);
+        ucoap_process(handle, 0);
+    }
+
+    return answer_len;
+}
+
+
+static uint32_t
+op_block2(void * ctx) {
+    uint8_t value[3];
+    ucoap_option_data opt;
+    ucoap_blockwise_data bw;
+    ucoap_blockwise_data out;
+    const ucoap_option_data * found;
+    uint32_t * const num = ctx;
+
+    bw.fld.num = (*num)++ & 0xfffff;
+    bw.fld.block_szx = 6;
+    bw.fld.more = 1;
+
+    ucoap_fill_block2_opt(&opt, &bw, value);
+    found = ucoap_find_option_by_number(&opt, UCOAP_BLOCK2_OPT);
+    ucoap_extract_block2_from_opt(found, &out);
+
+    return ucoap_decode_szx_to_size(out.fld.block_szx) ? opt.len : 0;
+}
+
+
+int
+main(void) {
+    uint32_t i;
+    uint32_t block_num;
+    char name[64];
+
+    prepare_corpus();
+
+    bench_header("codec");
+
+    for (i = 0; i < sizeof(corpus) / sizeof(corpus[0]); i++) {
+        snprintf(name, sizeof(name), "encoding_options/%s", corpus[i].name);
+        bench_run(name, op_encoding_options, &corpus[i]);
+
+        snprintf(name, sizeof(name), "decoding_options/%s", corpus[i].name);
+        bench_run(name, op_decoding_options, &corpus[i]);
+
+        snprintf(name, sizeof(name), "decoding_options+find/%s", corpus[i].name);
+        bench_run(name, op_option_find, &corpus[i]);
+
+        snprintf(name, sizeof(name), "split_options+seek/%s", corpus[i].name);
+        bench_run(name, op_option_seek, &corpus[i]);
+    }
+
+    for (i = 0; i < sizeof(corpus) / sizeof(corpus[0]); i++) {
+        if (corpus[i].payload.len) {
+            snprintf(name, sizeof(name), "fill_payload/%s", corpus[i].name);
+            bench_run(name, op_fill_payload, &corpus[i]);
+        }
+    }
+
+    block_num = 0;
+    bench_run("block2 fill/find/extract", op_block2, &block_num);
+
+    bench_header("request paths");
+
+    bench_run("udp asemble_request/telemetry", op_request, &udp_handle);
+    bench_run("tcp asemble_request/telemetry", op_request, &tcp_handle);
+    bench_run("udp exchange/long-path", op_exchange, &udp_handle);
+    bench_run("tcp exchange/long-path", op_exchange, &tcp_handle);
+
+    ucoap_handle_init(&udp_persistent_handle, NULL, 0);
+    ucoap_handle_init(&tcp_persistent_handle, NULL, 0);
+
+    bench_header("request paths, persistent buffers");
+
+    bench_run("udp asemble_request/telemetry", op_request, &udp_persistent_handle);
+    bench_run("tcp asemble_request/telemetry", op_request, &tcp_persistent_handle);
+    bench_run("udp exchange/long-path", op_exchange, &udp_persistent_handle);
+    bench_run("tcp exchange/long-path", op_exchange, &tcp_persistent_handle);
+
+    ucoap_zero_copy_rx(&udp_zero_copy_handle, true);
+    ucoap_handle_init(&udp_zero_copy_handle, NULL, 0);
+
+    bench_run("udp exchange/long-path zero-copy rx", op_exchange, &udp_zero_copy_handle);
+
+    ucoap_handle_deinit(&udp_persistent_handle);
+    ucoap_handle_deinit(&tcp_persistent_handle);
+    ucoap_handle_deinit(&udp_zero_copy_handle);
+
+    return 0;
+}
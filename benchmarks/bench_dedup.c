@@ -0,0 +1,216 @@
+/**
+ * bench_dedup.c
+ *
+ * Deduplication of confirmable requests by the server with 1k, 10k and
+ * 100k requests remembered at once: thousands of peers, the clock moves
+ * by EXCHANGE_LIFETIME / entries per request, so the store stays at that
+ * size while the oldest entries expire. One operation is a new request
+ * (lookup and insert) and a retransmission of a recent one (lookup hit).
+ * The store is compared with a linear scan over the same requests.
+ *
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+
+#include "ucoap_dedup.h"
+
+
+#define BENCH_PEERS                  4096
+#define BENCH_RESPONSE_LEN           8
+#define BENCH_MAX_ENTRIES            UCOAP_DEDUP_ENTRIES
+
+
+typedef struct {
+
+    struct ucoap_endpoint endpoint;
+    uint16_t mid;
+    uint32_t expires;
+
+} bench_request;
+
+
+typedef struct {
+
+    uint32_t entries;              /* requests remembered at once */
+    uint32_t now;
+    uint32_t seq;
+
+    /* the linear scan */
+    uint32_t head;
+    uint32_t count;
+
+} bench_case;
+
+
+static struct ucoap_dedup dedup;
+static bench_request scanned[BENCH_MAX_ENTRIES];
+
+static const uint8_t response[BENCH_RESPONSE_LEN] = {
+    0x61, 0x44, 0x00, 0x00, 0x77, 0xc0, 0xff, 0x00
+};
+
+
+/* the request number 'seq': IPv4 address and port of the peer and MID */
+static void
+make_request(const uint32_t seq, struct ucoap_endpoint * const endpoint,
+        uint16_t * const mid) {
+    const uint32_t peer = seq % BENCH_PEERS;
+
+    endpoint->len = 6;
+    endpoint->addr[0] = 10;
+    endpoint->addr[1] = 0;
+    endpoint->addr[2] = peer >> 8;
+    endpoint->addr[3] = peer;
+    endpoint->addr[4] = 0x16;
+    endpoint->addr[5] = 0x33;
+
+    *mid = seq / BENCH_PEERS;
+}
+
+
+static uint32_t
+op_dedup(void * ctx) {
+    bench_case * const c = ctx;
+    uint16_t mid;
+    struct ucoap_endpoint endpoint;
+    const struct ucoap_dedup_entry * entry;
+
+    c->now = (uint64_t)c->seq * dedup.lifetime / c->entries;
+
+    /* a new request */
+    make_request(c->seq++, &endpoint, &mid);
+
+    if (ucoap_dedup_find(&dedup, &endpoint, mid, c->now) == NULL) {
+        ucoap_dedup_add(&dedup, &endpoint, mid, response, sizeof(response), c->now);
+    }
+
+    /* a retransmission of a recent one */
+    make_request(c->seq - 1 - (c->seq * 7919) % (c->entries / 2), &endpoint, &mid);
+    entry = ucoap_dedup_find(&dedup, &endpoint, mid, c->now);
+
+    return entry != NULL ? entry->response_len : 0;
+}
+
+
+static void
+scan_expire(bench_case * const c) {
+    while (c->count && (int32_t)(c->now - scanned[(c->head - c->count) % BENCH_MAX_ENTRIES].expires) >= 0) {
+        c->count--;
+    }
+}
+
+
+static void
+scan_add(bench_case * const c, const struct ucoap_endpoint * const endpoint,
+        const uint16_t mid) {
+    bench_request * const request = &scanned[c->head];
+
+    if (c->count == BENCH_MAX_ENTRIES) {
+        c->count--;
+    }
+
+    request->endpoint = *endpoint;
+    request->mid = mid;
+    request->expires = c->now + dedup.lifetime;
+
+    c->head = (c->head + 1) % BENCH_MAX_ENTRIES;
+    c->count++;
+}
+
+
+static const bench_request *
+scan_find(bench_case * const c, const struct ucoap_endpoint * const endpoint,
+        const uint16_t mid) {
+    uint32_t i;
+    const bench_request * request;
+
+    scan_expire(c);
+
+    for (i = 0; i < c->count; i++) {
+        request = &scanned[(c->head - c->count + i) % BENCH_MAX_ENTRIES];
+
+        if (request->mid == mid && request->endpoint.len == endpoint->len
+                && memcmp(request->endpoint.addr, endpoint->addr, endpoint->len) == 0) {
+            return request;
+        }
+    }
+
+    return NULL;
+}
+
+
+static uint32_t
+op_scan(void * ctx) {
+    bench_case * const c = ctx;
+    uint16_t mid;
+    struct ucoap_endpoint endpoint;
+
+    c->now = (uint64_t)c->seq * dedup.lifetime / c->entries;
+
+    make_request(c->seq++, &endpoint, &mid);
+
+    if (scan_find(c, &endpoint, mid) == NULL) {
+        scan_add(c, &endpoint, mid);
+    }
+
+    make_request(c->seq - 1 - (c->seq * 7919) % (c->entries / 2), &endpoint, &mid);
+
+    return scan_find(c, &endpoint, mid) != NULL ? BENCH_RESPONSE_LEN : 0;
+}
+
+
+static void
+run_case(const uint32_t entries) {
+    uint32_t i;
+    uint16_t mid;
+    char name[64];
+    bench_case c;
+    struct ucoap_endpoint endpoint;
+
+    ucoap_dedup_init(&dedup, &ucoap_default_config);
+
+    memset(&c, 0, sizeof(c));
+    c.entries = entries;
+
+    /* to the steady state: as many entries expire as are added */
+    for (i = 0; i < 2 * entries; i++) {
+        op_dedup(&c);
+    }
+
+    snprintf(name, sizeof(name), "hash+ring/%u", dedup.count);
+    bench_run(name, op_dedup, &c);
+
+    if (dedup.evicted) {
+        printf("%-40s %12u evicted before expiry\n", "", dedup.evicted);
+    }
+
+    memset(&c, 0, sizeof(c));
+    c.entries = entries;
+
+    /* the requests are new, so the lookups are skipped */
+    for (i = 0; i < 2 * entries; i++) {
+        c.now = (uint64_t)c.seq * dedup.lifetime / c.entries;
+        make_request(c.seq++, &endpoint, &mid);
+        scan_expire(&c);
+        scan_add(&c, &endpoint, mid);
+    }
+
+    snprintf(name, sizeof(name), "linear scan/%u", c.count);
+    bench_run(name, op_scan, &c);
+}
+
+
+int
+main(void) {
+    bench_header("server deduplication");
+
+    run_case(1000);
+    run_case(10000);
+    run_case(100000);
+
+    return 0;
+}
@@ -0,0 +1,440 @@
+/**
+ * bench_tcp_assembly.c
+ *
+ * Assembling of CoAP over TCP requests with bodies (options and payload)
+ * around the boundaries of the extended length: 13, 269 and 65805 bytes.
+ * Three ways are reproduced on a plain buffer, so the transaction
+ * bookkeeping does not blur the difference: the previous one (header
+ * length guessed as if the body were below 269 bytes, options moved byte
+ * by byte if the guess was wrong), the length of options computed first
+ * and the frame written in one pass, and the way of the library (header
+ * length predicted by the payload, options encoded again only if they
+ * push the body over a boundary). Every frame is checked against the one
+ * sent by the library.
+ *
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+
+#include "ucoap_utils.h"
+
+
+#define BENCH_MAX_BODY               (65805 + 16)
+#define BENCH_PDU_SIZE               (BENCH_MAX_BODY + 64)
+#define BENCH_TKL                    4
+
+
+typedef struct {
+
+    const char * name;
+    ucoap_option_data options[8];
+    uint32_t options_len;
+
+} bench_options;
+
+
+typedef struct {
+
+    ucoap_request_descriptor reqd;
+    uint8_t frame[BENCH_PDU_SIZE];
+    uint32_t frame_len;
+
+} bench_case;
+
+
+static const struct ucoap_config bench_config = {
+    .max_pdu_size = BENCH_PDU_SIZE,
+    .ack_timeout_ms = UCOAP_ACK_TIMEOUT_MS,
+    .resp_timeout_ms = UCOAP_RESP_TIMEOUT_MS,
+    .max_retransmit = UCOAP_MAX_RETRANSMIT
+};
+
+static struct ucoap_handle tcp_handle = {
+    .name = "bench_tcp",
+    .transport = UCOAP_TCP,
+    .config = &bench_config
+};
+
+static bench_options short_options;
+static bench_options path_options;
+static bench_case bench;
+
+static uint8_t payload[BENCH_MAX_BODY];
+static uint8_t library_frame[BENCH_PDU_SIZE];
+static uint32_t library_frame_len;
+
+
+/* model of the previous assembling */
+
+static void
+previous_shift_data(uint8_t * dst, const uint8_t * src, uint32_t len) {
+    if (dst < src) {
+        while (len--) *dst++ = *src++;
+    } else {
+        while (len--) *dst-- = *src--;
+    }
+}
+
+
+static uint32_t
+previous_asemble_request(uint8_t * const buf, const ucoap_request_descriptor * const reqd) {
+    uint32_t len;
+    uint32_t options_shift;
+    uint32_t options_len;
+    const uint32_t tkl = reqd->tkl;
+
+    options_len = 0;
+    options_shift = 2 + tkl;
+
+    if (reqd->payload.len > 10) {
+        options_shift += 1;
+    }
+
+    if (reqd->options != NULL) {
+        options_len += encoding_options(buf + options_shift, reqd->options);
+    }
+
+    len = options_len + (reqd->payload.len ? reqd->payload.len + 1 : 0);
+
+    if (len < 13) {
+        buf[0] = (len << 4) | tkl;
+        buf[1] = reqd->code;
+
+        if (options_shift > 2 + tkl) {
+            previous_shift_data(buf + tkl + 2, buf + options_shift, options_len);
+        }
+
+        len = 2;
+    } else if (len < 269) {
+        buf[0] = (13 << 4) | tkl;
+        buf[1] = len - 13;
+
+        if (options_shift > tkl + 3) {
+            previous_shift_data(buf + tkl + 3, buf + options_shift, options_len);
+        } else if (options_shift < tkl + 3) {
+            previous_shift_data(buf + options_len + tkl + 2,
+                    buf + options_shift + options_len - 1, options_len);
+        }
+
+        buf[2] = reqd->code;
+        len = 3;
+    } else if (len < 65805) {
+        buf[0] = (14 << 4) | tkl;
+
+        if (options_shift > tkl + 4) {
+            previous_shift_data(buf + tkl + 4, buf + options_shift, options_len);
+        } else if (options_shift < tkl + 4) {
+            previous_shift_data(buf + options_len + tkl + 3,
+                    buf + options_shift + options_len - 1, options_len);
+        }
+
+        buf[1] = (len - 269) >> 8;
+        buf[2] = (len - 269);
+        buf[3] = reqd->code;
+        len = 4;
+    } else {
+        buf[0] = (15 << 4) | tkl;
+
+        if (options_shift < tkl + 6) {
+            previous_shift_data(buf + options_len + tkl + 5,
+                    buf + options_shift + options_len - 1, options_len);
+        }
+
+        buf[1] = (len - 65805) >> 24;
+        buf[2] = (len - 65805) >> 16;
+        buf[3] = (len - 65805) >> 8;
+        buf[4] = (len - 65805);
+        buf[5] = reqd->code;
+        len = 6;
+    }
+
+    ucoap_fill_token(&tcp_handle, buf + len, tkl);
+    len += tkl + options_len;
+
+    if (reqd->payload.len) {
+        len += fill_payload(buf + len, &reqd->payload);
+    }
+
+    return len;
+}
+
+
+static uint32_t
+op_previous(void * ctx) {
+    bench_case * const c = ctx;
+
+    c->frame_len = previous_asemble_request(c->frame, &c->reqd);
+    ucoap_tx_data(&tcp_handle, c->frame, c->frame_len);
+
+    return c->frame_len;
+}
+
+
+/* the length of options first, then one pass */
+
+static uint32_t
+fill_length(uint8_t * const buf, const uint32_t tkl, const uint32_t data_len) {
+    uint32_t len;
+
+    len = 1;
+
+    if (data_len < 13) {
+        buf[0] = (data_len << 4) | tkl;
+    } else if (data_len < 269) {
+        buf[0] = (13 << 4) | tkl;
+        buf[len++] = data_len - 13;
+    } else if (data_len < 65805) {
+        buf[0] = (14 << 4) | tkl;
+        buf[len++] = (data_len - 269) >> 8;
+        buf[len++] = (data_len - 269);
+    } else {
+        buf[0] = (15 << 4) | tkl;
+        buf[len++] = (data_len - 65805) >> 24;
+        buf[len++] = (data_len - 65805) >> 16;
+        buf[len++] = (data_len - 65805) >> 8;
+        buf[len++] = (data_len - 65805);
+    }
+
+    return len;
+}
+
+
+static uint32_t
+single_pass_asemble_request(uint8_t * const buf, const ucoap_request_descriptor * const reqd) {
+    uint32_t len;
+    uint32_t options_len;
+
+    options_len = encoded_options_length(reqd->options);
+    len = fill_length(buf, reqd->tkl,
+            options_len + (reqd->payload.len ? reqd->payload.len + 1 : 0));
+    buf[len++] = reqd->code;
+
+    ucoap_fill_token(&tcp_handle, buf + len, reqd->tkl);
+    len += reqd->tkl;
+
+    if (reqd->options != NULL) {
+        len += encoding_options(buf + len, reqd->options);
+    }
+
+    if (reqd->payload.len) {
+        len += fill_payload(buf + len, &reqd->payload);
+    }
+
+    return len;
+}
+
+
+static uint32_t
+op_single_pass(void * ctx) {
+    bench_case * const c = ctx;
+
+    c->frame_len = single_pass_asemble_request(c->frame, &c->reqd);
+    ucoap_tx_data(&tcp_handle, c->frame, c->frame_len);
+
+    return c->frame_len;
+}
+
+
+/* as 'asemble_request' of ucoap_tcp.c does it */
+
+static uint32_t
+length_field_size(const uint32_t data_len) {
+    if (data_len < 13) {
+        return 1;
+    }
+
+    if (data_len < 269) {
+        return 2;
+    }
+
+    return data_len < 65805 ? 3 : 5;
+}
+
+
+static uint32_t
+library_asemble_request(uint8_t * const buf, const ucoap_request_descriptor * const reqd) {
+    uint32_t idx;
+    uint32_t len;
+    uint32_t payload_len;
+    uint32_t options_len;
+
+    payload_len = reqd->payload.len ? reqd->payload.len + 1 : 0;
+    idx = length_field_size(payload_len) + 1 + reqd->tkl;
+    options_len = 0;
+
+    if (reqd->options != NULL) {
+        options_len = encoding_options(buf + idx, reqd->options);
+    }
+
+    if (length_field_size(options_len + payload_len) != length_field_size(payload_len)) {
+        idx = length_field_size(options_len + payload_len) + 1 + reqd->tkl;
+        encoding_options(buf + idx, reqd->options);
+    }
+
+    len = fill_length(buf, reqd->tkl, options_len + payload_len);
+    buf[len++] = reqd->code;
+
+    ucoap_fill_token(&tcp_handle, buf + len, reqd->tkl);
+    len = idx + options_len;
+
+    if (reqd->payload.len) {
+        len += fill_payload(buf + len, &reqd->payload);
+    }
+
+    return len;
+}
+
+
+static uint32_t
+op_library(void * ctx) {
+    bench_case * const c = ctx;
+
+    c->frame_len = library_asemble_request(c->frame, &c->reqd);
+    ucoap_tx_data(&tcp_handle, c->frame, c->frame_len);
+
+    return c->frame_len;
+}
+
+
+static void
+keep_frame(struct ucoap_handle * const handle, const uint8_t * buf,
+        const uint32_t len) {
+    (void)handle;
+
+    memcpy(library_frame, buf, len);
+    library_frame_len = len;
+}
+
+
+static void
+add_option(bench_options * const o, const uint32_t idx, const uint16_t num,
+        const char * value) {
+    o->options[idx].num = num;
+    o->options[idx].len = strlen(value);
+    o->options[idx].value = (uint8_t *)value;
+    o->options[idx].next = NULL;
+
+    if (idx > 0) {
+        o->options[idx - 1].next = &o->options[idx];
+    }
+
+    o->options_len = encoded_options_length(o->options);
+}
+
+
+static void
+prepare_options(void) {
+    uint32_t i;
+
+    static const char * path[] = {
+        "api", "v1", "devices", "0042", "sensors", "temperature", "history", "latest"
+    };
+
+    short_options.name = "short";
+    add_option(&short_options, 0, UCOAP_URI_PATH_OPT, "fw");
+    add_option(&short_options, 1, UCOAP_CONTENT_FORMAT_OPT, "\x2a");
+
+    path_options.name = "long-path";
+
+    for (i = 0; i < sizeof(path) / sizeof(path[0]); i++) {
+        add_option(&path_options, i, UCOAP_URI_PATH_OPT, path[i]);
+    }
+}
+
+
+/* the library has to send the same frame, but the token */
+static bool
+same_frames(const bench_case * const c) {
+    uint32_t header_len;
+
+    if (c->frame_len != library_frame_len) {
+        return false;
+    }
+
+    /* Len/TKL, extended length and code */
+    header_len = c->frame_len - BENCH_TKL - encoded_options_length(c->reqd.options)
+            - (c->reqd.payload.len ? c->reqd.payload.len + 1 : 0);
+
+    return memcmp(c->frame, library_frame, header_len) == 0
+            && memcmp(c->frame + header_len + BENCH_TKL, library_frame + header_len + BENCH_TKL,
+                    c->frame_len - header_len - BENCH_TKL) == 0;
+}
+
+
+static void
+run_case(const bench_options * const o, const uint32_t body) {
+    char name[64];
+
+    if (body < o->options_len + 2) {
+        return;
+    }
+
+    bench.reqd.type = UCOAP_MESSAGE_NON;
+    bench.reqd.code = UCOAP_REQ_POST;
+    bench.reqd.tkl = BENCH_TKL;
+    bench.reqd.options = (ucoap_option_data *)o->options;
+    bench.reqd.payload.buf = payload;
+    bench.reqd.payload.len = body - o->options_len - 1;
+    bench.reqd.response_callback = NULL;
+
+    bench_tx_hook = keep_frame;
+    ucoap_submit_coap_request(&tcp_handle, &bench.reqd, 0);
+    bench_tx_hook = NULL;
+
+    op_previous(&bench);
+
+    if (!same_frames(&bench)) {
+        printf("%s/%u: frames differ\n", o->name, body);
+        return;
+    }
+
+    op_single_pass(&bench);
+
+    if (!same_frames(&bench)) {
+        printf("%s/%u: frames differ\n", o->name, body);
+        return;
+    }
+
+    op_library(&bench);
+
+    if (!same_frames(&bench)) {
+        printf("%s/%u: frames differ\n", o->name, body);
+        return;
+    }
+
+    snprintf(name, sizeof(name), "previous/%s/%u", o->name, body);
+    bench_run(name, op_previous, &bench);
+
+    snprintf(name, sizeof(name), "length first/%s/%u", o->name, body);
+    bench_run(name, op_single_pass, &bench);
+
+    snprintf(name, sizeof(name), "library/%s/%u", o->name, body);
+    bench_run(name, op_library, &bench);
+}
+
+
+int
+main(void) {
+    uint32_t i;
+    static const uint32_t bodies[] = { 13, 100, 268, 269, 1024, 65804, 65805 };
+
+    memset(payload, 'x', sizeof(payload));
+    prepare_options();
+
+    ucoap_handle_init(&tcp_handle, NULL, 0);
+
+    bench_header("tcp request assembling");
+
+    for (i = 0; i < sizeof(bodies) / sizeof(bodies[0]); i++) {
+        run_case(&short_options, bodies[i]);
+        run_case(&path_options, bodies[i]);
+    }
+
+    ucoap_handle_deinit(&tcp_handle);
+
+    return 0;
+}
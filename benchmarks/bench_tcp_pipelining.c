@@ -0,0 +1,225 @@
+/**
+ * bench_tcp_pipelining.c
+ *
+ * A batch of GET requests in flight over one CoAP over TCP connection
+ * (a local socket pair), the responses come back in reverse order and
+ * are matched by token. Every frame is written by its own 'ucoap_tx_data'
+ * call, or the frames are coalesced and the batch is written at once.
+ * One operation is the whole batch: submitting, writing, answering by the
+ * peer and receiving by 'ucoap_rx_stream'.
+ *
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "bench.h"
+
+#include "ucoap_utils.h"
+
+
+#define BENCH_BATCH                  UCOAP_MAX_TRANSACTIONS
+#define BENCH_TKL                    4
+#define BENCH_STREAM_SIZE            (BENCH_BATCH * 64)
+
+
+static struct ucoap_handle tcp_handle = {
+    .name = "bench_tcp",
+    .transport = UCOAP_TCP
+};
+
+static int client_fd;
+static int server_fd;
+static uint32_t writes;
+static uint32_t responses;
+
+static uint8_t batch_buf[BENCH_STREAM_SIZE];
+static uint8_t stream[BENCH_STREAM_SIZE];
+
+static ucoap_option_data path[2];
+static ucoap_request_descriptor reqd;
+
+
+static void
+write_frames(struct ucoap_handle * const handle, const uint8_t * buf,
+        const uint32_t len) {
+    (void)handle;
+
+    writes++;
+
+    if (write(client_fd, buf, len) != (ssize_t)len) {
+        perror("write");
+    }
+}
+
+
+static void
+response_callback(const struct ucoap_request_descriptor * const reqd,
+        const ucoap_result_data * const result) {
+    (void)reqd;
+
+    if (result->err == UCOAP_OK && result->resp_code == UCOAP_RESP_SUCCESS_CONTENT_205) {
+        responses++;
+    }
+}
+
+
+/* the peer: read the requests, answer them in reverse order at once */
+static void
+answer_requests(void) {
+    uint32_t i;
+    uint32_t len;
+    uint32_t parsed;
+    uint32_t count;
+    uint32_t frame_len;
+    uint32_t offsets[BENCH_BATCH];
+    uint8_t answer[BENCH_STREAM_SIZE];
+    ssize_t got;
+
+    len = 0;
+    parsed = 0;
+    count = 0;
+
+    while (count < BENCH_BATCH) {
+        got = read(server_fd, stream + len, sizeof(stream) - len);
+
+        if (got <= 0) {
+            perror("read");
+            return;
+        }
+
+        len += got;
+
+        /* Len is 13 at most for these requests */
+        while (count < BENCH_BATCH && len - parsed >= 2) {
+            frame_len = 2 + BENCH_TKL + ((stream[parsed] >> 4) == 13
+                    ? 1 + stream[parsed + 1] + 13 : (stream[parsed] >> 4));
+
+            if (len - parsed < frame_len) {
+                break;
+            }
+
+            offsets[count++] = parsed;
+            parsed += frame_len;
+        }
+    }
+
+    len = 0;
+
+    for (i = count; i > 0; i--) {
+        const uint8_t * const request = stream + offsets[i - 1];
+        const uint32_t token_idx = (request[0] >> 4) == 13 ? 3 : 2;
+
+        answer[len++] = (5 << 4) | BENCH_TKL;
+        answer[len++] = UCOAP_RESP_SUCCESS_CONTENT_205;
+        memcpy(answer + len, request + token_idx, BENCH_TKL);
+        len += BENCH_TKL;
+        answer[len++] = 0xff;
+        memcpy(answer + len, "21.5", 4);
+        len += 4;
+    }
+
+    if (write(server_fd, answer, len) != (ssize_t)len) {
+        perror("write");
+    }
+}
+
+
+static uint32_t
+op_batch(void * ctx) {
+    uint32_t i;
+    uint32_t bytes;
+    ssize_t got;
+    uint8_t chunk[BENCH_STREAM_SIZE];
+
+    (void)ctx;
+
+    responses = 0;
+    bytes = 0;
+
+    for (i = 0; i < BENCH_BATCH; i++) {
+        ucoap_submit_coap_request(&tcp_handle, &reqd, 0);
+    }
+
+    ucoap_tcp_flush(&tcp_handle);
+    answer_requests();
+
+    while (responses < BENCH_BATCH) {
+        got = read(client_fd, chunk, sizeof(chunk));
+
+        if (got <= 0) {
+            perror("read");
+            break;
+        }
+
+        bytes += got;
+        ucoap_rx_stream(&tcp_handle, chunk, got, 0);
+    }
+
+    return bytes;
+}
+
+
+static void
+run_case(const char * name, uint8_t * const buf, const uint32_t size) {
+    uint32_t batch_writes;
+
+    ucoap_tcp_coalesce(&tcp_handle, buf, size);
+
+    writes = 0;
+    op_batch(NULL);
+    batch_writes = writes;
+
+    bench_run(name, op_batch, NULL);
+    printf("%-40s %12u writes per %u requests\n", "", batch_writes, BENCH_BATCH);
+}
+
+
+int
+main(void) {
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        perror("socketpair");
+        return 1;
+    }
+
+    client_fd = fds[0];
+    server_fd = fds[1];
+
+    path[0].num = UCOAP_URI_PATH_OPT;
+    path[0].len = 7;
+    path[0].value = (uint8_t *)"sensors";
+    path[0].next = &path[1];
+    path[1].num = UCOAP_URI_PATH_OPT;
+    path[1].len = 4;
+    path[1].value = (uint8_t *)"temp";
+    path[1].next = NULL;
+
+    reqd.type = UCOAP_MESSAGE_NON;
+    reqd.code = UCOAP_REQ_GET;
+    reqd.tkl = BENCH_TKL;
+    reqd.options = path;
+    reqd.payload.buf = NULL;
+    reqd.payload.len = 0;
+    reqd.response_callback = response_callback;
+
+    ucoap_handle_init(&tcp_handle, NULL, 0);
+    bench_tx_hook = write_frames;
+
+    bench_header("tcp pipelining");
+
+    run_case("frame per write", NULL, 0);
+    run_case("coalesced", batch_buf, sizeof(batch_buf));
+
+    bench_tx_hook = NULL;
+    ucoap_handle_deinit(&tcp_handle);
+
+    close(client_fd);
+    close(server_fd);
+
+    return 0;
+}
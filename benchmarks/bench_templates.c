@@ -0,0 +1,224 @@
+/**
+ * bench_templates.c
+ *
+ * Periodic requests with the same options and a new payload each time:
+ * the descriptor (options encoded by every send) against the template
+ * (options encoded once by 'ucoap_template_init'), over UDP and TCP.
+ * The requests are NON without callback, so one operation is the whole
+ * send through the library: transaction, assembling and transmission.
+ * The frames of both are checked to be the same but Message ID and token.
+ *
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+
+#include "ucoap_utils.h"
+
+
+#define BENCH_TKL                    4
+#define BENCH_PAYLOAD_LEN            16
+
+
+typedef struct {
+
+    const char * name;
+    ucoap_option_data options[10];
+
+} bench_options;
+
+
+typedef struct {
+
+    struct ucoap_handle * handle;
+    ucoap_request_descriptor reqd;
+    struct ucoap_request_template tmpl;
+    ucoap_data payload;
+
+} bench_case;
+
+
+static struct ucoap_handle udp_handle = {
+    .name = "bench_udp",
+    .transport = UCOAP_UDP
+};
+
+static struct ucoap_handle tcp_handle = {
+    .name = "bench_tcp",
+    .transport = UCOAP_TCP
+};
+
+static bench_options telemetry_options;
+static bench_options path_options;
+static bench_case bench;
+
+static uint8_t payload[BENCH_PAYLOAD_LEN];
+static uint8_t frames[2][UCOAP_MAX_PDU_SIZE];
+static uint32_t frame_lens[2];
+static uint32_t frame_idx;
+
+
+static uint32_t
+op_descriptor(void * ctx) {
+    bench_case * const c = ctx;
+
+    /* a new reading */
+    payload[0]++;
+
+    ucoap_submit_coap_request(c->handle, &c->reqd, 0);
+
+    return c->reqd.payload.len;
+}
+
+
+static uint32_t
+op_template(void * ctx) {
+    bench_case * const c = ctx;
+
+    payload[0]++;
+
+    ucoap_submit_template(c->handle, &c->tmpl, &c->payload, 0);
+
+    return c->payload.len;
+}
+
+
+static void
+keep_frame(struct ucoap_handle * const handle, const uint8_t * buf,
+        const uint32_t len) {
+    (void)handle;
+
+    memcpy(frames[frame_idx], buf, len);
+    frame_lens[frame_idx] = len;
+}
+
+
+static void
+add_option(bench_options * const o, const uint32_t idx, const uint16_t num,
+        const char * value) {
+    o->options[idx].num = num;
+    o->options[idx].len = strlen(value);
+    o->options[idx].value = (uint8_t *)value;
+    o->options[idx].next = NULL;
+
+    if (idx > 0) {
+        o->options[idx - 1].next = &o->options[idx];
+    }
+}
+
+
+static void
+prepare_options(void) {
+    uint32_t i;
+
+    static const char * path[] = {
+        "api", "v1", "devices", "0042", "sensors", "temperature", "history", "latest"
+    };
+
+    telemetry_options.name = "telemetry";
+    add_option(&telemetry_options, 0, UCOAP_URI_PATH_OPT, "api");
+    add_option(&telemetry_options, 1, UCOAP_URI_PATH_OPT, "v1");
+    add_option(&telemetry_options, 2, UCOAP_URI_PATH_OPT, "telemetry");
+    add_option(&telemetry_options, 3, UCOAP_CONTENT_FORMAT_OPT, "\x3c");
+    add_option(&telemetry_options, 4, UCOAP_ACCEPT_OPT, "\x3c");
+
+    path_options.name = "long-path";
+
+    for (i = 0; i < sizeof(path) / sizeof(path[0]); i++) {
+        add_option(&path_options, i, UCOAP_URI_PATH_OPT, path[i]);
+    }
+
+    add_option(&path_options, i, UCOAP_CONTENT_FORMAT_OPT, "\x3c");
+}
+
+
+/* the same frames, but Message ID (UDP) and token */
+static bool
+same_frames(const struct ucoap_handle * const handle) {
+    uint32_t skip_at;
+    uint32_t skip_len;
+
+    if (frame_lens[0] != frame_lens[1]) {
+        return false;
+    }
+
+    if (handle->transport == UCOAP_UDP) {
+        skip_at = 2;
+        skip_len = 2 + BENCH_TKL;
+    } else {
+        /* Len/TKL, extended length and code */
+        skip_at = (frames[0][0] >> 4) == 13 ? 3 : (frames[0][0] >> 4) == 14 ? 4 : 2;
+        skip_len = BENCH_TKL;
+    }
+
+    return memcmp(frames[0], frames[1], skip_at) == 0
+            && memcmp(frames[0] + skip_at + skip_len, frames[1] + skip_at + skip_len,
+                    frame_lens[0] - skip_at - skip_len) == 0;
+}
+
+
+static void
+run_case(struct ucoap_handle * const handle, const bench_options * const o) {
+    char name[64];
+    const char * transport;
+
+    transport = handle->transport == UCOAP_UDP ? "udp" : "tcp";
+
+    bench.handle = handle;
+    bench.reqd.type = UCOAP_MESSAGE_NON;
+    bench.reqd.code = UCOAP_REQ_POST;
+    bench.reqd.tkl = BENCH_TKL;
+    bench.reqd.options = (ucoap_option_data *)o->options;
+    bench.reqd.payload.buf = payload;
+    bench.reqd.payload.len = sizeof(payload);
+    bench.reqd.response_callback = NULL;
+    bench.payload = bench.reqd.payload;
+
+    if (ucoap_template_init(handle, &bench.tmpl, &bench.reqd) != UCOAP_OK) {
+        printf("%s/%s: options exceed the template\n", transport, o->name);
+        return;
+    }
+
+    bench_tx_hook = keep_frame;
+    frame_idx = 0;
+    ucoap_submit_coap_request(handle, &bench.reqd, 0);
+    frame_idx = 1;
+    ucoap_submit_template(handle, &bench.tmpl, &bench.payload, 0);
+    bench_tx_hook = NULL;
+
+    if (!same_frames(handle)) {
+        printf("%s/%s: frames differ\n", transport, o->name);
+        return;
+    }
+
+    snprintf(name, sizeof(name), "%s descriptor/%s", transport, o->name);
+    bench_run(name, op_descriptor, &bench);
+
+    snprintf(name, sizeof(name), "%s template/%s", transport, o->name);
+    bench_run(name, op_template, &bench);
+}
+
+
+int
+main(void) {
+    memset(payload, 'x', sizeof(payload));
+    prepare_options();
+
+    ucoap_handle_init(&udp_handle, NULL, 0);
+    ucoap_handle_init(&tcp_handle, NULL, 0);
+
+    bench_header("request templates");
+
+    run_case(&udp_handle, &telemetry_options);
+    run_case(&udp_handle, &path_options);
+    run_case(&tcp_handle, &telemetry_options);
+    run_case(&tcp_handle, &path_options);
+
+    ucoap_handle_deinit(&udp_handle);
+    ucoap_handle_deinit(&tcp_handle);
+
+    return 0;
+}
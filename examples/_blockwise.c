@@ -86,16 +86,14 @@ static void get_config_response_callback(const struct ucoap_request_descriptor *
 {
     (void)reqd;
 
-    const ucoap_option_data * block2;
+    ucoap_option_data block2;
     ucoap_blockwise_data bw;
 
     if (UCOAP_EXTRACT_CLASS(result->resp_code) == UCOAP_SUCCESS_CLASS && result->payload.len > 0)
     {
         /* get block2 option */
-        block2 = ucoap_find_option_by_number(result->options, UCOAP_BLOCK2_OPT);
-
-        if (block2 != NULL) {
-            ucoap_extract_block2_from_opt(block2, &bw);
+        if (ucoap_find_option(&result->options, UCOAP_BLOCK2_OPT, &block2)) {
+            ucoap_extract_block2_from_opt(&block2, &bw);
 
             /* shift counters */
             config_manager.block_num = bw.fld.num;
@@ -42,6 +42,9 @@ __ucoap_error ucoap_tx_signal(__ucoap_handle * const handle, const __ucoap_out_s
         case UCOAP_TX_ACK_PACKET:
             break;
 
+        case UCOAP_TX_RST_PACKET:
+            break;
+
         case UCOAP_ACK_DID_RECEIVE:
             break;
 
@@ -61,6 +64,21 @@ __ucoap_error ucoap_tx_signal(__ucoap_handle * const handle, const __ucoap_out_s
             rtos_send_event(UCOAP_DATA_DID_RECEIVE_EVENTGR);
             break;
 
+        case UCOAP_TX_ABORT_PACKET:
+            break;
+
+        case UCOAP_TCP_CSM_DID_RECEIVE:
+            break;
+
+        case UCOAP_TCP_PONG_DID_RECEIVE:
+            break;
+
+        case UCOAP_TCP_PING_TIMEOUT:
+        case UCOAP_TCP_RELEASE_DID_RECEIVE:
+        case UCOAP_TCP_ABORT_DID_RECEIVE:
+            /* close the connection */
+            break;
+
         default:
             return UCOAP_PARAM_ERROR;
     }
@@ -119,6 +137,16 @@ __ucoap_error ucoap_fill_token(__ucoap_handle * const handle, uint8_t *token, co
 }
 
 
+#ifdef UCOAP_RANDOM_HOOK
+uint32_t ucoap_random(__ucoap_handle * const handle)
+{
+    (void)handle;
+
+    return rtos_get_random();
+}
+#endif /* UCOAP_RANDOM_HOOK */
+
+
 __ucoap_error ucoap_alloc_mem_block(uint8_t **block, const uint32_t min_len)
 {
     bool success;
@@ -12,27 +12,636 @@
 #include "ucoap_udp.h"
 #include "ucoap_tcp.h"
 #include "ucoap_utils.h"
+#include "ucoap_helpers.h"
 
 
+const struct ucoap_config ucoap_default_config = UCOAP_DEFAULT_CONFIG;
+
+
+static struct ucoap_transaction *
+reserve_transaction(struct ucoap_handle * const handle);
 static enum ucoap_error
 init_coap_driver(struct ucoap_handle * const handle,
-        const ucoap_request_descriptor * const reqd);
+        struct ucoap_transaction * const trans,
+        const ucoap_request_descriptor * const reqd,
+        const struct ucoap_request_template * const tmpl);
+static void
+deinit_coap_driver(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans);
+static struct ucoap_transaction *
+route_packet(struct ucoap_handle * const handle,
+        const uint8_t * buf, const uint32_t len);
 static void
-deinit_coap_driver(struct ucoap_handle * handle);
+reject_packet(struct ucoap_handle * const handle,
+        const uint8_t * buf, const uint32_t len);
+static void
+process_transaction(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const uint32_t now);
+static void
+finish_transaction(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans);
+static enum ucoap_error
+submit_transaction(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const uint32_t now);
+static enum ucoap_error
+send_request(struct ucoap_handle * const handle,
+        const ucoap_request_descriptor * const reqd,
+        const struct ucoap_request_template * const tmpl);
+static enum ucoap_error
+submit_request(struct ucoap_handle * const handle,
+        const ucoap_request_descriptor * const reqd,
+        const struct ucoap_request_template * const tmpl,
+        const uint32_t now, const uint16_t status);
+static struct ucoap_transaction *
+oldest_transaction(struct ucoap_handle * const handle, const uint16_t status,
+        const uint16_t skip);
+static uint32_t
+outstanding_requests(const struct ucoap_handle * const handle);
+static void
+dispatch_queued(struct ucoap_handle * const handle, const uint32_t now);
+static void
+complete_in_order(struct ucoap_handle * const handle);
+
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_debug(struct ucoap_handle * const handle, const bool enable) {
+    if (enable) {
+        UCOAP_SET_STATUS(handle, UCOAP_DEBUG_ON);
+    } else {
+        UCOAP_RESET_STATUS(handle, UCOAP_DEBUG_ON);
+    }
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_zero_copy_rx(struct ucoap_handle * const handle, const bool enable) {
+    if (enable) {
+        UCOAP_SET_STATUS(handle, UCOAP_ZERO_COPY_RX);
+    } else {
+        UCOAP_RESET_STATUS(handle, UCOAP_ZERO_COPY_RX);
+    }
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_adaptive_rto(struct ucoap_handle * const handle, const bool enable) {
+    handle->rto.rto = 0;
+    handle->rto.updated_at = 0;
+    handle->rto.strong_srtt = 0;
+    handle->rto.strong_rttvar = 0;
+    handle->rto.weak_srtt = 0;
+    handle->rto.weak_rttvar = 0;
+
+    if (enable) {
+        UCOAP_SET_STATUS(handle, UCOAP_ADAPTIVE_RTO);
+    } else {
+        UCOAP_RESET_STATUS(handle, UCOAP_ADAPTIVE_RTO);
+    }
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_in_order(struct ucoap_handle * const handle, const bool enable) {
+    if (enable) {
+        UCOAP_SET_STATUS(handle, UCOAP_IN_ORDER);
+    } else {
+        UCOAP_RESET_STATUS(handle, UCOAP_IN_ORDER);
+    }
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_handle_init(struct ucoap_handle * const handle, uint8_t * const storage,
+        const uint32_t len) {
+    uint32_t i;
+    enum ucoap_error err;
+    uint32_t pdu_size;
+    struct ucoap_transaction * trans;
+
+    bool zero_copy;
+
+    zero_copy = UCOAP_CHECK_STATUS(handle, UCOAP_ZERO_COPY_RX);
+
+    pdu_size = UCOAP_PDU_SIZE(handle);
+
+    if (storage != NULL && len < ucoap_handle_storage_size(handle)) {
+        return UCOAP_PARAM_ERROR;
+    }
+
+    for (i = 0; i < UCOAP_MAX_TRANSACTIONS; i++) {
+        trans = &handle->transactions[i];
+
+        if (storage != NULL && zero_copy) {
+            trans->request.buf = storage + i * pdu_size;
+            continue;
+        }
+
+        if (storage != NULL) {
+            trans->request.buf = storage + (2 * i) * pdu_size;
+            trans->response.buf = storage + (2 * i + 1) * pdu_size;
+            continue;
+        }
+
+        err = ucoap_alloc_mem_block(&trans->request.buf, pdu_size);
+
+        if (err == UCOAP_OK && !zero_copy) {
+            err = ucoap_alloc_mem_block(&trans->response.buf, pdu_size);
+        }
+
+        if (err != UCOAP_OK) {
+            UCOAP_SET_STATUS(handle, UCOAP_PERSISTENT_BUFS);
+            ucoap_handle_deinit(handle);
+            return err;
+        }
+    }
+
+    UCOAP_SET_STATUS(handle, UCOAP_PERSISTENT_BUFS);
+
+    if (storage != NULL) {
+        UCOAP_SET_STATUS(handle, UCOAP_STATIC_BUFS);
+    }
+
+    return UCOAP_OK;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+uint32_t
+ucoap_handle_storage_size(const struct ucoap_handle * const handle) {
+    uint32_t size;
+
+    size = UCOAP_MAX_TRANSACTIONS * UCOAP_PDU_SIZE(handle);
+
+    if (!UCOAP_CHECK_STATUS(handle, UCOAP_ZERO_COPY_RX)) {
+        size *= 2;
+    }
+
+    return size;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_handle_deinit(struct ucoap_handle * const handle) {
+    uint32_t i;
+    struct ucoap_transaction * trans;
+
+    if (!UCOAP_CHECK_STATUS(handle, UCOAP_PERSISTENT_BUFS)) {
+        return;
+    }
+
+    for (i = 0; i < UCOAP_MAX_TRANSACTIONS; i++) {
+        trans = &handle->transactions[i];
+
+        if (!UCOAP_CHECK_STATUS(handle, UCOAP_STATIC_BUFS)) {
+            if (trans->request.buf != NULL) {
+                ucoap_free_mem_block(trans->request.buf, UCOAP_PDU_SIZE(handle));
+            }
+
+            if (trans->response.buf != NULL) {
+                ucoap_free_mem_block(trans->response.buf, UCOAP_PDU_SIZE(handle));
+            }
+        }
+
+        trans->request.buf = NULL;
+        trans->response.buf = NULL;
+    }
+
+    UCOAP_RESET_STATUS(handle, UCOAP_PERSISTENT_BUFS | UCOAP_STATIC_BUFS);
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_send_coap_request(struct ucoap_handle * const handle,
+        const ucoap_request_descriptor * const reqd) {
+    return send_request(handle, reqd, NULL);
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_submit_coap_request(struct ucoap_handle * const handle,
+        const ucoap_request_descriptor * const reqd,
+        const uint32_t now) {
+    return submit_request(handle, reqd, NULL, now, UCOAP_TRANS_ASYNC);
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_template_init(struct ucoap_handle * const handle,
+        struct ucoap_request_template * const tmpl,
+        const ucoap_request_descriptor * const reqd) {
+    uint32_t options_len;
+
+    options_len = encoded_options_length(reqd->options);
+
+    /* the request without payload has to fit the buffers of the handle */
+    if (options_len > UCOAP_TEMPLATE_OPTIONS_SIZE || request_frame_length(handle->transport,
+                reqd->tkl, options_len, 0) > UCOAP_PDU_SIZE(handle)) {
+        return UCOAP_PARAM_ERROR;
+    }
+
+    tmpl->reqd = *reqd;
+    tmpl->reqd.options = NULL;
+    tmpl->reqd.payload.buf = NULL;
+    tmpl->reqd.payload.len = 0;
+    tmpl->options_len = 0;
+
+    if (reqd->options != NULL) {
+        tmpl->options_len = encoding_options(tmpl->options, reqd->options);
+    }
+
+    return UCOAP_OK;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_send_template(struct ucoap_handle * const handle,
+        struct ucoap_request_template * const tmpl,
+        const ucoap_data * const payload) {
+    tmpl->reqd.payload = *payload;
+
+    return send_request(handle, &tmpl->reqd, tmpl);
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_submit_template(struct ucoap_handle * const handle,
+        struct ucoap_request_template * const tmpl,
+        const ucoap_data * const payload,
+        const uint32_t now) {
+    uint32_t i;
+
+    /* the payload of the request in flight is in the template */
+    for (i = 0; i < UCOAP_MAX_TRANSACTIONS; i++) {
+        if (UCOAP_CHECK_STATUS(&handle->transactions[i], UCOAP_TRANS_BUSY)
+                && handle->transactions[i].reqd == &tmpl->reqd) {
+            return UCOAP_BUSY_ERROR;
+        }
+    }
+
+    tmpl->reqd.payload = *payload;
+
+    return submit_request(handle, &tmpl->reqd, tmpl, now, UCOAP_TRANS_ASYNC);
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_observe(struct ucoap_handle * const handle,
+        const ucoap_request_descriptor * const reqd,
+        const uint32_t now) {
+    if (reqd->code != UCOAP_REQ_GET || reqd->response_callback == NULL
+            || reqd->options == NULL
+            || ucoap_find_option_by_number(reqd->options, UCOAP_OBSERVE_OPT) == NULL) {
+        return UCOAP_PARAM_ERROR;
+    }
+
+    return submit_request(handle, reqd, NULL, now,
+            UCOAP_TRANS_ASYNC | UCOAP_TRANS_OBSERVE);
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_cancel_observe(struct ucoap_handle * const handle,
+        const ucoap_request_descriptor * const reqd) {
+    uint32_t i;
+    struct ucoap_transaction * trans;
+
+    for (i = 0; i < UCOAP_MAX_TRANSACTIONS; i++) {
+        trans = &handle->transactions[i];
+
+        if (UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_OBSERVE)
+                && trans->reqd == reqd) {
+            deinit_coap_driver(handle, trans);
+
+            ucoap_tx_signal(handle, UCOAP_ROUTINE_PACKET_DID_FINISH);
+            return UCOAP_OK;
+        }
+    }
+
+    return UCOAP_WRONG_STATE_ERROR;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_process(struct ucoap_handle * const handle, const uint32_t now) {
+    uint32_t i;
+    struct ucoap_transaction * trans;
+
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_TCP_SIGNALING)) {
+        ucoap_process_signaling_tcp(handle, now);
+    }
+
+    for (i = 0; i < UCOAP_MAX_TRANSACTIONS; i++) {
+        trans = &handle->transactions[i];
+
+        if (UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_ASYNC)
+                && !UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_QUEUED | UCOAP_TRANS_DONE)) {
+            process_transaction(handle, trans, now);
+            finish_transaction(handle, trans);
+        }
+    }
+
+    complete_in_order(handle);
+    dispatch_queued(handle, now);
+
+    if (handle->transport == UCOAP_TCP) {
+        return ucoap_flush_tcp(handle);
+    }
+
+    return UCOAP_OK;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+bool
+ucoap_next_deadline(struct ucoap_handle * const handle,
+        uint32_t * const deadline) {
+    uint32_t i;
+    bool found;
+    struct ucoap_transaction * trans;
+
+    found = false;
+
+    for (i = 0; i < UCOAP_MAX_TRANSACTIONS; i++) {
+        trans = &handle->transactions[i];
+
+        if (!UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_ASYNC)
+                || UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_QUEUED | UCOAP_TRANS_DONE
+                    | UCOAP_TRANS_OBSERVING)) {
+            continue;
+        }
+
+        if (!found || UCOAP_TIME_REACHED(*deadline, trans->deadline)) {
+            *deadline = trans->deadline;
+            found = true;
+        }
+    }
+
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_TCP_SIGNALING) && handle->signaling.ping_pending
+            && (!found || UCOAP_TIME_REACHED(*deadline, handle->signaling.ping_deadline))) {
+        *deadline = handle->signaling.ping_deadline;
+        found = true;
+    }
+
+    return found;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_rx_byte(struct ucoap_handle * const handle, const uint8_t byte) {
+    uint32_t i;
+    struct ucoap_transaction * trans;
+
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_ZERO_COPY_RX)) {
+        return UCOAP_WRONG_STATE_ERROR;
+    }
+
+    for (i = 0; i < UCOAP_MAX_TRANSACTIONS; i++) {
+        trans = &handle->transactions[i];
+
+        if (UCOAP_CHECK_STATUS(trans,
+                    UCOAP_TRANS_WAITING_ACK | UCOAP_TRANS_WAITING_RESP)) {
+
+            if (trans->response.len < UCOAP_PDU_SIZE(handle)) {
+                trans->response.buf[trans->response.len++] = byte;
+                UCOAP_SET_STATUS(trans, UCOAP_TRANS_RECEIVED);
+
+                ucoap_tx_signal(handle, UCOAP_RESPONSE_BYTE_DID_RECEIVE);
+                return UCOAP_OK;
+            }
+
+            return UCOAP_RX_BUFF_FULL_ERROR;
+        }
+    }
+
+    return UCOAP_WRONG_STATE_ERROR;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_rx_packet(struct ucoap_handle * const handle, const uint8_t * buf,
+        const uint32_t len) {
+    struct ucoap_transaction * trans;
+    const uint32_t pdu_size = UCOAP_PDU_SIZE(handle);
+
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_ZERO_COPY_RX)) {
+        return UCOAP_WRONG_STATE_ERROR;
+    }
+
+    trans = route_packet(handle, buf, len);
+
+    if (trans == NULL) {
+        reject_packet(handle, buf, len);
+        return UCOAP_WRONG_STATE_ERROR;
+    }
+
+    /* the previous packet waits for 'ucoap_process', this one goes behind it */
+    if (UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_RECEIVED)) {
+        if (trans->response.len + len > pdu_size) {
+            return UCOAP_RX_BUFF_FULL_ERROR;
+        }
+
+        trans->pending.buf = trans->response.buf + trans->response.len;
+        trans->pending.len = len;
+        mem_copy(trans->pending.buf, buf, len);
+
+        ucoap_tx_signal(handle, UCOAP_RESPONSE_DID_RECEIVE);
+        return UCOAP_OK;
+    }
+
+    mem_copy(trans->response.buf, buf, len < pdu_size? len: pdu_size);
+    trans->response.len = len < pdu_size? len: pdu_size;
+
+    if (len < pdu_size) {
+        UCOAP_SET_STATUS(trans, UCOAP_TRANS_RECEIVED);
+
+        ucoap_tx_signal(handle, UCOAP_RESPONSE_DID_RECEIVE);
+        return UCOAP_OK;
+    }
+
+    return UCOAP_RX_BUFF_FULL_ERROR;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_rx_stream(struct ucoap_handle * const handle, const uint8_t * buf,
+        uint32_t len, const uint32_t now) {
+    enum ucoap_error err;
+    uint32_t used;
+    struct ucoap_transaction * trans;
+
+    if (handle->transport != UCOAP_TCP
+            || UCOAP_CHECK_STATUS(handle, UCOAP_ZERO_COPY_RX)) {
+        return UCOAP_WRONG_STATE_ERROR;
+    }
+
+    while (len > 0) {
+        err = ucoap_frame_stream_tcp(handle, buf, len, &used, &trans);
+
+        if (err != UCOAP_OK) {
+            ucoap_rx_stream_reset(handle);
+            return err;
+        }
+
+        buf += used;
+        len -= used;
+
+        if (trans == NULL) {
+            continue;
+        }
+
+        UCOAP_SET_STATUS(trans, UCOAP_TRANS_RECEIVED);
+        ucoap_tx_signal(handle, UCOAP_RESPONSE_DID_RECEIVE);
+
+        /* a blocking waiter reads the response itself, the next frame of
+         * an observation may come in the same chunk */
+        if (UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_ASYNC)) {
+            process_transaction(handle, trans, now);
+            finish_transaction(handle, trans);
+        }
+    }
+
+    complete_in_order(handle);
+    dispatch_queued(handle, now);
+
+    /* requests submitted by the callbacks go out together */
+    return ucoap_flush_tcp(handle);
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_rx_stream_reset(struct ucoap_handle * const handle) {
+    handle->rx_stream.header_len = 0;
+    handle->rx_stream.header_need = 0;
+    handle->rx_stream.body_left = 0;
+    handle->rx_stream.trans = NULL;
+    handle->rx_stream.signal = false;
+    handle->rx_stream.signal_cut = false;
+    handle->rx_stream.signal_len = 0;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_tcp_start(struct ucoap_handle * const handle) {
+    if (handle->transport != UCOAP_TCP) {
+        return UCOAP_WRONG_STATE_ERROR;
+    }
+
+    ucoap_rx_stream_reset(handle);
+
+    return ucoap_start_signaling_tcp(handle);
+}
 
 
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_tcp_ping(struct ucoap_handle * const handle, const uint32_t now) {
+    if (!UCOAP_CHECK_STATUS(handle, UCOAP_TCP_SIGNALING)) {
+        return UCOAP_WRONG_STATE_ERROR;
+    }
+
+    return ucoap_ping_tcp(handle, now);
+}
+
 
 /**
  * @brief See description in the header file.
  *
  */
-void
-ucoap_debug(struct ucoap_handle * const handle, const bool enable) {
-    if (enable) {
-        UCOAP_SET_STATUS(handle, UCOAP_DEBUG_ON);
-    } else {
-        UCOAP_RESET_STATUS(handle, UCOAP_DEBUG_ON);
+enum ucoap_error
+ucoap_tcp_release(struct ucoap_handle * const handle) {
+    if (!UCOAP_CHECK_STATUS(handle, UCOAP_TCP_SIGNALING)) {
+        return UCOAP_WRONG_STATE_ERROR;
     }
+
+    return ucoap_release_tcp(handle);
 }
 
 
@@ -41,26 +650,267 @@ ucoap_debug(struct ucoap_handle * const handle, const bool enable) {
  *
  */
 enum ucoap_error
-ucoap_send_coap_request(struct ucoap_handle * const handle,
-        const ucoap_request_descriptor * const reqd) {
+ucoap_tcp_coalesce(struct ucoap_handle * const handle, uint8_t * const buf,
+        const uint32_t size) {
     enum ucoap_error err;
 
-    if (UCOAP_CHECK_STATUS(handle, UCOAP_SENDING_PACKET)) {
-        return UCOAP_BUSY_ERROR;
+    if (handle->transport != UCOAP_TCP) {
+        return UCOAP_WRONG_STATE_ERROR;
+    }
+
+    err = ucoap_flush_tcp(handle);
+
+    handle->tx_batch.buf = buf;
+    handle->tx_batch.size = buf != NULL ? size : 0;
+
+    return err;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_tcp_flush(struct ucoap_handle * const handle) {
+    if (handle->transport != UCOAP_TCP) {
+        return UCOAP_WRONG_STATE_ERROR;
+    }
+
+    return ucoap_flush_tcp(handle);
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_rx_packet_borrowed(struct ucoap_handle * const handle,
+        const uint8_t * buf, const uint32_t len, const uint32_t now) {
+    bool copied;
+    ucoap_data own;
+    struct ucoap_transaction * trans;
+
+    trans = route_packet(handle, buf, len);
+
+    /* the packets received by 'ucoap_rx_packet' go first */
+    if (trans != NULL && UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_RECEIVED)
+            && UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_ASYNC)) {
+        process_transaction(handle, trans, now);
+        finish_transaction(handle, trans);
+
+        trans = route_packet(handle, buf, len);
+    }
+
+    if (trans == NULL) {
+        reject_packet(handle, buf, len);
+        return UCOAP_WRONG_STATE_ERROR;
+    }
+
+    /* a blocking waiter would read the packet after return */
+    if (!UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_ASYNC)) {
+        return UCOAP_WRONG_STATE_ERROR;
+    }
+
+    own = trans->response;
+
+    /* a result held for in-order completion outlives the call, so it has
+     * to point into the own buffer of the transaction */
+    copied = UCOAP_CHECK_STATUS(handle, UCOAP_IN_ORDER)
+            && !UCOAP_CHECK_STATUS(handle, UCOAP_ZERO_COPY_RX);
+
+    if (copied) {
+        if (len >= UCOAP_PDU_SIZE(handle)) {
+            return UCOAP_RX_BUFF_FULL_ERROR;
+        }
+
+        mem_copy(trans->response.buf, buf, len);
+    } else {
+        trans->response.buf = (uint8_t *)buf;
+    }
+
+    trans->response.len = len;
+    UCOAP_SET_STATUS(trans, UCOAP_TRANS_RECEIVED);
+
+    ucoap_tx_signal(handle, UCOAP_RESPONSE_DID_RECEIVE);
+
+    process_transaction(handle, trans, now);
+
+    /* the borrowed buffer is not valid after return */
+    if (!copied) {
+        trans->response.buf = own.buf;
+        trans->response.len = 0;
+    }
+
+    finish_transaction(handle, trans);
+    complete_in_order(handle);
+    dispatch_queued(handle, now);
+
+    return UCOAP_OK;
+}
+
+
+/**
+ * @brief Find the transaction which the packet belongs to
+ *
+ * @param handle - coap handle
+ * @param buf - pointer on buffer with data
+ * @param len - length of data
+ *
+ * @return pointer on the transaction or NULL if packet is unexpected
+ */
+static struct ucoap_transaction *
+route_packet(struct ucoap_handle * const handle,
+        const uint8_t * buf, const uint32_t len) {
+    switch (handle->transport) {
+        case UCOAP_UDP:
+            return ucoap_route_packet_udp(handle, buf, len);
+
+        case UCOAP_TCP:
+            return ucoap_route_packet_tcp(handle, buf, len);
+
+        default:
+            return NULL;
+    }
+}
+
+
+/**
+ * @brief Answer the packet which nobody waits for, if the transport needs
+ *        it, or handle the signal of CoAP over TCP
+ *
+ * @param handle - coap handle
+ * @param buf - pointer on buffer with data
+ * @param len - length of data
+ *
+ */
+static void
+reject_packet(struct ucoap_handle * const handle,
+        const uint8_t * buf, const uint32_t len) {
+    switch (handle->transport) {
+        case UCOAP_UDP:
+            ucoap_reject_packet_udp(handle, buf, len);
+            break;
+
+        case UCOAP_TCP:
+            ucoap_rx_signal_tcp(handle, buf, len);
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/**
+ * @brief Drive the submitted transaction
+ *
+ * @param handle - coap handle
+ * @param trans - submitted transaction
+ * @param now - current time, ms
+ *
+ */
+static void
+process_transaction(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const uint32_t now) {
+    uint32_t i;
+
+    switch (handle->transport) {
+        case UCOAP_UDP:
+            ucoap_process_transaction_udp(handle, trans, now);
+            break;
+
+        case UCOAP_TCP:
+            ucoap_process_transaction_tcp(handle, trans, now);
+            break;
+
+        default:
+            break;
+    }
+
+    if (trans->pending.len == 0 || UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_RECEIVED)) {
+        return;
+    }
+
+    /* the packet behind the processed one, if it is still expected */
+    if (!UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_WAITING_ACK | UCOAP_TRANS_WAITING_RESP)) {
+        trans->pending.len = 0;
+        return;
+    }
+
+    /* it is further in the same buffer, forward copying is safe */
+    for (i = 0; i < trans->pending.len; i++) {
+        trans->response.buf[i] = trans->pending.buf[i];
+    }
+
+    trans->response.len = trans->pending.len;
+    trans->pending.len = 0;
+    UCOAP_SET_STATUS(trans, UCOAP_TRANS_RECEIVED);
+
+    process_transaction(handle, trans, now);
+}
+
+
+/**
+ * @brief Release the submitted transaction if it is not waiting anything
+ *
+ * @param handle - coap handle
+ * @param trans - submitted transaction
+ *
+ */
+static void
+finish_transaction(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans) {
+    if (!UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_WAITING_ACK
+                | UCOAP_TRANS_WAITING_RESP | UCOAP_TRANS_QUEUED
+                | UCOAP_TRANS_DONE)) {
+        deinit_coap_driver(handle, trans);
+
+        ucoap_tx_signal(handle, UCOAP_ROUTINE_PACKET_DID_FINISH);
+    }
+}
+
+
+/**
+ * @brief Reserve a transaction for the request, send it and wait for the
+ *        response
+ *
+ * @param handle - coap handle
+ * @param reqd - descriptor of request
+ * @param tmpl - template of the request, NULL - the options are encoded
+ *
+ * @return status of operation
+ */
+static enum ucoap_error
+send_request(struct ucoap_handle * const handle,
+        const ucoap_request_descriptor * const reqd,
+        const struct ucoap_request_template * const tmpl) {
+    enum ucoap_error err;
+    struct ucoap_transaction * trans;
+
+    /* the waiter needs a copy of packet */
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_ZERO_COPY_RX)) {
+        return UCOAP_WRONG_STATE_ERROR;
     }
 
-    UCOAP_SET_STATUS(handle, UCOAP_SENDING_PACKET);
-    err = init_coap_driver(handle, reqd);
+    trans = reserve_transaction(handle);
+
+    if (trans == NULL) {
+        return UCOAP_BUSY_ERROR;
+    }
 
+    err = init_coap_driver(handle, trans, reqd, tmpl);
     if (err == UCOAP_OK) {
 
         switch (handle->transport) {
             case UCOAP_UDP:
-                err = ucoap_send_coap_request_udp(handle, reqd);
+                err = ucoap_send_coap_request_udp(handle, trans, reqd);
                 break;
 
             case UCOAP_TCP:
-                err = ucoap_send_coap_request_tcp(handle, reqd);
+                err = ucoap_send_coap_request_tcp(handle, trans, reqd);
                 break;
 
             case UCOAP_SMS:
@@ -71,9 +921,8 @@ ucoap_send_coap_request(struct ucoap_handle * const handle,
         }
     }
 
-    deinit_coap_driver(handle);
+    deinit_coap_driver(handle, trans);
 
-    UCOAP_RESET_STATUS(handle, UCOAP_SENDING_PACKET);
     ucoap_tx_signal(handle, UCOAP_ROUTINE_PACKET_DID_FINISH);
 
     return err;
@@ -81,49 +930,233 @@ ucoap_send_coap_request(struct ucoap_handle * const handle,
 
 
 /**
- * @brief See description in the header file.
+ * @brief Reserve a transaction for the request and send it or put it in the
+ *        queue of the window
+ *
+ * @param handle - coap handle
+ * @param reqd - descriptor of request
+ * @param tmpl - template of the request, NULL - the options are encoded
+ * @param now - current time, ms
+ * @param status - initial status bits of the transaction
  *
+ * @return status of operation
  */
-enum ucoap_error
-ucoap_rx_byte(struct ucoap_handle * const handle, const uint8_t byte) {
-    if (UCOAP_CHECK_STATUS(handle, UCOAP_WAITING_RESP)) {
+static enum ucoap_error
+submit_request(struct ucoap_handle * const handle,
+        const ucoap_request_descriptor * const reqd,
+        const struct ucoap_request_template * const tmpl,
+        const uint32_t now, const uint16_t status) {
+    enum ucoap_error err;
+    struct ucoap_transaction * trans;
+
+    trans = reserve_transaction(handle);
+
+    if (trans == NULL) {
+        return UCOAP_BUSY_ERROR;
+    }
+
+    err = init_coap_driver(handle, trans, reqd, tmpl);
 
-        if (handle->response.len < UCOAP_MAX_PDU_SIZE) {
-            handle->response.buf[handle->response.len++] = byte;
+    if (err == UCOAP_OK) {
+        UCOAP_SET_STATUS(trans, status);
+        trans->seq = handle->next_seq++;
 
-            ucoap_tx_signal(handle, UCOAP_RESPONSE_BYTE_DID_RECEIVE);
+        /* keep the order: nobody overtakes the queued requests */
+        if (reqd->type == UCOAP_MESSAGE_CON
+                && (outstanding_requests(handle) >= ucoap_window(handle)
+                    || oldest_transaction(handle, UCOAP_TRANS_QUEUED, 0) != NULL)) {
+            UCOAP_SET_STATUS(trans, UCOAP_TRANS_QUEUED);
             return UCOAP_OK;
         }
 
-        return UCOAP_RX_BUFF_FULL_ERROR;
+        err = submit_transaction(handle, trans, now);
     }
 
-    return UCOAP_WRONG_STATE_ERROR;
+    /* nothing to wait, e.g. NON request without callback */
+    if (err != UCOAP_OK || !UCOAP_CHECK_STATUS(trans,
+                UCOAP_TRANS_WAITING_ACK | UCOAP_TRANS_WAITING_RESP)) {
+        deinit_coap_driver(handle, trans);
+
+        ucoap_tx_signal(handle, UCOAP_ROUTINE_PACKET_DID_FINISH);
+    }
+
+    return err;
 }
 
 
 /**
- * @brief See description in the header file.
+ * @brief Send the request of the submitted transaction by its transport
+ *
+ * @param handle - coap handle
+ * @param trans - submitted transaction
+ * @param now - current time, ms
+ *
+ * @return status of operation
+ */
+static enum ucoap_error
+submit_transaction(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const uint32_t now) {
+    switch (handle->transport) {
+        case UCOAP_UDP:
+            return ucoap_submit_coap_request_udp(handle, trans, trans->reqd, now);
+
+        case UCOAP_TCP:
+            return ucoap_submit_coap_request_tcp(handle, trans, trans->reqd, now);
+
+        case UCOAP_SMS:
+        default:
+            /* not supported yet */
+            return UCOAP_PARAM_ERROR;
+    }
+}
+
+
+/**
+ * @brief Find the earliest submitted transaction with given status
+ *
+ * @param handle - coap handle
+ * @param status - status bit the transaction must have
+ * @param skip - status bits of the transactions to ignore
  *
+ * @return pointer on the transaction or NULL if there is no such one
  */
-enum ucoap_error
-ucoap_rx_packet(struct ucoap_handle * const handle, const uint8_t * buf,
-        const uint32_t len) {
-    if (UCOAP_CHECK_STATUS(handle, UCOAP_WAITING_RESP)) {
+static struct ucoap_transaction *
+oldest_transaction(struct ucoap_handle * const handle, const uint16_t status,
+        const uint16_t skip) {
+    uint32_t i;
+    struct ucoap_transaction * trans;
+    struct ucoap_transaction * oldest;
 
-        mem_copy(handle->response.buf, buf,
-                len < UCOAP_MAX_PDU_SIZE? len: UCOAP_MAX_PDU_SIZE);
-        handle->response.len = len;
+    oldest = NULL;
 
-        if (len < UCOAP_MAX_PDU_SIZE) {
-            ucoap_tx_signal(handle, UCOAP_RESPONSE_DID_RECEIVE);
-            return UCOAP_OK;
+    for (i = 0; i < UCOAP_MAX_TRANSACTIONS; i++) {
+        trans = &handle->transactions[i];
+
+        if (!UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_ASYNC)
+                || !UCOAP_CHECK_STATUS(trans, status)
+                || UCOAP_CHECK_STATUS(trans, skip)) {
+            continue;
         }
 
-        return UCOAP_RX_BUFF_FULL_ERROR;
+        if (oldest == NULL || (int16_t)(trans->seq - oldest->seq) < 0) {
+            oldest = trans;
+        }
     }
 
-    return UCOAP_WRONG_STATE_ERROR;
+    return oldest;
+}
+
+
+/**
+ * @brief Count of CON requests which are waiting for ACK
+ *
+ * @param handle - coap handle
+ *
+ * @return count of requests
+ */
+static uint32_t
+outstanding_requests(const struct ucoap_handle * const handle) {
+    uint32_t i;
+    uint32_t count;
+
+    count = 0;
+
+    for (i = 0; i < UCOAP_MAX_TRANSACTIONS; i++) {
+        if (UCOAP_CHECK_STATUS(&handle->transactions[i], UCOAP_TRANS_WAITING_ACK)) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+
+/**
+ * @brief Send the queued requests in order of submitting while the window
+ *        allows
+ *
+ * @param handle - coap handle
+ * @param now - current time, ms
+ *
+ */
+static void
+dispatch_queued(struct ucoap_handle * const handle, const uint32_t now) {
+    enum ucoap_error err;
+    struct ucoap_transaction * trans;
+
+    while (outstanding_requests(handle) < ucoap_window(handle)) {
+        trans = oldest_transaction(handle, UCOAP_TRANS_QUEUED, 0);
+
+        if (trans == NULL) {
+            break;
+        }
+
+        UCOAP_RESET_STATUS(trans, UCOAP_TRANS_QUEUED);
+
+        err = submit_transaction(handle, trans, now);
+
+        if (err != UCOAP_OK) {
+            ucoap_fail_transaction(handle, trans, err);
+        }
+
+        finish_transaction(handle, trans);
+    }
+
+    complete_in_order(handle);
+}
+
+
+/**
+ * @brief Pass the held results to the callbacks while the earliest
+ *        submitted transaction is completed
+ *
+ * @param handle - coap handle
+ *
+ */
+static void
+complete_in_order(struct ucoap_handle * const handle) {
+    struct ucoap_transaction * trans;
+
+    for (;;) {
+        /* a long-lived observation does not hold the others */
+        trans = oldest_transaction(handle, UCOAP_TRANS_ASYNC, UCOAP_TRANS_OBSERVE);
+
+        if (trans == NULL || !UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_DONE)) {
+            break;
+        }
+
+        UCOAP_RESET_STATUS(trans, UCOAP_TRANS_DONE);
+
+        trans->reqd->response_callback(trans->reqd, &trans->result);
+
+        finish_transaction(handle, trans);
+    }
+}
+
+
+/**
+ * @brief Reserve a free transaction of the handle
+ *
+ * @param handle - coap handle
+ *
+ * @return pointer on the reserved transaction or NULL if all are busy
+ */
+static struct ucoap_transaction *
+reserve_transaction(struct ucoap_handle * const handle) {
+    uint32_t i;
+    struct ucoap_transaction * trans;
+
+    for (i = 0; i < UCOAP_MAX_TRANSACTIONS; i++) {
+        trans = &handle->transactions[i];
+
+        if (!UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_BUSY)) {
+            trans->statuses_mask = UCOAP_TRANS_BUSY;
+            return trans;
+        }
+    }
+
+    return NULL;
 }
 
 
@@ -131,35 +1164,64 @@ ucoap_rx_packet(struct ucoap_handle * const handle, const uint8_t * buf,
  * @brief Init CoAP driver
  *
  * @param handle - coap handle
+ * @param trans - reserved transaction
  * @param reqd - descriptor of request
+ * @param tmpl - template of the request, NULL - the options are encoded
  *
  * @return status of operation
  */
 static enum ucoap_error
 init_coap_driver(struct ucoap_handle * const handle,
-        const ucoap_request_descriptor * const reqd) {
+        struct ucoap_transaction * const trans,
+        const ucoap_request_descriptor * const reqd,
+        const struct ucoap_request_template * const tmpl) {
     enum ucoap_error err;
+    uint32_t frame_len;
 
     err = UCOAP_OK;
-    handle->request.len = 0;
-    handle->response.len = 0;
+    trans->reqd = reqd;
+    trans->tmpl = tmpl;
+    trans->request.len = 0;
+    trans->response.len = 0;
+    trans->pending.len = 0;
 
     if (reqd->code == UCOAP_CODE_EMPTY_MSG && reqd->tkl) {
         return UCOAP_PARAM_ERROR;
     }
 
-    if (handle->request.buf == NULL) {
-        err = ucoap_alloc_mem_block(&handle->request.buf, UCOAP_MAX_PDU_SIZE);
+    if (reqd->tkl > UCOAP_MAX_TOKEN_LEN) {
+        return UCOAP_PARAM_ERROR;
+    }
+
+    frame_len = request_frame_length(handle->transport, reqd->tkl,
+            tmpl != NULL ? tmpl->options_len : encoded_options_length(reqd->options),
+            reqd->payload.len);
+
+#ifdef UCOAP_TX_DATAV
+    /* the payload is transmitted from the descriptor, the marker is in the buffer */
+    frame_len -= reqd->payload.len;
+#endif /* UCOAP_TX_DATAV */
+
+    if (frame_len > UCOAP_PDU_SIZE(handle)) {
+        return UCOAP_PARAM_ERROR;
+    }
+
+    if (trans->request.buf == NULL) {
+        err = ucoap_alloc_mem_block(&trans->request.buf, UCOAP_PDU_SIZE(handle));
 
         if (err != UCOAP_OK) {
             return err;
         }
     }
 
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_ZERO_COPY_RX)) {
+        return err;
+    }
+
     if (reqd->type == UCOAP_MESSAGE_CON || reqd->response_callback != NULL) {
-        if (handle->response.buf == NULL) {
-            err = ucoap_alloc_mem_block(&handle->response.buf,
-                    UCOAP_MAX_PDU_SIZE);
+        if (trans->response.buf == NULL) {
+            err = ucoap_alloc_mem_block(&trans->response.buf,
+                    UCOAP_PDU_SIZE(handle));
         }
     }
 
@@ -168,23 +1230,31 @@ init_coap_driver(struct ucoap_handle * const handle,
 
 
 /**
- * @brief Deinit CoAP driver
+ * @brief Deinit CoAP driver and release the transaction
  *
  * @param handle - coap handle
+ * @param trans - transaction to release
  *
  */
 static void
-deinit_coap_driver(struct ucoap_handle * handle) {
-    if (handle->response.buf != NULL) {
-        ucoap_free_mem_block(handle->response.buf, UCOAP_MAX_PDU_SIZE);
-        handle->response.buf = NULL;
-    }
+deinit_coap_driver(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans) {
+    /* buffers of 'ucoap_handle_init' are kept for the next request */
+    if (!UCOAP_CHECK_STATUS(handle, UCOAP_PERSISTENT_BUFS)) {
+        if (trans->response.buf != NULL) {
+            ucoap_free_mem_block(trans->response.buf, UCOAP_PDU_SIZE(handle));
+            trans->response.buf = NULL;
+        }
 
-    if (handle->request.buf != NULL) {
-        ucoap_free_mem_block(handle->request.buf, UCOAP_MAX_PDU_SIZE);
-        handle->request.buf = NULL;
+        if (trans->request.buf != NULL) {
+            ucoap_free_mem_block(trans->request.buf, UCOAP_PDU_SIZE(handle));
+            trans->request.buf = NULL;
+        }
     }
 
-    handle->request.len = 0;
-    handle->response.len = 0;
+    trans->request.len = 0;
+    trans->response.len = 0;
+    trans->pending.len = 0;
+    trans->reqd = NULL;
+    trans->statuses_mask = UCOAP_TRANS_FREE;
 }
@@ -18,13 +18,20 @@
 #define UCOAP_UCOAP_H_
 
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
 #define UCOAP_DEFAULT_VERSION           1
 #define UCOAP_CODE(CLASS,CODE)          (int)((CLASS<<5)|CODE)
 #define UCOAP_EXTRACT_CLASS(c)          (int)((c)>>5)
+#define UCOAP_OPT_NO_CACHE_KEY(num)     (((num) & 0x1E) == 0x1C)
 
 #define UCOAP_TCP_URI_SCHEME            "coap+tcp"
 #define UCOAP_TCP_SECURE_URI_SCHEME     "coaps+tcp"
@@ -37,6 +44,7 @@
 #define UCOAP_UDP_DEFAULT_SECURE_PORT   5684
 
 
+/* defaults of 'struct ucoap_config' */
 #ifndef UCOAP_RESP_TIMEOUT_MS
 #define UCOAP_RESP_TIMEOUT_MS           9000
 #endif /* UCOAP_RESP_TIMEOUT_MS */
@@ -57,6 +65,54 @@
 #define UCOAP_MAX_PDU_SIZE              96        /* maximum size of a CoAP PDU */
 #endif /* UCOAP_MAX_PDU_SIZE */
 
+#ifndef UCOAP_NSTART
+#define UCOAP_NSTART                    0         /* 0 - up to UCOAP_MAX_TRANSACTIONS */
+#endif /* UCOAP_NSTART */
+
+#ifndef UCOAP_MAX_TRANSACTIONS
+#define UCOAP_MAX_TRANSACTIONS          4         /* outstanding requests per handle */
+#endif /* UCOAP_MAX_TRANSACTIONS */
+
+#define UCOAP_MAX_TOKEN_LEN             8
+
+/* Len/TKL, extended length, code and token of CoAP over TCP */
+#define UCOAP_MAX_TCP_HEADER_LEN        (6 + UCOAP_MAX_TOKEN_LEN)
+
+/* CoAP over TCP signaling, see 'ucoap_tcp_start' */
+#define UCOAP_TCP_DEFAULT_MESSAGE_SIZE  1152      /* until CSM of the peer has come */
+
+#ifndef UCOAP_TEMPLATE_OPTIONS_SIZE
+#define UCOAP_TEMPLATE_OPTIONS_SIZE     64        /* encoded options of a request template */
+#endif /* UCOAP_TEMPLATE_OPTIONS_SIZE */
+
+#ifndef UCOAP_TCP_SIGNAL_SIZE
+#define UCOAP_TCP_SIGNAL_SIZE           32        /* options of an incoming signal, larger are skipped */
+#endif /* UCOAP_TCP_SIGNAL_SIZE */
+
+/* limits of adaptive RTO, see 'ucoap_adaptive_rto' */
+#ifndef UCOAP_RTO_MIN_MS
+#define UCOAP_RTO_MIN_MS                50        /* covers jitter of fast links */
+#endif /* UCOAP_RTO_MIN_MS */
+
+#define UCOAP_RTO_SMALL_MS              1000
+#define UCOAP_RTO_LARGE_MS              3000
+#define UCOAP_RTO_MAX_MS                60000
+
+/* size of caller-supplied storage for 'ucoap_handle_init' */
+#define UCOAP_HANDLE_STORAGE_SIZE_FOR(pdu)  (2 * UCOAP_MAX_TRANSACTIONS * (pdu))
+#define UCOAP_HANDLE_STORAGE_SIZE       UCOAP_HANDLE_STORAGE_SIZE_FOR(UCOAP_MAX_PDU_SIZE)
+#define UCOAP_HANDLE_ZERO_COPY_STORAGE_SIZE (UCOAP_MAX_TRANSACTIONS * UCOAP_MAX_PDU_SIZE)
+
+/* initializer of 'struct ucoap_config' with the compile-time defaults */
+#define UCOAP_DEFAULT_CONFIG                        \
+    {                                               \
+        .max_pdu_size = UCOAP_MAX_PDU_SIZE,         \
+        .ack_timeout_ms = UCOAP_ACK_TIMEOUT_MS,     \
+        .resp_timeout_ms = UCOAP_RESP_TIMEOUT_MS,   \
+        .max_retransmit = UCOAP_MAX_RETRANSMIT,     \
+        .nstart = UCOAP_NSTART                      \
+    }
+
 
 
 enum ucoap_error{
@@ -74,7 +130,9 @@ enum ucoap_error{
     UCOAP_WRONG_STATE_ERROR,
 
     UCOAP_NO_OPTIONS_ERROR,
-    UCOAP_WRONG_OPTIONS_ERROR
+    UCOAP_WRONG_OPTIONS_ERROR,
+
+    UCOAP_IO_ERROR
 };
 
 
@@ -84,6 +142,7 @@ enum ucoap_outsignal{
 
     UCOAP_TX_RETR_PACKET,
     UCOAP_TX_ACK_PACKET,
+    UCOAP_TX_RST_PACKET,
 
     UCOAP_ACK_DID_RECEIVE,
     UCOAP_NRST_DID_RECEIVE,
@@ -91,7 +150,14 @@ enum ucoap_outsignal{
 
     UCOAP_RESPONSE_BYTE_DID_RECEIVE,
     UCOAP_RESPONSE_TO_LONG_ERROR,
-    UCOAP_RESPONSE_DID_RECEIVE
+    UCOAP_RESPONSE_DID_RECEIVE,
+
+    UCOAP_TX_ABORT_PACKET,                 /* CSM of the peer is not acceptable */
+    UCOAP_TCP_CSM_DID_RECEIVE,
+    UCOAP_TCP_PONG_DID_RECEIVE,
+    UCOAP_TCP_PING_TIMEOUT,                /* the connection is dead */
+    UCOAP_TCP_RELEASE_DID_RECEIVE,         /* close the connection after the responses */
+    UCOAP_TCP_ABORT_DID_RECEIVE            /* close the connection */
 };
 
 
@@ -131,6 +197,7 @@ enum ucoap_packetcode {
     UCOAP_RESP_SUCCESS_VALID_203 = UCOAP_CODE(UCOAP_SUCCESS_CLASS, 3),
     UCOAP_RESP_SUCCESS_CHANGED_204 = UCOAP_CODE(UCOAP_SUCCESS_CLASS, 4),
     UCOAP_RESP_SUCCESS_CONTENT_205 = UCOAP_CODE(UCOAP_SUCCESS_CLASS, 5),
+    UCOAP_RESP_SUCCESS_CONTINUE_231 = UCOAP_CODE(UCOAP_SUCCESS_CLASS, 31),
     UCOAP_RESP_ERROR_BAD_REQUEST_400 = UCOAP_CODE(UCOAP_BAD_REQUEST_CLASS, 0),
     UCOAP_RESP_ERROR_UNAUTHORIZED_401 = UCOAP_CODE(UCOAP_BAD_REQUEST_CLASS, 1),
     UCOAP_RESP_BAD_OPTION_402 = UCOAP_CODE(UCOAP_BAD_REQUEST_CLASS, 2),
@@ -138,6 +205,7 @@ enum ucoap_packetcode {
     UCOAP_RESP_NOT_FOUND_404 = UCOAP_CODE(UCOAP_BAD_REQUEST_CLASS, 4),
     UCOAP_RESP_METHOD_NOT_ALLOWED_405 = UCOAP_CODE(UCOAP_BAD_REQUEST_CLASS, 5),
     UCOAP_RESP_METHOD_NOT_ACCEPTABLE_406 = UCOAP_CODE(UCOAP_BAD_REQUEST_CLASS, 6),
+    UCOAP_RESP_REQUEST_ENTITY_INCOMPLETE_408 = UCOAP_CODE(UCOAP_BAD_REQUEST_CLASS, 8),
     UCOAP_RESP_PRECONDITION_FAILED_412 = UCOAP_CODE(UCOAP_BAD_REQUEST_CLASS, 12),
     UCOAP_RESP_REQUEST_ENTITY_TOO_LARGE_413 = UCOAP_CODE(UCOAP_BAD_REQUEST_CLASS, 13),
     UCOAP_RESP_UNSUPPORTED_CONTENT_FORMAT_415 = UCOAP_CODE(UCOAP_BAD_REQUEST_CLASS, 15),
@@ -167,6 +235,7 @@ enum ucoap_option {
     UCOAP_URI_HOST_OPT         = 3,
     UCOAP_ETAG_OPT             = 4,
     UCOAP_IF_NON_MATCH_OPT     = 5,
+    UCOAP_OBSERVE_OPT          = 6,   /* RFC 7641 */
     UCOAP_URI_PORT_OPT         = 7,
     UCOAP_LOCATION_PATH_OPT    = 8,
     UCOAP_URI_PATH_OPT         = 11,
@@ -177,6 +246,7 @@ enum ucoap_option {
     UCOAP_LOCATION_QUERY_OPT   = 20,
     UCOAP_BLOCK2_OPT           = 23,  /* blockwise option for GET */
     UCOAP_BLOCK1_OPT           = 27,  /* blockwise option for POST */
+    UCOAP_SIZE2_OPT            = 28,  /* size of the resource for GET */
     UCOAP_PROXY_URI_OPT        = 35,
     UCOAP_PROXY_SCHEME_OPT     = 39,
     UCOAP_SIZE1_OPT            = 60
@@ -233,7 +303,10 @@ typedef struct ucoap_result_data {
 
     uint8_t resp_code;
     ucoap_data payload;
-    ucoap_option_data * options;   /* NULL terminated linked list of options */
+    ucoap_data options;            /* encoded options, see 'ucoap_option_iterator' */
+
+    enum ucoap_error err;          /* not UCOAP_OK if the exchange has failed
+                                      (asynchronous mode only) */
 
 } ucoap_result_data;
 
@@ -258,6 +331,148 @@ typedef struct ucoap_request_descriptor {
 } ucoap_request_descriptor;
 
 
+/**
+ * @brief A request which is sent again and again with the same type, code
+ *        and options, e.g. periodic telemetry. The options are encoded once
+ *        by 'ucoap_template_init', every send takes a new Message ID and
+ *        token and the payload passed to it.
+ *
+ */
+struct ucoap_request_template {
+
+    ucoap_request_descriptor reqd;     /* must be the first member */
+
+    uint32_t options_len;
+    uint8_t options[UCOAP_TEMPLATE_OPTIONS_SIZE];  /* encoded */
+
+};
+
+
+/**
+ * One outstanding exchange of the handle. Incoming packets are routed to
+ * a transaction by Message ID (ACK/RST) or by token (responses).
+ */
+struct ucoap_transaction {
+
+    uint16_t statuses_mask;
+
+    uint16_t mid;
+    uint8_t tkl;
+    uint8_t token[UCOAP_MAX_TOKEN_LEN];
+
+    const struct ucoap_request_descriptor * reqd;
+    const struct ucoap_request_template * tmpl;  /* NULL - 'reqd->options' are encoded */
+
+    ucoap_data request;
+    ucoap_data response;
+    ucoap_data pending;            /* the next packet, behind the received one in 'response' */
+
+    uint32_t deadline;             /* asynchronous mode only, ms */
+    uint32_t sent_at;              /* first transmission, ms */
+    uint32_t ack_timeout;          /* current timeout of waiting ACK, ms */
+    uint8_t retransmition;
+
+    uint16_t seq;                  /* order of submitting */
+    ucoap_result_data result;      /* held until the preceding requests end */
+
+    uint32_t observe_seq;          /* of the last fresh notification */
+    uint32_t observe_at;           /* time of the last fresh notification, ms */
+
+};
+
+
+/**
+ * @brief Tuning of one link. A handle without configuration uses
+ *        'ucoap_default_config', i.e. the UCOAP_* macros above.
+ *
+ */
+struct ucoap_config {
+
+    uint32_t max_pdu_size;         /* size of request/response buffers */
+    uint32_t ack_timeout_ms;
+    uint32_t resp_timeout_ms;
+    uint32_t max_retransmit;
+    uint32_t nstart;               /* outstanding CON requests, 0 - no limit */
+
+};
+
+
+/**
+ * @brief State of the adaptive retransmission timeout (CoCoA). The strong
+ *        estimator is fed by exchanges without retransmissions, the weak one
+ *        by exchanges with one or two retransmissions. All values are in ms.
+ *
+ */
+struct ucoap_rto_estimator {
+
+    uint32_t rto;                  /* overall RTO, 0 - no samples yet */
+    uint32_t updated_at;           /* time of the last update or aging */
+
+    uint32_t strong_srtt;
+    uint32_t strong_rttvar;
+    uint32_t weak_srtt;
+    uint32_t weak_rttvar;
+
+};
+
+
+/**
+ * @brief State of the incoming CoAP over TCP stream between the chunks
+ *        passed to 'ucoap_rx_stream'. The header of a frame is collected
+ *        here, its body goes straight to the response buffer of the
+ *        transaction it belongs to.
+ *
+ */
+struct ucoap_rx_stream {
+
+    uint8_t header_len;            /* collected bytes of the header */
+    uint8_t header_need;           /* full length of the header, 0 - unknown yet */
+    uint8_t header[UCOAP_MAX_TCP_HEADER_LEN];
+
+    uint32_t body_left;            /* bytes of options and payload to come */
+    struct ucoap_transaction * trans;    /* NULL - the frame is skipped */
+
+    bool signal;                   /* the frame is a signal, collected below */
+    bool signal_cut;               /* its options are too large, only code and token are kept */
+    uint16_t signal_len;
+    uint8_t signal_buf[UCOAP_MAX_TCP_HEADER_LEN + UCOAP_TCP_SIGNAL_SIZE];
+
+};
+
+
+/**
+ * @brief Frames of CoAP over TCP requests held to be written together,
+ *        see 'ucoap_tcp_coalesce'.
+ *
+ */
+struct ucoap_tx_batch {
+
+    uint8_t * buf;                 /* NULL - every frame is written at once */
+    uint32_t size;
+    uint32_t len;                  /* held bytes */
+
+};
+
+
+/**
+ * @brief State of CoAP over TCP signaling (RFC 8323, section 5) of the
+ *        current connection, see 'ucoap_tcp_start'.
+ *
+ */
+struct ucoap_tcp_signaling {
+
+    uint32_t max_message_size;     /* the peer receives, bytes */
+    bool csm_received;
+    bool block_wise;               /* the peer supports BERT */
+    bool released;                 /* no new requests on this connection */
+
+    bool ping_pending;             /* Pong is awaited */
+    uint8_t ping_token[UCOAP_MAX_TOKEN_LEN];
+    uint32_t ping_deadline;        /* ms */
+
+};
+
+
 struct ucoap_handle {
 
     const char * name;
@@ -265,12 +480,28 @@ struct ucoap_handle {
 
     uint16_t statuses_mask;
 
-    ucoap_data request;
-    ucoap_data response;
+    /* NULL - defaults; change only while there are no buffers */
+    const struct ucoap_config * config;
+
+    struct ucoap_rto_estimator rto;
+
+    /* window of outstanding CON requests (asynchronous mode) */
+    uint16_t next_seq;
+    uint8_t cwnd;                  /* 0 - not limited yet, see 'nstart' */
+    uint8_t cwnd_acks;
+
+    struct ucoap_transaction transactions[UCOAP_MAX_TRANSACTIONS];
+
+    struct ucoap_rx_stream rx_stream;    /* CoAP over TCP only */
+    struct ucoap_tcp_signaling signaling;    /* CoAP over TCP only */
+    struct ucoap_tx_batch tx_batch;      /* CoAP over TCP only */
 
 };
 
 
+extern const struct ucoap_config ucoap_default_config;
+
+
 /**
  * @brief In this function user should implement a transmission given data via
  *        hardware interface (e.g. serial port)
@@ -281,6 +512,27 @@ ucoap_tx_data(struct ucoap_handle * const handle, const uint8_t * buf,
         const uint32_t len);
 
 
+#ifdef UCOAP_TX_DATAV
+/**
+ * @brief Vectored variant of 'ucoap_tx_data' (optional, build with
+ *        UCOAP_TX_DATAV defined). Requests are sent through it as two parts:
+ *        header, token and options from the request buffer, then the payload
+ *        straight from the request descriptor. The payload is not copied and
+ *        is not limited by UCOAP_MAX_PDU_SIZE then. All parts make up one
+ *        datagram (one frame for TCP).
+ *
+ * @param handle - coap handle
+ * @param iov - array of parts
+ * @param iovcnt - number of parts
+ *
+ * @return status of operation
+ */
+extern enum ucoap_error
+ucoap_tx_datav(struct ucoap_handle * const handle, const ucoap_data * iov,
+        const uint32_t iovcnt);
+#endif /* UCOAP_TX_DATAV */
+
+
 /**
  * @brief In this function user should implement a functionality of waiting response.
  *        This function has to return a control when timeout will expired or
@@ -316,6 +568,19 @@ ucoap_fill_token(struct ucoap_handle * const handle, uint8_t * token,
         const uint32_t tkl);
 
 
+#ifdef UCOAP_RANDOM_HOOK
+/**
+ * @brief In this function user should implement a generating of random
+ *        number (optional, build with UCOAP_RANDOM_HOOK defined). It is used
+ *        for randomization of retransmission timeouts, so devices which have
+ *        started together do not retransmit together. Without it the first
+ *        timeout is exactly ACK_TIMEOUT.
+ *
+ */
+extern uint32_t ucoap_random(struct ucoap_handle * const handle);
+#endif /* UCOAP_RANDOM_HOOK */
+
+
 /**
  * @brief These functions are using for debug purpose, if user will enable debug mode.
  *
@@ -332,7 +597,8 @@ extern void ucoap_debug_print_payload(struct ucoap_handle * const handle,
  * @brief In this function user should implement an allocating block of memory.
  *        In simple case it may be a static buffer. The 'UCOAP' will make
  *        two calls of this function before starting work (for rx and tx buffers).
- *        So, you should have minimum two separate blocks of memory.
+ *        So, you should have minimum two separate blocks of memory for
+ *        each outstanding request (see 'UCOAP_MAX_TRANSACTIONS').
  *
  */
 extern enum ucoap_error
@@ -370,7 +636,88 @@ void ucoap_debug(struct ucoap_handle * const handle, const bool enable);
 
 
 /**
- * @brief Send CoAP request to the server
+ * @brief Enable/disable zero-copy receiving (asynchronous mode only).
+ *        The handle does not allocate response buffers then, and incoming
+ *        packets have to be passed through 'ucoap_rx_packet_borrowed'.
+ *        Change it only while there are no outstanding requests and before
+ *        'ucoap_handle_init' ('UCOAP_HANDLE_ZERO_COPY_STORAGE_SIZE' is
+ *        enough for the storage then).
+ *
+ */
+void ucoap_zero_copy_rx(struct ucoap_handle * const handle, const bool enable);
+
+
+/**
+ * @brief Enable/disable adaptive retransmission timeout (CoAP over UDP,
+ *        asynchronous mode only). RTT is measured on ACKs, the estimated
+ *        RTO replaces ACK_TIMEOUT of the configuration for next requests.
+ *        An RTO which has not been updated for a long time is aged towards
+ *        the default as CoCoA does. Blocking requests have no clock to take
+ *        part in it and keep using ACK_TIMEOUT. The estimator is reset by
+ *        every call.
+ *
+ */
+void ucoap_adaptive_rto(struct ucoap_handle * const handle, const bool enable);
+
+
+/**
+ * @brief Enable/disable in-order completion (asynchronous mode only).
+ *        Callbacks are called in order of submitting the requests: a request
+ *        completed early keeps its transaction until all preceding ones end.
+ *        It has no effect on the zero-copy receiving handle.
+ *
+ */
+void ucoap_in_order(struct ucoap_handle * const handle, const bool enable);
+
+
+/**
+ * @brief Give the handle its request/response buffers for whole lifetime
+ *        (optional). By default the buffers are allocated and freed around
+ *        every request. After this call no allocations are made per request.
+ *
+ * @param handle - coap handle
+ * @param storage - static storage of 'ucoap_handle_storage_size' bytes, or
+ *        NULL to allocate the buffers once through 'ucoap_alloc_mem_block'
+ * @param len - length of storage
+ *
+ * @return status of operation
+ *
+ */
+enum ucoap_error
+ucoap_handle_init(struct ucoap_handle * const handle, uint8_t * const storage,
+        const uint32_t len);
+
+
+/**
+ * @brief Size of storage needed by 'ucoap_handle_init' for the handle with
+ *        its current configuration and receiving mode.
+ *
+ * @param handle - coap handle
+ *
+ * @return size in bytes
+ */
+uint32_t
+ucoap_handle_storage_size(const struct ucoap_handle * const handle);
+
+
+/**
+ * @brief Release the buffers which were given by 'ucoap_handle_init'.
+ *        There must be no outstanding requests.
+ *
+ * @param handle - coap handle
+ *
+ */
+void
+ucoap_handle_deinit(struct ucoap_handle * const handle);
+
+
+/**
+ * @brief Send CoAP request to the server.
+ *        Every call reserves its own transaction of the handle, so up to
+ *        'UCOAP_MAX_TRANSACTIONS' requests may be outstanding at once
+ *        (e.g. from several tasks). The 'ucoap_wait_event' implementation
+ *        should wake all waiters of the handle: each of them checks
+ *        whether the received packet was routed to its own transaction.
  *
  * @param handle - coap handle
  * @param reqd - descriptor of request
@@ -383,11 +730,165 @@ ucoap_send_coap_request(struct ucoap_handle * const handle,
         const ucoap_request_descriptor * const reqd);
 
 
+/**
+ * @brief Submit CoAP request to the server without waiting (asynchronous
+ *        mode). The function returns right after the request is sent,
+ *        the exchange is driven by 'ucoap_process' then.
+ *        The 'response_callback' is called once, either with the response
+ *        or with the reason of failure in 'result->err'. The descriptor
+ *        has to be valid until that moment, but the options and the
+ *        payload are not needed after the request is sent (a request queued
+ *        by the window is sent later from 'ucoap_process'). With
+ *        UCOAP_TX_DATAV the payload is not copied, retransmissions send it
+ *        from the descriptor, so it has to be valid until the callback too.
+ *        The 'ucoap_wait_event' function is never called in this mode.
+ *
+ * @param handle - coap handle
+ * @param reqd - descriptor of request
+ * @param now - current time, ms (any monotonic clock, may wrap around)
+ *
+ * @return status of operation
+ *
+ */
+enum ucoap_error
+ucoap_submit_coap_request(struct ucoap_handle * const handle,
+        const ucoap_request_descriptor * const reqd,
+        const uint32_t now);
+
+
+/**
+ * @brief Make the template of the request: the descriptor is copied and
+ *        its options are encoded, so neither is needed afterwards.
+ *        The payload of the descriptor is ignored, it is given per send.
+ *
+ * @param handle - coap handle the request is sent by
+ * @param tmpl - the template
+ * @param reqd - descriptor of request (type, code, tkl, options, callback)
+ *
+ * @return status of operation, UCOAP_PARAM_ERROR if the encoded options
+ *         exceed UCOAP_TEMPLATE_OPTIONS_SIZE or the request without
+ *         payload does not fit PDU size of the handle
+ */
+enum ucoap_error
+ucoap_template_init(struct ucoap_handle * const handle,
+        struct ucoap_request_template * const tmpl,
+        const ucoap_request_descriptor * const reqd);
+
+
+/**
+ * @brief Send the request of the template and wait for the response,
+ *        see 'ucoap_send_coap_request'. The encoded options are copied into
+ *        the request, only the header, Message ID, token and the payload
+ *        are written.
+ *
+ * @param handle - coap handle
+ * @param tmpl - the template
+ * @param payload - payload of this request
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_send_template(struct ucoap_handle * const handle,
+        struct ucoap_request_template * const tmpl,
+        const ucoap_data * const payload);
+
+
+/**
+ * @brief Submit the request of the template, see 'ucoap_submit_coap_request'.
+ *        The callback gets the descriptor of the template. One template is
+ *        one request in flight: it is UCOAP_BUSY_ERROR until the previous
+ *        request ends, copies of the template may be in flight at once.
+ *
+ * @param handle - coap handle
+ * @param tmpl - the template
+ * @param payload - payload of this request, see 'ucoap_submit_coap_request'
+ * @param now - current time, ms
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_submit_template(struct ucoap_handle * const handle,
+        struct ucoap_request_template * const tmpl,
+        const ucoap_data * const payload,
+        const uint32_t now);
+
+
+/**
+ * @brief Register an observation of the resource (RFC 7641, asynchronous
+ *        mode only). The request must be GET with Observe option (value 0)
+ *        and callback. Every fresh notification is passed to the callback;
+ *        reordered and duplicated ones are dropped, confirmable ones are
+ *        acknowledged anyway. The subscription keeps its transaction until
+ *        a response without Observe option (or an error) ends it, or until
+ *        'ucoap_cancel_observe'. The descriptor must live all this time.
+ *
+ * @param handle - coap handle
+ * @param reqd - descriptor of registration request
+ * @param now - current time, ms
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_observe(struct ucoap_handle * const handle,
+        const ucoap_request_descriptor * const reqd,
+        const uint32_t now);
+
+
+/**
+ * @brief Forget the observation registered by 'ucoap_observe'. Next
+ *        confirmable notifications are rejected by Reset (CoAP over UDP),
+ *        so the server removes the observer. The callback is not called.
+ *
+ * @param handle - coap handle
+ * @param reqd - descriptor of registration request
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_cancel_observe(struct ucoap_handle * const handle,
+        const ucoap_request_descriptor * const reqd);
+
+
+/**
+ * @brief Handle received packets and expired timers of the submitted
+ *        requests. Call it after each received packet and when the time
+ *        returned by 'ucoap_next_deadline' has come.
+ *        Responses are passed to the callbacks from this function.
+ *
+ * @param handle - coap handle
+ * @param now - current time, ms
+ *
+ * @return status of operation
+ *
+ */
+enum ucoap_error
+ucoap_process(struct ucoap_handle * const handle, const uint32_t now);
+
+
+/**
+ * @brief Get the time when 'ucoap_process' has to be called next time,
+ *        e.g. to arm a timerfd or to compute a timeout of epoll_wait.
+ *
+ * @param handle - coap handle
+ * @param deadline - pointer on variable for storing the time, ms
+ *
+ * @return false if there are no submitted requests and no Ping is
+ *         awaiting Pong
+ *
+ */
+bool
+ucoap_next_deadline(struct ucoap_handle * const handle,
+        uint32_t * const deadline);
+
+
 /**
  * @brief Receive a packet step-by-step (sequence of bytes).
  *        You may to use it if you communicate with server over serial port
  *        or you haven't a free mem for cumulative buffer. Detecting of the
  *        end of packet is a user responsibility (through byte-timeout).
+ *        A packet can not be routed before it is complete, so bytes are
+ *        stored to the first waiting transaction: use it with only one
+ *        outstanding request at a time.
  *
  * @param handle - coap handle
  * @param byte - received byte
@@ -400,7 +901,13 @@ ucoap_rx_byte(struct ucoap_handle * const handle, const uint8_t byte);
 
 
 /**
- * @brief Receive whole packet
+ * @brief Receive whole packet. The packet is routed to the transaction
+ *        it belongs to, by Message ID for ACK/RST and by token otherwise.
+ *        A packet of an asynchronous transaction whose previous packet is
+ *        not processed by 'ucoap_process' yet (e.g. a separate response
+ *        right after the empty ACK) is kept behind it in the response
+ *        buffer; if there is no room, UCOAP_RX_BUFF_FULL_ERROR is returned
+ *        and the packet can be passed again after 'ucoap_process'.
  *
  * @param handle - coap handle
  * @param buf - pointer on buffer with data
@@ -414,4 +921,162 @@ ucoap_rx_packet(struct ucoap_handle * const handle,
         const uint8_t * buf, const uint32_t len);
 
 
+/**
+ * @brief Receive a chunk of CoAP over TCP stream of any size, as it has
+ *        been read from the socket. Frames may be split between chunks or
+ *        several of them may come in one chunk: each byte is looked at
+ *        once, the body of a frame is copied straight to the response
+ *        buffer of its transaction. Responses of the asynchronous mode
+ *        are passed to the callbacks from this function. Frames which
+ *        nobody waits for (or too large for the PDU) are skipped.
+ *        Not available for the zero-copy receiving handle.
+ *
+ * @param handle - coap handle
+ * @param buf - pointer on buffer with data
+ * @param len - length of data
+ * @param now - current time, ms
+ *
+ * @return status of operation, UCOAP_WRONG_STATE_ERROR if the stream is
+ *         broken (the connection has to be closed)
+ *
+ */
+enum ucoap_error
+ucoap_rx_stream(struct ucoap_handle * const handle, const uint8_t * buf,
+        uint32_t len, const uint32_t now);
+
+
+/**
+ * @brief Forget a partly received frame, e.g. when the connection is
+ *        closed. Call it before the first chunk of a new connection.
+ *
+ * @param handle - coap handle
+ *
+ */
+void
+ucoap_rx_stream_reset(struct ucoap_handle * const handle);
+
+
+/**
+ * @brief Start CoAP over TCP signaling (RFC 8323, section 5) on a new
+ *        connection: forget the state of the previous one (the frames held
+ *        by 'ucoap_tcp_coalesce' are dropped, their requests fail with
+ *        UCOAP_IO_ERROR) and send our Capabilities and Settings Message
+ *        (CSM) with Max-Message-Size of the PDU. Until CSM of the peer
+ *        comes, requests larger than 1152 bytes are refused, then up to
+ *        its Max-Message-Size are sent.
+ *        Signals of the peer are handled by 'ucoap_rx_packet' and
+ *        'ucoap_rx_stream': Ping is answered by Pong, Release and Abort
+ *        are passed to 'ucoap_tx_signal'. A signal in the stream with
+ *        options larger than UCOAP_TCP_SIGNAL_SIZE is handled without
+ *        them, such a CSM is ignored. A CSM with unknown critical
+ *        option is answered by Abort. On Abort the submitted requests
+ *        fail with UCOAP_NRST_ANSWER.
+ *        Without this call the handle sends requests up to the PDU size
+ *        and ignores signals.
+ *
+ * @param handle - coap handle
+ *
+ * @return status of operation
+ *
+ */
+enum ucoap_error
+ucoap_tcp_start(struct ucoap_handle * const handle);
+
+
+/**
+ * @brief Send Ping with Custody option to check the connection, e.g. when
+ *        it has been idle for a while. If Pong does not come in the
+ *        response timeout, 'ucoap_process' signals UCOAP_TCP_PING_TIMEOUT
+ *        and fails the submitted requests with UCOAP_TIMEOUT_ERROR: the
+ *        connection has to be closed.
+ *
+ * @param handle - coap handle
+ * @param now - current time, ms
+ *
+ * @return status of operation, UCOAP_BUSY_ERROR if the previous Ping is
+ *         not answered yet
+ *
+ */
+enum ucoap_error
+ucoap_tcp_ping(struct ucoap_handle * const handle, const uint32_t now);
+
+
+/**
+ * @brief Send Release: the connection will be closed. The submitted
+ *        requests go on, new ones are refused with UCOAP_WRONG_STATE_ERROR
+ *        (as after Release of the peer).
+ *
+ * @param handle - coap handle
+ *
+ * @return status of operation
+ *
+ */
+enum ucoap_error
+ucoap_tcp_release(struct ucoap_handle * const handle);
+
+
+/**
+ * @brief Coalesce frames of CoAP over TCP requests: they are appended to
+ *        the buffer and written by one 'ucoap_tx_data' call when the
+ *        buffer can not take the next frame, by 'ucoap_tcp_flush', or at
+ *        the end of 'ucoap_process' and 'ucoap_rx_stream'. So a batch of
+ *        submitted requests goes to the socket at once, and responses are
+ *        matched by token in any order. A blocking request and signals
+ *        write the held frames before them. A frame larger than the
+ *        buffer is written alone. If writing the held frames fails, their
+ *        submitted requests fail with the error; 'ucoap_tcp_start' drops
+ *        them and fails the requests with UCOAP_IO_ERROR.
+ *
+ * @param handle - coap handle
+ * @param buf - the buffer, NULL - write every frame at once (the held
+ *        frames are written first)
+ * @param size - size of the buffer
+ *
+ * @return status of operation
+ *
+ */
+enum ucoap_error
+ucoap_tcp_coalesce(struct ucoap_handle * const handle, uint8_t * const buf,
+        const uint32_t size);
+
+
+/**
+ * @brief Write the frames held by 'ucoap_tcp_coalesce' at once
+ *
+ * @param handle - coap handle
+ *
+ * @return status of operation
+ *
+ */
+enum ucoap_error
+ucoap_tcp_flush(struct ucoap_handle * const handle);
+
+
+/**
+ * @brief Receive whole packet without copying (asynchronous mode only).
+ *        The packet is parsed and passed to the callback straight from the
+ *        given buffer, which has to be valid for the duration of the call.
+ *        There is no need to call 'ucoap_process' for this packet. With
+ *        in-order completion on a handle without zero-copy receiving the
+ *        packet is copied to the response buffer, as its result may be
+ *        held past the call.
+ *
+ * @param handle - coap handle
+ * @param buf - pointer on buffer with data
+ * @param len - length of data
+ * @param now - current time, ms
+ *
+ * @return status of operation
+ *
+ */
+enum ucoap_error
+ucoap_rx_packet_borrowed(struct ucoap_handle * const handle,
+        const uint8_t * buf, const uint32_t len, const uint32_t now);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
 #endif /* _UCOAP_UCOAP_H_ */
@@ -0,0 +1,770 @@
+/**
+ * ucoap_blockwise.c
+ *
+ * Block-wise transfers (RFC 7959) on top of the asynchronous mode
+ *
+ */
+
+
+#include "ucoap_blockwise.h"
+#include "ucoap_utils.h"
+
+
+#define UCOAP_BLOCK_MAX_SZX          6
+
+
+
+static enum ucoap_error
+request_block(struct ucoap_block_download * const download,
+        struct ucoap_block_slot * const slot, const uint32_t now);
+static void
+download_callback(const struct ucoap_request_descriptor * const reqd,
+        const ucoap_result_data * const result);
+static void
+fail_download(struct ucoap_block_download * const download,
+        const enum ucoap_error err, const uint8_t resp_code);
+static bool
+same_etag(struct ucoap_block_download * const download,
+        const ucoap_option_data * const etag);
+static struct ucoap_block_slot *
+free_slot(struct ucoap_block_slot * const slots, const uint32_t count);
+static uint32_t
+busy_slots(const struct ucoap_block_slot * const slots, const uint32_t count);
+static enum ucoap_error
+send_block(struct ucoap_block_upload * const upload, const uint32_t now);
+static void
+upload_callback(const struct ucoap_request_descriptor * const reqd,
+        const ucoap_result_data * const result);
+static void
+finish_upload(struct ucoap_block_upload * const upload,
+        const enum ucoap_error err, const uint8_t resp_code);
+static enum ucoap_error
+limit_szx(const struct ucoap_handle * const handle, const uint8_t tkl,
+        const uint32_t options_len, uint8_t * const szx);
+static uint32_t
+upload_options_length(struct ucoap_block_upload * const upload);
+static void
+link_options(struct ucoap_block_slot * const slot,
+        const ucoap_option_data * options,
+        const ucoap_option_data * block, const ucoap_option_data * size);
+
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_block_download_start(struct ucoap_block_download * const download,
+        const uint32_t now) {
+    uint32_t i;
+    enum ucoap_error err;
+    const ucoap_option_data * option;
+
+    if (download->handle == NULL || download->sink == NULL || download->done == NULL
+            || download->szx > UCOAP_BLOCK_MAX_SZX || download->window > UCOAP_BLOCK_WINDOW) {
+        return UCOAP_PARAM_ERROR;
+    }
+
+    for (i = 0, option = download->options; option != NULL; option = option->next) {
+        if (++i > UCOAP_BLOCK_MAX_OPTIONS) {
+            return UCOAP_PARAM_ERROR;
+        }
+    }
+
+    /* the options of the response are not known yet */
+    err = limit_szx(download->handle, download->tkl, UCOAP_BLOCK_HEADROOM, &download->szx);
+
+    if (err != UCOAP_OK) {
+        return err;
+    }
+
+    if (download->window == 0) {
+        download->window = 1;
+    }
+
+    download->err = UCOAP_OK;
+    download->resp_code = 0;
+    download->has_size = false;
+    download->last = false;
+    download->size = 0;
+    download->next_num = 0;
+    download->etag_len = 0;
+
+    for (i = 0; i < UCOAP_BLOCK_WINDOW; i++) {
+        download->slots[i].busy = false;
+        download->slots[i].transfer = download;
+    }
+
+    download->state = UCOAP_BLOCK_RUNNING;
+
+    err = request_block(download, &download->slots[0], now);
+
+    if (err != UCOAP_OK) {
+        download->state = UCOAP_BLOCK_IDLE;
+    }
+
+    return err;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+bool
+ucoap_block_download_process(struct ucoap_block_download * const download,
+        const uint32_t now) {
+    enum ucoap_error err;
+    uint32_t busy;
+    struct ucoap_block_slot * slot;
+
+    for (;;) {
+        busy = busy_slots(download->slots, download->window);
+
+        if (download->state != UCOAP_BLOCK_RUNNING || download->last) {
+            break;
+        }
+
+        /* blocks are requested ahead only within the known size */
+        if (busy != 0 && (!download->has_size || download->next_num
+                    * ucoap_decode_szx_to_size(download->szx) >= download->size)) {
+            break;
+        }
+
+        slot = free_slot(download->slots, download->window);
+
+        if (slot == NULL) {
+            break;
+        }
+
+        err = request_block(download, slot, now);
+
+        /* all transactions of the handle are busy, try later */
+        if (err == UCOAP_BUSY_ERROR) {
+            break;
+        }
+
+        if (err != UCOAP_OK) {
+            fail_download(download, err, 0);
+        }
+    }
+
+    if (busy == 0 && (download->state == UCOAP_BLOCK_FINISHING
+                || (download->state == UCOAP_BLOCK_RUNNING && download->last))) {
+        download->state = UCOAP_BLOCK_DONE;
+        download->done(download, download->err, download->resp_code);
+    }
+
+    return download->state == UCOAP_BLOCK_RUNNING
+            || download->state == UCOAP_BLOCK_FINISHING;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_block_upload_start(struct ucoap_block_upload * const upload,
+        const uint32_t now) {
+    uint32_t i;
+    enum ucoap_error err;
+    const ucoap_option_data * option;
+
+    if (upload->handle == NULL || upload->done == NULL
+            || upload->szx > UCOAP_BLOCK_MAX_SZX
+            || (upload->source == NULL && upload->payload.buf == NULL)) {
+        return UCOAP_PARAM_ERROR;
+    }
+
+    for (i = 0, option = upload->options; option != NULL; option = option->next) {
+        if (++i > UCOAP_BLOCK_MAX_OPTIONS) {
+            return UCOAP_PARAM_ERROR;
+        }
+    }
+
+    err = limit_szx(upload->handle, upload->tkl, upload_options_length(upload), &upload->szx);
+
+    if (err != UCOAP_OK) {
+        return err;
+    }
+
+    if (upload->source != NULL
+            && upload->buffer.len < ucoap_decode_szx_to_size(upload->szx)) {
+        return UCOAP_PARAM_ERROR;
+    }
+
+    upload->err = UCOAP_OK;
+    upload->resp_code = 0;
+    upload->offset = 0;
+    upload->len = 0;
+    upload->ready = true;
+    upload->slot.busy = false;
+    upload->slot.transfer = upload;
+
+    upload->state = UCOAP_BLOCK_RUNNING;
+
+    err = send_block(upload, now);
+
+    if (err != UCOAP_OK) {
+        upload->state = UCOAP_BLOCK_IDLE;
+    }
+
+    return err;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+bool
+ucoap_block_upload_process(struct ucoap_block_upload * const upload,
+        const uint32_t now) {
+    enum ucoap_error err;
+
+    if (upload->state == UCOAP_BLOCK_RUNNING && upload->ready && !upload->slot.busy) {
+        err = send_block(upload, now);
+
+        /* all transactions of the handle are busy, try later */
+        if (err != UCOAP_OK && err != UCOAP_BUSY_ERROR) {
+            finish_upload(upload, err, 0);
+        }
+    }
+
+    if (upload->state == UCOAP_BLOCK_FINISHING && !upload->slot.busy) {
+        upload->state = UCOAP_BLOCK_DONE;
+        upload->done(upload, upload->err, upload->resp_code);
+    }
+
+    return upload->state == UCOAP_BLOCK_RUNNING
+            || upload->state == UCOAP_BLOCK_FINISHING;
+}
+
+
+/**
+ * @brief Submit the request of the next block
+ *
+ * @param download - the transfer
+ * @param slot - free slot for the request
+ * @param now - current time, ms
+ *
+ * @return status of operation
+ */
+static enum ucoap_error
+request_block(struct ucoap_block_download * const download,
+        struct ucoap_block_slot * const slot, const uint32_t now) {
+    enum ucoap_error err;
+    ucoap_blockwise_data bw;
+    ucoap_option_data block2;
+    ucoap_option_data size2;
+
+    bw.fld.num = download->next_num;
+    bw.fld.block_szx = download->szx;
+    bw.fld.more = 0;
+
+    ucoap_fill_block2_opt(&block2, &bw, slot->block_value);
+
+    size2.num = UCOAP_SIZE2_OPT;
+    size2.len = 0;
+    size2.value = slot->size_value;
+
+    /* the size of the resource is asked once */
+    link_options(slot, download->options, &block2,
+            download->next_num == 0 ? &size2 : NULL);
+
+    slot->reqd.type = download->type;
+    slot->reqd.code = UCOAP_REQ_GET;
+    slot->reqd.tkl = download->tkl;
+    slot->reqd.payload.buf = NULL;
+    slot->reqd.payload.len = 0;
+    slot->reqd.response_callback = download_callback;
+    slot->num = download->next_num++;
+
+    /* the callback may come before return */
+    slot->busy = true;
+
+    err = ucoap_submit_coap_request(download->handle, &slot->reqd, now);
+
+    if (err != UCOAP_OK) {
+        slot->busy = false;
+        download->next_num--;
+    }
+
+    return err;
+}
+
+
+/**
+ * @brief Pass the block to the sink and learn the size of the resource
+ *
+ * @param reqd - descriptor of the block request
+ * @param result - the response
+ *
+ */
+static void
+download_callback(const struct ucoap_request_descriptor * const reqd,
+        const ucoap_result_data * const result) {
+    struct ucoap_block_slot * const slot = (struct ucoap_block_slot *)reqd;
+    struct ucoap_block_download * const download = slot->transfer;
+    const ucoap_option_data * block2;
+    const ucoap_option_data * size2;
+    const ucoap_option_data * etag;
+    ucoap_option_data options[3];
+    ucoap_option_iterator it;
+    ucoap_blockwise_data bw;
+    uint32_t block_size;
+
+    slot->busy = false;
+
+    /* the blocks which come after a failure are dropped */
+    if (download->state != UCOAP_BLOCK_RUNNING) {
+        return;
+    }
+
+    if (result->err != UCOAP_OK || result->resp_code != UCOAP_RESP_SUCCESS_CONTENT_205) {
+        fail_download(download, result->err, result->resp_code);
+        return;
+    }
+
+    download->resp_code = result->resp_code;
+
+    /* one walk over the options, they are in ascending order */
+    ucoap_option_iterator_init(&it, &result->options);
+
+    etag = ucoap_option_seek(&it, UCOAP_ETAG_OPT, &options[0]) ? &options[0] : NULL;
+    block2 = ucoap_option_seek(&it, UCOAP_BLOCK2_OPT, &options[1]) ? &options[1] : NULL;
+    size2 = ucoap_option_seek(&it, UCOAP_SIZE2_OPT, &options[2]) ? &options[2] : NULL;
+
+    /* the representation has changed in the middle of the transfer */
+    if (!same_etag(download, etag)) {
+        fail_download(download, UCOAP_WRONG_STATE_ERROR, result->resp_code);
+        return;
+    }
+
+    /* the whole resource has come at once */
+    if (block2 == NULL) {
+        if (slot->num != 0) {
+            fail_download(download, UCOAP_WRONG_OPTIONS_ERROR, result->resp_code);
+            return;
+        }
+
+        download->last = true;
+        download->sink(download, 0, &result->payload);
+        return;
+    }
+
+    ucoap_extract_block2_from_opt(block2, &bw);
+
+    if (bw.fld.block_szx > download->szx) {
+        fail_download(download, UCOAP_WRONG_OPTIONS_ERROR, result->resp_code);
+        return;
+    }
+
+    if (bw.fld.block_szx < download->szx) {
+        /* the server wants smaller blocks, it is possible until the others are asked */
+        if (busy_slots(download->slots, download->window) != 0
+                || (uint32_t)(bw.fld.num >> (download->szx - bw.fld.block_szx)) != slot->num) {
+            fail_download(download, UCOAP_WRONG_OPTIONS_ERROR, result->resp_code);
+            return;
+        }
+
+        download->szx = bw.fld.block_szx;
+        download->next_num = bw.fld.num + 1;
+    } else if (bw.fld.num != slot->num) {
+        fail_download(download, UCOAP_WRONG_OPTIONS_ERROR, result->resp_code);
+        return;
+    }
+
+    block_size = ucoap_decode_szx_to_size(bw.fld.block_szx);
+
+    /* only the last block may be short */
+    if (bw.fld.more && result->payload.len != block_size) {
+        fail_download(download, UCOAP_WRONG_OPTIONS_ERROR, result->resp_code);
+        return;
+    }
+
+    if (size2 != NULL && !download->has_size) {
+        download->size = decode_uint_value(size2->value, size2->len);
+        download->has_size = true;
+    }
+
+    if (!bw.fld.more) {
+        download->last = true;
+    }
+
+    download->sink(download, bw.fld.num * block_size, &result->payload);
+}
+
+
+/**
+ * @brief Submit the block of the payload at 'offset'
+ *
+ * @param upload - the transfer
+ * @param now - current time, ms
+ *
+ * @return status of operation
+ */
+static enum ucoap_error
+send_block(struct ucoap_block_upload * const upload, const uint32_t now) {
+    uint32_t i;
+    uint32_t block_size;
+    enum ucoap_error err;
+    ucoap_blockwise_data bw;
+    ucoap_option_data block1;
+    ucoap_option_data size1;
+    struct ucoap_block_slot * const slot = &upload->slot;
+
+    block_size = ucoap_decode_szx_to_size(upload->szx);
+
+    if (upload->source != NULL) {
+        upload->len = upload->source(upload, upload->offset, upload->buffer.buf, block_size);
+        upload->more = upload->len == block_size;
+
+        slot->reqd.payload.buf = upload->buffer.buf;
+    } else {
+        upload->len = upload->payload.len - upload->offset;
+
+        if (upload->len > block_size) {
+            upload->len = block_size;
+        }
+
+        upload->more = upload->offset + upload->len < upload->payload.len;
+
+        slot->reqd.payload.buf = upload->payload.buf + upload->offset;
+    }
+
+    slot->reqd.payload.len = upload->len;
+
+    bw.fld.num = upload->offset / block_size;
+    bw.fld.block_szx = upload->szx;
+    bw.fld.more = upload->more;
+
+    ucoap_fill_block1_opt(&block1, &bw, slot->block_value);
+
+    /* the size of the whole payload is told once, if it is known */
+    size1.num = UCOAP_SIZE1_OPT;
+    size1.len = 0;
+    size1.value = slot->size_value;
+
+    for (i = sizeof(slot->size_value); i > 0; i--) {
+        if (size1.len || (upload->payload.len >> ((i - 1) * 8)) & 0xFF) {
+            slot->size_value[size1.len++] = (upload->payload.len >> ((i - 1) * 8)) & 0xFF;
+        }
+    }
+
+    link_options(slot, upload->options, &block1,
+            upload->offset == 0 && upload->source == NULL ? &size1 : NULL);
+
+    slot->reqd.type = upload->type;
+    slot->reqd.code = upload->code;
+    slot->reqd.tkl = upload->tkl;
+    slot->reqd.response_callback = upload_callback;
+    slot->num = bw.fld.num;
+
+    /* the callback may come before return */
+    slot->busy = true;
+    upload->ready = false;
+
+    err = ucoap_submit_coap_request(upload->handle, &slot->reqd, now);
+
+    if (err != UCOAP_OK) {
+        slot->busy = false;
+        upload->ready = true;
+    }
+
+    return err;
+}
+
+
+/**
+ * @brief Move to the next block, or resend the current one by smaller
+ *        blocks, or finish the transfer
+ *
+ * @param reqd - descriptor of the block request
+ * @param result - the response
+ *
+ */
+static void
+upload_callback(const struct ucoap_request_descriptor * const reqd,
+        const ucoap_result_data * const result) {
+    struct ucoap_block_slot * const slot = (struct ucoap_block_slot *)reqd;
+    struct ucoap_block_upload * const upload = slot->transfer;
+    const ucoap_option_data * block1;
+    const ucoap_option_data * size1;
+    ucoap_option_data options[2];
+    ucoap_option_iterator it;
+    ucoap_blockwise_data bw;
+
+    slot->busy = false;
+
+    if (upload->state != UCOAP_BLOCK_RUNNING) {
+        return;
+    }
+
+    if (result->err != UCOAP_OK) {
+        finish_upload(upload, result->err, result->resp_code);
+        return;
+    }
+
+    ucoap_option_iterator_init(&it, &result->options);
+
+    block1 = ucoap_option_seek(&it, UCOAP_BLOCK1_OPT, &options[0]) ? &options[0] : NULL;
+    size1 = ucoap_option_seek(&it, UCOAP_SIZE1_OPT, &options[1]) ? &options[1] : NULL;
+
+    if (block1 != NULL) {
+        ucoap_extract_block1_from_opt(block1, &bw);
+    }
+
+    if (result->resp_code == UCOAP_RESP_REQUEST_ENTITY_TOO_LARGE_413) {
+        /* the server tells the block size it accepts ... */
+        if (block1 != NULL && bw.fld.block_szx < upload->szx) {
+            upload->szx = bw.fld.block_szx;
+            upload->ready = true;
+            return;
+        }
+
+        /* ... or the largest payload, the block may be too large anyway */
+        if ((size1 == NULL || upload->source != NULL
+                    || decode_uint_value(size1->value, size1->len) >= upload->payload.len)
+                && upload->szx > 0) {
+            upload->szx--;
+            upload->ready = true;
+            return;
+        }
+
+        finish_upload(upload, UCOAP_OK, result->resp_code);
+        return;
+    }
+
+    if (UCOAP_EXTRACT_CLASS(result->resp_code) != UCOAP_SUCCESS_CLASS) {
+        finish_upload(upload, UCOAP_OK, result->resp_code);
+        return;
+    }
+
+    /* the final response */
+    if (!upload->more) {
+        finish_upload(upload, UCOAP_OK, result->resp_code);
+        return;
+    }
+
+    /* 2.31 Continue, or 2.04 of a server which handles the blocks one by one */
+    if (block1 == NULL || bw.fld.num != slot->num || bw.fld.block_szx > upload->szx) {
+        finish_upload(upload, UCOAP_WRONG_OPTIONS_ERROR, result->resp_code);
+        return;
+    }
+
+    upload->szx = bw.fld.block_szx;
+    upload->offset += upload->len;
+    upload->ready = true;
+}
+
+
+/**
+ * @brief Stop sending the blocks, 'done' is called when the block in
+ *        flight is over
+ *
+ * @param upload - the transfer
+ * @param err - reason of failure or UCOAP_OK
+ * @param resp_code - code of the last response
+ *
+ */
+static void
+finish_upload(struct ucoap_block_upload * const upload,
+        const enum ucoap_error err, const uint8_t resp_code) {
+    upload->state = UCOAP_BLOCK_FINISHING;
+    upload->err = err;
+    upload->resp_code = resp_code;
+}
+
+
+/**
+ * @brief Stop requesting the blocks, 'done' is called after the blocks
+ *        in flight
+ *
+ * @param download - the transfer
+ * @param err - reason of failure
+ * @param resp_code - code of the response
+ *
+ */
+static void
+fail_download(struct ucoap_block_download * const download,
+        const enum ucoap_error err, const uint8_t resp_code) {
+    download->state = UCOAP_BLOCK_FINISHING;
+    download->err = err;
+    download->resp_code = resp_code;
+}
+
+
+/**
+ * @brief Compare ETag of the block with the first one
+ *
+ * @param download - the transfer
+ * @param etag - ETag option of the block or NULL
+ *
+ * @return false if the representation has changed
+ */
+static bool
+same_etag(struct ucoap_block_download * const download,
+        const ucoap_option_data * const etag) {
+    if (etag == NULL || etag->len > sizeof(download->etag)) {
+        return true;
+    }
+
+    if (download->etag_len == 0) {
+        mem_copy(download->etag, etag->value, etag->len);
+        download->etag_len = etag->len;
+        return true;
+    }
+
+    return etag->len == download->etag_len
+            && mem_cmp(etag->value, download->etag, etag->len);
+}
+
+
+/**
+ * @brief Limit the block size so the whole message of the block (header,
+ *        token, options, payload marker and the block) fits into the
+ *        buffers of the handle
+ *
+ * @param handle - coap handle
+ * @param tkl - length of token
+ * @param options_len - length of encoded options of the message
+ * @param szx - the largest block wanted, replaced by the one which fits
+ *
+ * @return status of operation, UCOAP_PARAM_ERROR if even 16 bytes do not fit
+ */
+static enum ucoap_error
+limit_szx(const struct ucoap_handle * const handle, const uint8_t tkl,
+        const uint32_t options_len, uint8_t * const szx) {
+    while (request_frame_length(handle->transport, tkl, options_len,
+                ucoap_decode_szx_to_size(*szx)) > UCOAP_PDU_SIZE(handle)) {
+        if (*szx == 0) {
+            return UCOAP_PARAM_ERROR;
+        }
+
+        (*szx)--;
+    }
+
+    return UCOAP_OK;
+}
+
+
+/**
+ * @brief Get the length of the options of a block request at most: the
+ *        options of the user, Block1 with 3-byte value and Size1 with
+ *        4-byte one if it is sent
+ *
+ * @param upload - the transfer
+ *
+ * @return length of encoded options
+ */
+static uint32_t
+upload_options_length(struct ucoap_block_upload * const upload) {
+    ucoap_option_data block1;
+    ucoap_option_data size1;
+
+    block1.num = UCOAP_BLOCK1_OPT;
+    block1.len = sizeof(upload->slot.block_value);
+    block1.value = upload->slot.block_value;
+
+    size1.num = UCOAP_SIZE1_OPT;
+    size1.len = sizeof(upload->slot.size_value);
+    size1.value = upload->slot.size_value;
+
+    link_options(&upload->slot, upload->options, &block1,
+            upload->source == NULL ? &size1 : NULL);
+
+    return encoded_options_length(upload->slot.reqd.options);
+}
+
+
+/**
+ * @brief Find a slot without request in flight
+ *
+ * @param slots - slots of the transfer
+ * @param count - count of the slots in use
+ *
+ * @return pointer on the slot or NULL if all are busy
+ */
+static struct ucoap_block_slot *
+free_slot(struct ucoap_block_slot * const slots, const uint32_t count) {
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        if (!slots[i].busy) {
+            return &slots[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Count the requests in flight
+ *
+ * @param slots - slots of the transfer
+ * @param count - count of the slots in use
+ *
+ * @return count of requests
+ */
+static uint32_t
+busy_slots(const struct ucoap_block_slot * const slots, const uint32_t count) {
+    uint32_t i;
+    uint32_t busy;
+
+    busy = 0;
+
+    for (i = 0; i < count; i++) {
+        if (slots[i].busy) {
+            busy++;
+        }
+    }
+
+    return busy;
+}
+
+
+/**
+ * @brief Copy the options of the user into the slot and insert the block
+ *        option and the size one in order of numbers
+ *
+ * @param slot - slot of the request
+ * @param options - options of the user, may be NULL
+ * @param block - block option
+ * @param size - size option (its number is above the block one) or NULL
+ *
+ */
+static void
+link_options(struct ucoap_block_slot * const slot,
+        const ucoap_option_data * options,
+        const ucoap_option_data * block, const ucoap_option_data * size) {
+    uint32_t i;
+    ucoap_option_data * const out = slot->options;
+
+    i = 0;
+
+    while (options != NULL || block != NULL || size != NULL) {
+        if (block != NULL && (options == NULL || options->num > block->num)) {
+            out[i] = *block;
+            block = NULL;
+        } else if (block == NULL && size != NULL
+                && (options == NULL || options->num > size->num)) {
+            out[i] = *size;
+            size = NULL;
+        } else {
+            out[i] = *options;
+            options = options->next;
+        }
+
+        if (i > 0) {
+            out[i - 1].next = &out[i];
+        }
+
+        out[i++].next = NULL;
+    }
+
+    slot->reqd.options = out;
+}
@@ -0,0 +1,257 @@
+/**
+ * ucoap_blockwise.h
+ *
+ * Block-wise transfers (RFC 7959) on top of the asynchronous mode. The
+ * download keeps a few block requests in flight at once and passes every
+ * block to the application as soon as it has come. The upload sends a
+ * large payload block by block, so it does not have to fit into the PDU.
+ *
+ */
+
+
+#ifndef _UCOAP_UCOAP_BLOCKWISE_H_
+#define _UCOAP_UCOAP_BLOCKWISE_H_
+
+
+#include "ucoap.h"
+#include "ucoap_helpers.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#ifndef UCOAP_BLOCK_WINDOW
+#define UCOAP_BLOCK_WINDOW              2         /* blocks in flight, up to UCOAP_MAX_TRANSACTIONS */
+#endif /* UCOAP_BLOCK_WINDOW */
+
+#ifndef UCOAP_BLOCK_MAX_OPTIONS
+#define UCOAP_BLOCK_MAX_OPTIONS         4         /* options of the request besides block ones */
+#endif /* UCOAP_BLOCK_MAX_OPTIONS */
+
+#ifndef UCOAP_BLOCK_HEADROOM
+#define UCOAP_BLOCK_HEADROOM            32        /* options of a downloaded block: ETag, Block2, Size2, ... */
+#endif /* UCOAP_BLOCK_HEADROOM */
+
+
+struct ucoap_block_download;
+struct ucoap_block_upload;
+
+
+/**
+ * @brief Receives the next block of the resource. The blocks may come out
+ *        of order if the window is wider than one block.
+ *
+ * @param download - the transfer
+ * @param offset - position of the block in the resource
+ * @param data - the block, valid only during the call
+ *
+ */
+typedef void (* ucoap_block_sink)(struct ucoap_block_download * const download,
+        const uint32_t offset, const ucoap_data * const data);
+
+
+/**
+ * @brief Called once when the transfer is over
+ *
+ * @param download - the transfer
+ * @param err - UCOAP_OK or the reason of failure of an exchange
+ * @param resp_code - code of the last response (2.05 if all is right)
+ *
+ */
+typedef void (* ucoap_block_download_done)(struct ucoap_block_download * const download,
+        const enum ucoap_error err, const uint8_t resp_code);
+
+
+/**
+ * @brief Fills the next block of the payload to upload. The same offset
+ *        may be asked again if the server wants smaller blocks.
+ *
+ * @param upload - the transfer
+ * @param offset - position of the block in the payload
+ * @param buf - buffer for the block
+ * @param len - size of the block
+ *
+ * @return count of filled bytes, less than 'len' for the last block
+ */
+typedef uint32_t (* ucoap_block_source)(struct ucoap_block_upload * const upload,
+        const uint32_t offset, uint8_t * const buf, const uint32_t len);
+
+
+/**
+ * @brief Called once when the upload is over
+ *
+ * @param upload - the transfer
+ * @param err - UCOAP_OK or the reason of failure of an exchange
+ * @param resp_code - code of the last response (e.g. 4.13 if the payload
+ *        is too large for the server)
+ *
+ */
+typedef void (* ucoap_block_upload_done)(struct ucoap_block_upload * const upload,
+        const enum ucoap_error err, const uint8_t resp_code);
+
+
+/**
+ * @brief A block request of the transfer. Internal, do not use it directly.
+ */
+struct ucoap_block_slot {
+
+    ucoap_request_descriptor reqd; /* must be the first member */
+
+    void * transfer;
+    uint32_t num;
+    bool busy;
+
+    uint8_t block_value[3];
+    uint8_t size_value[4];
+    ucoap_option_data options[UCOAP_BLOCK_MAX_OPTIONS + 2];
+
+};
+
+
+enum ucoap_block_state {
+    UCOAP_BLOCK_IDLE = 0,
+    UCOAP_BLOCK_RUNNING,
+    UCOAP_BLOCK_FINISHING,         /* waits for the blocks in flight */
+    UCOAP_BLOCK_DONE
+};
+
+
+struct ucoap_block_download {
+
+    /* filled by user before 'ucoap_block_download_start' */
+    struct ucoap_handle * handle;
+    const ucoap_option_data * options;   /* of GET, in ascending order, without Block2 */
+
+    uint8_t type;                  /* CON or NON */
+    uint8_t tkl;
+    uint8_t szx;                   /* the largest block to ask for, 0..6 */
+    uint8_t window;                /* blocks in flight, 1..UCOAP_BLOCK_WINDOW */
+
+    ucoap_block_sink sink;
+    ucoap_block_download_done done;
+
+    /* state of the transfer */
+    uint8_t state;
+    uint8_t resp_code;
+    enum ucoap_error err;
+
+    bool has_size;
+    bool last;                     /* the block without 'more' flag has come */
+    uint32_t size;                 /* Size2 of the resource */
+    uint32_t next_num;             /* the next block to ask for */
+
+    uint8_t etag_len;
+    uint8_t etag[8];
+
+    struct ucoap_block_slot slots[UCOAP_BLOCK_WINDOW];
+
+};
+
+
+struct ucoap_block_upload {
+
+    /* filled by user before 'ucoap_block_upload_start' */
+    struct ucoap_handle * handle;
+    const ucoap_option_data * options;   /* in ascending order, without Block1 */
+
+    uint8_t code;                  /* POST or PUT */
+    uint8_t type;                  /* CON or NON */
+    uint8_t tkl;
+    uint8_t szx;                   /* the largest block to send, 0..6 */
+
+    ucoap_data payload;            /* the whole payload, or ... */
+    ucoap_block_source source;     /* ... pull it by blocks into 'buffer' */
+    ucoap_data buffer;             /* not less than the block */
+
+    ucoap_block_upload_done done;
+
+    /* state of the transfer */
+    uint8_t state;
+    uint8_t resp_code;
+    enum ucoap_error err;
+
+    bool ready;                    /* the block at 'offset' has to be sent */
+    bool more;                     /* the block in flight is not the last */
+    uint32_t offset;               /* of the block in flight */
+    uint32_t len;                  /* of the block in flight */
+
+    struct ucoap_block_slot slot;
+
+};
+
+
+/**
+ * @brief Start downloading the resource by Block2 (asynchronous mode).
+ *        The first block asks for the size of the resource (Size2) with
+ *        the block size limited by 'szx' and PDU size of the handle. The
+ *        server may answer with a smaller block, it is used then. If the
+ *        server tells the size, up to 'window' blocks are requested at
+ *        once, otherwise they are requested one by one.
+ *
+ * @param download - the transfer, has to live until 'done' is called
+ * @param now - current time, ms
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_block_download_start(struct ucoap_block_download * const download,
+        const uint32_t now);
+
+
+/**
+ * @brief Request the next blocks and call 'done' when the transfer is
+ *        over. Call it after each 'ucoap_process' of the handle.
+ *
+ * @param download - the transfer
+ * @param now - current time, ms
+ *
+ * @return true if the transfer is still running
+ */
+bool
+ucoap_block_download_process(struct ucoap_block_download * const download,
+        const uint32_t now);
+
+
+/**
+ * @brief Start uploading the payload by Block1 (asynchronous mode). The
+ *        block size is limited by 'szx' and so the whole block request
+ *        (header, token, options with Block1 and Size1, the block) fits
+ *        into PDU size of the handle, UCOAP_PARAM_ERROR if even 16 bytes
+ *        do not fit. The blocks are sent one by one, the next one after
+ *        2.31 Continue (or another success code echoing Block1 with
+ *        'more' flag). A smaller block size asked by the server is taken
+ *        over, 4.13 is answered by a smaller block unless Size1 of the
+ *        response tells that the whole payload is too large.
+ *
+ * @param upload - the transfer, has to live until 'done' is called
+ * @param now - current time, ms
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_block_upload_start(struct ucoap_block_upload * const upload,
+        const uint32_t now);
+
+
+/**
+ * @brief Send the next block and call 'done' when the transfer is over.
+ *        Call it after each 'ucoap_process' of the handle.
+ *
+ * @param upload - the transfer
+ * @param now - current time, ms
+ *
+ * @return true if the transfer is still running
+ */
+bool
+ucoap_block_upload_process(struct ucoap_block_upload * const upload,
+        const uint32_t now);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* _UCOAP_UCOAP_BLOCKWISE_H_ */
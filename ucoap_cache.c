@@ -0,0 +1,518 @@
+/**
+ * ucoap_cache.c
+ *
+ * Client-side response cache on top of the asynchronous mode
+ *
+ */
+
+
+#include "ucoap_cache.h"
+#include "ucoap_helpers.h"
+#include "ucoap_utils.h"
+
+
+#if UCOAP_CACHE_KEY_SIZE > 255
+#error "UCOAP_CACHE_KEY_SIZE should not exceed 255"
+#endif
+
+#define UCOAP_CACHE_NO_FORMAT        0xFF
+#define UCOAP_CACHE_OPTIONS_SIZE     16        /* ETag and Content-Format of an entry, encoded */
+#define UCOAP_CACHE_MAX_AGE_LIMIT    (0x7FFFFFFF / 1000)   /* s, half of the clock range */
+
+
+
+static void
+cache_callback(const struct ucoap_request_descriptor * const reqd,
+        const ucoap_result_data * const result);
+static void
+serve(const ucoap_request_descriptor * const reqd,
+        const struct ucoap_cache_entry * const entry);
+static void
+store(struct ucoap_cache * const cache,
+        const struct ucoap_cache_request * const creq,
+        const ucoap_result_data * const result);
+static uint8_t
+make_key(uint8_t * const key, const ucoap_request_descriptor * const reqd);
+static struct ucoap_cache_entry *
+find_entry(struct ucoap_cache * const cache, const uint8_t * const key,
+        const uint8_t key_len);
+static struct ucoap_cache_entry *
+victim_entry(struct ucoap_cache * const cache, const uint32_t now);
+static bool
+is_fresh(const struct ucoap_cache_entry * const entry, const uint32_t now);
+static uint32_t
+max_age(const ucoap_result_data * const result);
+static bool
+link_etag(struct ucoap_cache_request * const creq,
+        const ucoap_option_data * options, ucoap_option_data * const etag);
+
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_cache_init(struct ucoap_cache * const cache) {
+    uint32_t i;
+
+    cache->hits = 0;
+    cache->validations = 0;
+    cache->misses = 0;
+
+    for (i = 0; i < UCOAP_CACHE_ENTRIES; i++) {
+        cache->entries[i].used = false;
+    }
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_cache_submit(struct ucoap_cache * const cache,
+        struct ucoap_cache_request * const creq,
+        struct ucoap_handle * const handle,
+        const ucoap_request_descriptor * const reqd,
+        const uint32_t now) {
+    enum ucoap_error err;
+    ucoap_option_data etag;
+    struct ucoap_cache_entry * entry;
+
+    if (cache == NULL || creq == NULL || reqd == NULL
+            || reqd->response_callback == NULL) {
+        return UCOAP_PARAM_ERROR;
+    }
+
+    creq->reqd = *reqd;
+    creq->reqd.response_callback = cache_callback;
+    creq->cache = cache;
+    creq->user = reqd;
+    creq->sent_at = now;
+    creq->etag_len = 0;
+    creq->key_len = 0;
+
+    entry = NULL;
+
+    if (reqd->code == UCOAP_REQ_GET) {
+        creq->key_len = make_key(creq->key, reqd);
+    }
+
+    if (creq->key_len != 0) {
+        entry = find_entry(cache, creq->key, creq->key_len);
+    }
+
+    if (entry != NULL && is_fresh(entry, now)) {
+        cache->hits++;
+        serve(reqd, entry);
+        return UCOAP_OK;
+    }
+
+    /* the stale response is asked to be validated by its ETag */
+    if (entry != NULL && entry->etag_len != 0) {
+        mem_copy(creq->etag, entry->etag, entry->etag_len);
+
+        etag.num = UCOAP_ETAG_OPT;
+        etag.len = entry->etag_len;
+        etag.value = creq->etag;
+
+        if (link_etag(creq, reqd->options, &etag)) {
+            creq->etag_len = entry->etag_len;
+        }
+    }
+
+    err = ucoap_submit_coap_request(handle, &creq->reqd, now);
+
+    if (err == UCOAP_OK && creq->key_len != 0) {
+        cache->misses++;
+    }
+
+    return err;
+}
+
+
+/**
+ * @brief Keep or validate the response and pass it to the callback of
+ *        the user
+ *
+ * @param reqd - descriptor of the request (the first member of the
+ *        'ucoap_cache_request')
+ * @param result - the response
+ *
+ */
+static void
+cache_callback(const struct ucoap_request_descriptor * const reqd,
+        const ucoap_result_data * const result) {
+    const struct ucoap_cache_request * const creq = (const struct ucoap_cache_request *)reqd;
+    struct ucoap_cache * const cache = creq->cache;
+    struct ucoap_cache_entry * entry;
+    ucoap_option_data option;
+    const ucoap_option_data * etag;
+
+    entry = NULL;
+
+    if (result->err == UCOAP_OK && creq->key_len != 0) {
+        entry = find_entry(cache, creq->key, creq->key_len);
+    }
+
+    if (entry == NULL) {
+        if (result->err == UCOAP_OK && creq->key_len != 0
+                && result->resp_code == UCOAP_RESP_SUCCESS_CONTENT_205) {
+            store(cache, creq, result);
+        }
+
+        creq->user->response_callback(creq->user, result);
+        return;
+    }
+
+    etag = ucoap_find_option(&result->options, UCOAP_ETAG_OPT, &option) ? &option : NULL;
+
+    switch (result->resp_code) {
+        case UCOAP_RESP_SUCCESS_VALID_203:
+            /* the entry may have been replaced while the request was in flight */
+            if (creq->etag_len != 0 && creq->etag_len == entry->etag_len
+                    && mem_cmp(creq->etag, entry->etag, entry->etag_len)
+                    && (etag == NULL || (etag->len == entry->etag_len
+                            && mem_cmp(etag->value, entry->etag, etag->len)))) {
+                entry->stored_at = creq->sent_at;
+                entry->max_age = max_age(result);
+                cache->validations++;
+                serve(creq->user, entry);
+                return;
+            }
+
+            /* validates something else than the kept response */
+            entry->used = false;
+            break;
+
+        case UCOAP_RESP_SUCCESS_CONTENT_205:
+            store(cache, creq, result);
+            break;
+
+        default:
+            /* the resource has gone or changed by other means */
+            entry->used = false;
+            break;
+    }
+
+    creq->user->response_callback(creq->user, result);
+}
+
+
+/**
+ * @brief Pass the kept response to the callback
+ *
+ * @param reqd - descriptor of the request of the user
+ * @param entry - the response
+ *
+ */
+static void
+serve(const ucoap_request_descriptor * const reqd,
+        const struct ucoap_cache_entry * const entry) {
+    ucoap_result_data result;
+    ucoap_option_data options[2];
+    uint8_t encoded[UCOAP_CACHE_OPTIONS_SIZE];
+    uint32_t count;
+
+    count = 0;
+
+    if (entry->etag_len != 0) {
+        options[count].num = UCOAP_ETAG_OPT;
+        options[count].len = entry->etag_len;
+        options[count].value = (uint8_t *)entry->etag;
+        count++;
+    }
+
+    if (entry->format_len != UCOAP_CACHE_NO_FORMAT) {
+        options[count].num = UCOAP_CONTENT_FORMAT_OPT;
+        options[count].len = entry->format_len;
+        options[count].value = (uint8_t *)entry->format;
+        count++;
+    }
+
+    if (count != 0) {
+        options[0].next = count > 1 ? &options[1] : NULL;
+        options[count - 1].next = NULL;
+    }
+
+    result.resp_code = entry->resp_code;
+    result.payload.buf = entry->payload_len != 0 ? (uint8_t *)entry->payload : NULL;
+    result.payload.len = entry->payload_len;
+    result.options.buf = encoded;
+    result.options.len = count != 0 ? encoding_options(encoded, options) : 0;
+    result.err = UCOAP_OK;
+
+    reqd->response_callback(reqd, &result);
+}
+
+
+/**
+ * @brief Keep the response if it fits into an entry and may be used again
+ *
+ * @param cache - the cache
+ * @param creq - the request
+ * @param result - the response
+ *
+ */
+static void
+store(struct ucoap_cache * const cache,
+        const struct ucoap_cache_request * const creq,
+        const ucoap_result_data * const result) {
+    struct ucoap_cache_entry * entry;
+    const ucoap_option_data * etag;
+    const ucoap_option_data * format;
+    ucoap_option_data options[2];
+    ucoap_option_iterator it;
+    uint32_t age;
+
+    ucoap_option_iterator_init(&it, &result->options);
+
+    etag = ucoap_option_seek(&it, UCOAP_ETAG_OPT, &options[0]) ? &options[0] : NULL;
+    format = ucoap_option_seek(&it, UCOAP_CONTENT_FORMAT_OPT, &options[1]) ? &options[1] : NULL;
+
+    if (etag != NULL && (etag->len == 0 || etag->len > sizeof(entry->etag))) {
+        etag = NULL;
+    }
+
+    age = max_age(result);
+    entry = find_entry(cache, creq->key, creq->key_len);
+
+    /* a response which is stale at once is kept only to be validated */
+    if (result->payload.len > UCOAP_CACHE_PAYLOAD_SIZE
+            || (format != NULL && format->len > sizeof(entry->format))
+            || (age == 0 && etag == NULL)) {
+        if (entry != NULL) {
+            entry->used = false;
+        }
+
+        return;
+    }
+
+    if (entry == NULL) {
+        entry = victim_entry(cache, creq->sent_at);
+    }
+
+    entry->used = true;
+    entry->key_len = creq->key_len;
+    mem_copy(entry->key, creq->key, creq->key_len);
+
+    entry->resp_code = result->resp_code;
+    entry->stored_at = creq->sent_at;
+    entry->max_age = age;
+
+    entry->etag_len = etag != NULL ? etag->len : 0;
+
+    if (etag != NULL) {
+        mem_copy(entry->etag, etag->value, etag->len);
+    }
+
+    entry->format_len = format != NULL ? format->len : UCOAP_CACHE_NO_FORMAT;
+
+    if (format != NULL) {
+        mem_copy(entry->format, format->value, format->len);
+    }
+
+    entry->payload_len = result->payload.len;
+
+    if (result->payload.len != 0) {
+        mem_copy(entry->payload, result->payload.buf, result->payload.len);
+    }
+}
+
+
+/**
+ * @brief Encode the method and the options which make up the cache key
+ *
+ * @param key - buffer of UCOAP_CACHE_KEY_SIZE bytes
+ * @param reqd - descriptor of the request
+ *
+ * @return length of the key, 0 if the request is not cacheable
+ */
+static uint8_t
+make_key(uint8_t * const key, const ucoap_request_descriptor * const reqd) {
+    uint32_t len;
+    const ucoap_option_data * option;
+
+    len = 0;
+    key[len++] = reqd->code;
+
+    for (option = reqd->options; option != NULL; option = option->next) {
+        /* notifications are not cached */
+        if (option->num == UCOAP_OBSERVE_OPT) {
+            return 0;
+        }
+
+        if (UCOAP_OPT_NO_CACHE_KEY(option->num)) {
+            continue;
+        }
+
+        if (len + 3 + option->len > UCOAP_CACHE_KEY_SIZE) {
+            return 0;
+        }
+
+        key[len++] = option->num >> 8;
+        key[len++] = option->num & 0xFF;
+        key[len++] = option->len;
+        mem_copy(key + len, option->value, option->len);
+        len += option->len;
+    }
+
+    return len;
+}
+
+
+/**
+ * @brief Find the entry by the cache key
+ *
+ * @param cache - the cache
+ * @param key - the key
+ * @param key_len - length of the key
+ *
+ * @return the entry or NULL
+ */
+static struct ucoap_cache_entry *
+find_entry(struct ucoap_cache * const cache, const uint8_t * const key,
+        const uint8_t key_len) {
+    uint32_t i;
+    struct ucoap_cache_entry * entry;
+
+    for (i = 0; i < UCOAP_CACHE_ENTRIES; i++) {
+        entry = &cache->entries[i];
+
+        if (entry->used && entry->key_len == key_len
+                && mem_cmp(entry->key, key, key_len)) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Find an entry for a new response: a free one, or the one which
+ *        has been stale for the longest time (or is the closest to it)
+ *
+ * @param cache - the cache
+ * @param now - current time, ms
+ *
+ * @return the entry
+ */
+static struct ucoap_cache_entry *
+victim_entry(struct ucoap_cache * const cache, const uint32_t now) {
+    uint32_t i;
+    int32_t left;
+    int32_t min_left;
+    struct ucoap_cache_entry * entry;
+    struct ucoap_cache_entry * victim;
+
+    victim = &cache->entries[0];
+    min_left = INT32_MAX;
+
+    for (i = 0; i < UCOAP_CACHE_ENTRIES; i++) {
+        entry = &cache->entries[i];
+
+        if (!entry->used) {
+            return entry;
+        }
+
+        left = (int32_t)(entry->max_age - (now - entry->stored_at));
+
+        if (left < min_left) {
+            min_left = left;
+            victim = entry;
+        }
+    }
+
+    return victim;
+}
+
+
+/**
+ * @brief Check the freshness of the entry
+ *
+ * @param entry - the entry
+ * @param now - current time, ms
+ *
+ * @return true if the response may be served without a request
+ */
+static bool
+is_fresh(const struct ucoap_cache_entry * const entry, const uint32_t now) {
+    return (uint32_t)(now - entry->stored_at) < entry->max_age;
+}
+
+
+/**
+ * @brief Get the freshness lifetime of the response
+ *
+ * @param result - the response
+ *
+ * @return Max-Age, ms
+ */
+static uint32_t
+max_age(const ucoap_result_data * const result) {
+    uint32_t age;
+    ucoap_option_data option;
+
+    if (!ucoap_find_option(&result->options, UCOAP_MAX_AGE_OPT, &option)) {
+        return UCOAP_CACHE_DEFAULT_MAX_AGE * 1000;
+    }
+
+    age = decode_uint_value(option.value, option.len);
+
+    if (age > UCOAP_CACHE_MAX_AGE_LIMIT) {
+        age = UCOAP_CACHE_MAX_AGE_LIMIT;
+    }
+
+    return age * 1000;
+}
+
+
+/**
+ * @brief Copy the options of the user into the request and insert ETag
+ *        in order of numbers
+ *
+ * @param creq - the request
+ * @param options - options of the user, may be NULL
+ * @param etag - ETag option
+ *
+ * @return false if the options do not fit or already have ETag
+ */
+static bool
+link_etag(struct ucoap_cache_request * const creq,
+        const ucoap_option_data * options, ucoap_option_data * const etag) {
+    uint32_t i;
+    const ucoap_option_data * option;
+    ucoap_option_data * const out = creq->options;
+
+    for (i = 0, option = options; option != NULL; option = option->next) {
+        if (++i > UCOAP_CACHE_MAX_OPTIONS || option->num == UCOAP_ETAG_OPT) {
+            return false;
+        }
+    }
+
+    i = 0;
+
+    while (options != NULL && options->num < UCOAP_ETAG_OPT) {
+        out[i] = *options;
+        out[i].next = &out[i + 1];
+        options = options->next;
+        i++;
+    }
+
+    out[i] = *etag;
+    out[i].next = NULL;
+
+    while (options != NULL) {
+        out[i].next = &out[i + 1];
+        i++;
+        out[i] = *options;
+        out[i].next = NULL;
+        options = options->next;
+    }
+
+    creq->reqd.options = out;
+
+    return true;
+}
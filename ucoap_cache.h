@@ -0,0 +1,146 @@
+/**
+ * ucoap_cache.h
+ *
+ * Client-side response cache (RFC 7252, section 5.6) on top of the
+ * asynchronous mode. Responses to GET are kept in a fixed table keyed by
+ * the method and the options which are not marked NoCacheKey. A fresh
+ * response is served without a request, a stale one is revalidated by its
+ * ETag, so an unchanged resource costs a 2.03 Valid without payload.
+ *
+ */
+
+
+#ifndef _UCOAP_UCOAP_CACHE_H_
+#define _UCOAP_UCOAP_CACHE_H_
+
+
+#include "ucoap.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#ifndef UCOAP_CACHE_ENTRIES
+#define UCOAP_CACHE_ENTRIES             4         /* responses kept at once */
+#endif /* UCOAP_CACHE_ENTRIES */
+
+#ifndef UCOAP_CACHE_KEY_SIZE
+#define UCOAP_CACHE_KEY_SIZE            48        /* method and cache-key options, encoded */
+#endif /* UCOAP_CACHE_KEY_SIZE */
+
+#ifndef UCOAP_CACHE_PAYLOAD_SIZE
+#define UCOAP_CACHE_PAYLOAD_SIZE        64        /* larger responses are not kept */
+#endif /* UCOAP_CACHE_PAYLOAD_SIZE */
+
+#ifndef UCOAP_CACHE_MAX_OPTIONS
+#define UCOAP_CACHE_MAX_OPTIONS         4         /* options of the request besides ETag */
+#endif /* UCOAP_CACHE_MAX_OPTIONS */
+
+#define UCOAP_CACHE_DEFAULT_MAX_AGE     60        /* s, if the response has no Max-Age */
+
+
+/**
+ * @brief A kept response. Internal, do not use it directly.
+ */
+struct ucoap_cache_entry {
+
+    bool used;
+    uint8_t key_len;
+    uint8_t key[UCOAP_CACHE_KEY_SIZE];
+
+    uint8_t resp_code;
+    uint8_t etag_len;
+    uint8_t etag[8];
+    uint8_t format_len;            /* Content-Format, 0xFF - absent */
+    uint8_t format[2];
+
+    uint32_t stored_at;            /* ms */
+    uint32_t max_age;              /* ms */
+
+    uint16_t payload_len;
+    uint8_t payload[UCOAP_CACHE_PAYLOAD_SIZE];
+
+};
+
+
+struct ucoap_cache {
+
+    /* counters, may be reset by user */
+    uint32_t hits;                 /* served without a request */
+    uint32_t validations;          /* served after 2.03 Valid */
+    uint32_t misses;               /* sent to the server */
+
+    struct ucoap_cache_entry entries[UCOAP_CACHE_ENTRIES];
+
+};
+
+
+/**
+ * @brief A request which goes through the cache. It has to live until the
+ *        callback of the user is called.
+ */
+struct ucoap_cache_request {
+
+    ucoap_request_descriptor reqd; /* must be the first member */
+
+    struct ucoap_cache * cache;
+    const ucoap_request_descriptor * user;
+    uint32_t sent_at;
+
+    uint8_t key_len;               /* 0 - not cacheable */
+    uint8_t key[UCOAP_CACHE_KEY_SIZE];
+
+    uint8_t etag_len;              /* of the stale entry being revalidated */
+    uint8_t etag[8];
+    ucoap_option_data options[UCOAP_CACHE_MAX_OPTIONS + 1];
+
+};
+
+
+/**
+ * @brief Forget all kept responses and reset the counters
+ *
+ * @param cache - the cache
+ *
+ */
+void
+ucoap_cache_init(struct ucoap_cache * const cache);
+
+
+/**
+ * @brief Submit the request through the cache (asynchronous mode). A fresh
+ *        response to the same GET is passed to the callback before return,
+ *        with the payload, ETag and Content-Format it was kept with. A
+ *        stale one with ETag is revalidated: the request is sent with the
+ *        ETag and 2.03 Valid is passed to the callback as the kept response
+ *        (2.05). A 2.03 whose ETag does not match the kept response is a
+ *        cache miss: the entry is dropped and the 2.03 is passed as is, so
+ *        the request has to be repeated. Otherwise the request is submitted
+ *        as is and a 2.05 response is kept if it fits. Other methods are
+ *        not cached.
+ *
+ * @param cache - the cache
+ * @param creq - storage of the request, has to live until the callback
+ * @param handle - coap handle
+ * @param reqd - descriptor of the request, kept by pointer in 'creq', so
+ *        it has to live until the callback as well
+ * @param now - current time, ms
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_cache_submit(struct ucoap_cache * const cache,
+        struct ucoap_cache_request * const creq,
+        struct ucoap_handle * const handle,
+        const ucoap_request_descriptor * const reqd,
+        const uint32_t now);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* _UCOAP_UCOAP_CACHE_H_ */
@@ -0,0 +1,560 @@
+/**
+ * ucoap_client.hpp
+ *
+ * C++20 coroutines over the asynchronous mode (header only). A request is
+ * awaited where it is made and the coroutine resumes with the response:
+ *
+ *     ucoap::task
+ *     poll_sensor(ucoap::client & client) {
+ *         ucoap::response resp = co_await client.get("/sensors/temp");
+ *
+ *         if (resp.ok()) {
+ *             // resp.payload()
+ *         }
+ *     }
+ *
+ * The frames of suspended coroutines are the only state of requests, no
+ * thread or stack per request. Requests over UCOAP_MAX_TRANSACTIONS wait
+ * in the queue of the client in order of awaiting. Coroutines are resumed
+ * from 'ucoap::client::process', never from the callbacks of the library,
+ * so a resumed coroutine may await the next request right away.
+ *
+ */
+
+
+#ifndef _UCOAP_UCOAP_CLIENT_HPP_
+#define _UCOAP_UCOAP_CLIENT_HPP_
+
+
+#include <algorithm>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ucoap.h"
+#include "ucoap_helpers.h"
+
+
+#ifndef UCOAP_CLIENT_TKL
+#define UCOAP_CLIENT_TKL                4         /* token length of requests */
+#endif /* UCOAP_CLIENT_TKL */
+
+
+namespace ucoap {
+
+
+class client;
+class exchange;
+
+
+/**
+ * @brief Coroutine started at once and detached: its frame is freed when
+ *        it returns. It must not be destroyed while awaiting a request.
+ *
+ */
+struct task {
+
+    struct promise_type {
+
+        task
+        get_return_object() noexcept {
+            return {};
+        }
+
+        std::suspend_never
+        initial_suspend() noexcept {
+            return {};
+        }
+
+        std::suspend_never
+        final_suspend() noexcept {
+            return {};
+        }
+
+        void
+        return_void() noexcept {}
+
+        void
+        unhandled_exception() noexcept {
+            std::terminate();
+        }
+
+    };
+
+};
+
+
+/**
+ * @brief Response to an awaited request, or the reason of failure in
+ *        'error'. The payload and the options are owned by the object,
+ *        which can be moved but not copied.
+ *
+ */
+class response {
+
+public:
+
+    response() = default;
+    response(const response &) = delete;
+    response & operator=(const response &) = delete;
+    response(response &&) noexcept = default;
+    response & operator=(response &&) noexcept = default;
+
+    /* UCOAP_OK if the response has come */
+    enum ucoap_error
+    error() const {
+        return err_;
+    }
+
+    /* response code, e.g. UCOAP_RESP_SUCCESS_CONTENT_205 */
+    std::uint8_t
+    code() const {
+        return code_;
+    }
+
+    /* the response has come with 2.xx code */
+    bool
+    ok() const {
+        return err_ == UCOAP_OK && (code_ >> 5) == 2;
+    }
+
+    std::span<const std::uint8_t>
+    payload() const {
+        return payload_;
+    }
+
+    /* the first option with the number, see 'ucoap_find_option' */
+    bool
+    find_option(const std::uint16_t num, ucoap_option_data & option) const {
+        ucoap_data options = {
+            const_cast<std::uint8_t *>(options_.data()),
+            static_cast<std::uint32_t>(options_.size())
+        };
+
+        return ucoap_find_option(&options, num, &option);
+    }
+
+private:
+
+    friend class exchange;
+    friend class client;
+
+    enum ucoap_error err_ = UCOAP_OK;
+    std::uint8_t code_ = 0;
+    std::vector<std::uint8_t> payload_;
+    std::vector<std::uint8_t> options_;    /* encoded */
+
+};
+
+
+namespace detail {
+
+
+/* what the callback of the library gets, it leads to the exchange */
+struct exchange_node {
+
+    ucoap_request_descriptor reqd;     /* must be the first member */
+    exchange * owner;
+
+};
+
+
+} /* namespace detail */
+
+
+/**
+ * @brief One request awaited by a coroutine, made by 'ucoap::client'. It
+ *        lives in the frame of the coroutine until the response.
+ *
+ */
+class exchange {
+
+public:
+
+    exchange(const exchange &) = delete;
+    exchange & operator=(const exchange &) = delete;
+
+    bool
+    await_ready() const noexcept {
+        return resp_.err_ != UCOAP_OK;
+    }
+
+    bool
+    await_suspend(std::coroutine_handle<> waiter) noexcept;
+
+    response
+    await_resume() noexcept {
+        return std::move(resp_);
+    }
+
+private:
+
+    friend class client;
+
+    exchange(client & owner, const std::uint8_t code, const std::string_view uri,
+            const std::span<const std::uint8_t> payload, const int content_format);
+
+    bool
+    split_uri(const std::string_view uri, const int content_format);
+
+    bool
+    add_components(const std::uint16_t num, const std::string_view str, const char sep);
+
+    bool
+    add_option(const std::uint16_t num, const std::string_view encoded);
+
+    static int
+    hex_digit(const char c);
+
+    static void
+    response_callback(const ucoap_request_descriptor * const reqd,
+            const ucoap_result_data * const result);
+
+    detail::exchange_node node_;
+    client & client_;
+    std::coroutine_handle<> waiter_;
+    exchange * next_ = nullptr;        /* in a queue of the client */
+    response resp_;
+
+    std::string values_;               /* of the options, never reallocated */
+    std::vector<ucoap_option_data> options_;
+    std::vector<std::uint8_t> payload_;
+
+};
+
+
+/**
+ * @brief Requests of coroutines over one handle in the asynchronous mode.
+ *        The event loop calls 'process' after received packets and when
+ *        the time of 'next_deadline' has come, as for 'ucoap_process'.
+ *
+ */
+class client {
+
+public:
+
+    explicit
+    client(struct ucoap_handle & handle) : handle_(handle) {}
+
+    client(const client &) = delete;
+    client & operator=(const client &) = delete;
+
+    exchange
+    get(const std::string_view uri) {
+        return exchange(*this, UCOAP_REQ_GET, uri, {}, -1);
+    }
+
+    exchange
+    post(const std::string_view uri, const std::span<const std::uint8_t> payload,
+            const int content_format = -1) {
+        return exchange(*this, UCOAP_REQ_POST, uri, payload, content_format);
+    }
+
+    exchange
+    put(const std::string_view uri, const std::span<const std::uint8_t> payload,
+            const int content_format = -1) {
+        return exchange(*this, UCOAP_REQ_PUT, uri, payload, content_format);
+    }
+
+    exchange
+    del(const std::string_view uri) {
+        return exchange(*this, UCOAP_REQ_DEL, uri, {}, -1);
+    }
+
+    /**
+     * @brief Handle received packets and timers, submit the queued requests
+     *        and resume the coroutines whose requests have ended
+     *
+     * @param now - current time, ms
+     *
+     */
+    void
+    process(const std::uint32_t now) {
+        exchange * ready;
+
+        now_ = now;
+        ucoap_process(&handle_, now);
+        submit_queued();
+
+        /* a resumed coroutine may free transactions for the queued ones */
+        while ((ready = ready_) != nullptr) {
+            ready_ = nullptr;
+            ready_tail_ = &ready_;
+
+            while (ready != nullptr) {
+                exchange * const next = ready->next_;
+
+                ready->waiter_.resume();
+                ready = next;
+            }
+
+            submit_queued();
+        }
+    }
+
+    /**
+     * @brief Get the time when 'process' has to be called next time
+     *
+     * @param deadline - the time, ms
+     *
+     * @return false if there is nothing to wait for
+     */
+    bool
+    next_deadline(std::uint32_t & deadline) const {
+        if (ready_ != nullptr) {
+            deadline = now_;
+            return true;
+        }
+
+        return ucoap_next_deadline(&handle_, &deadline);
+    }
+
+    /* requests waiting for a free transaction of the handle */
+    std::uint32_t
+    queued() const {
+        return queued_count_;
+    }
+
+private:
+
+    friend class exchange;
+
+    /* false if it has failed at once */
+    bool
+    submit(exchange & ex) {
+        enum ucoap_error err;
+
+        /* nobody overtakes the queued requests */
+        if (queued_ == nullptr) {
+            err = ucoap_submit_coap_request(&handle_, &ex.node_.reqd, now_);
+
+            if (err != UCOAP_BUSY_ERROR) {
+                ex.resp_.err_ = err;
+                return err == UCOAP_OK;
+            }
+        }
+
+        ex.next_ = nullptr;
+        *queued_tail_ = &ex;
+        queued_tail_ = &ex.next_;
+        queued_count_++;
+
+        return true;
+    }
+
+    void
+    submit_queued() {
+        enum ucoap_error err;
+        exchange * ex;
+
+        while ((ex = queued_) != nullptr) {
+            err = ucoap_submit_coap_request(&handle_, &ex->node_.reqd, now_);
+
+            if (err == UCOAP_BUSY_ERROR) {
+                break;
+            }
+
+            queued_ = ex->next_;
+            queued_count_--;
+
+            if (queued_ == nullptr) {
+                queued_tail_ = &queued_;
+            }
+
+            if (err != UCOAP_OK) {
+                complete(*ex, err);
+            }
+        }
+    }
+
+    void
+    complete(exchange & ex, const enum ucoap_error err) {
+        ex.resp_.err_ = err;
+        ex.next_ = nullptr;
+        *ready_tail_ = &ex;
+        ready_tail_ = &ex.next_;
+    }
+
+    struct ucoap_handle & handle_;
+    std::uint32_t now_ = 0;
+
+    exchange * queued_ = nullptr;
+    exchange ** queued_tail_ = &queued_;
+    std::uint32_t queued_count_ = 0;
+
+    exchange * ready_ = nullptr;
+    exchange ** ready_tail_ = &ready_;
+
+};
+
+
+inline
+exchange::exchange(client & owner, const std::uint8_t code, const std::string_view uri,
+        const std::span<const std::uint8_t> payload, const int content_format)
+        : client_(owner), payload_(payload.begin(), payload.end()) {
+    node_.reqd = {};
+    node_.reqd.type = UCOAP_MESSAGE_CON;
+    node_.reqd.code = code;
+    node_.reqd.tkl = UCOAP_CLIENT_TKL;
+    node_.reqd.payload.buf = payload_.data();
+    node_.reqd.payload.len = static_cast<std::uint32_t>(payload_.size());
+    node_.reqd.response_callback = response_callback;
+    node_.owner = this;
+
+    if (!split_uri(uri, content_format)) {
+        resp_.err_ = UCOAP_PARAM_ERROR;
+    }
+}
+
+
+inline bool
+exchange::await_suspend(std::coroutine_handle<> waiter) noexcept {
+    waiter_ = waiter;
+
+    return client_.submit(*this);
+}
+
+
+/* Uri-Path, Content-Format and Uri-Query options, RFC 7252, 6.4 */
+inline bool
+exchange::split_uri(const std::string_view uri, const int content_format) {
+    std::size_t query;
+
+    if (uri.empty() || uri[0] != '/' || uri.find('#') != std::string_view::npos) {
+        return false;
+    }
+
+    query = std::min(uri.find('?'), uri.size());
+
+    /* decoded values are not longer, the options point into it */
+    values_.reserve(uri.size() + 2);
+
+    /* the path "/" has no Uri-Path options */
+    if (query > 1 && !add_components(UCOAP_URI_PATH_OPT, uri.substr(1, query - 1), '/')) {
+        return false;
+    }
+
+    if (content_format > 0xFFFF) {
+        return false;
+    }
+
+    if (content_format >= 0) {
+        options_.push_back({ UCOAP_CONTENT_FORMAT_OPT, 0,
+                reinterpret_cast<std::uint8_t *>(values_.data()) + values_.size(), nullptr });
+
+        if (content_format > 0xFF) {
+            values_ += static_cast<char>(content_format >> 8);
+            options_.back().len++;
+        }
+
+        if (content_format > 0) {
+            values_ += static_cast<char>(content_format);
+            options_.back().len++;
+        }
+    }
+
+    if (query < uri.size() && !add_components(UCOAP_URI_QUERY_OPT, uri.substr(query + 1), '&')) {
+        return false;
+    }
+
+    for (std::size_t i = 0; i + 1 < options_.size(); i++) {
+        options_[i].next = &options_[i + 1];
+    }
+
+    node_.reqd.options = options_.empty() ? nullptr : options_.data();
+
+    return true;
+}
+
+
+/* every part of 'str' between the separators is an option */
+inline bool
+exchange::add_components(const std::uint16_t num, const std::string_view str, const char sep) {
+    std::size_t end;
+
+    for (std::size_t begin = 0;; begin = end + 1) {
+        end = std::min(str.find(sep, begin), str.size());
+
+        if (!add_option(num, str.substr(begin, end - begin))) {
+            return false;
+        }
+
+        if (end == str.size()) {
+            return true;
+        }
+    }
+}
+
+
+/* percent-decode the value into 'values_' */
+inline bool
+exchange::add_option(const std::uint16_t num, const std::string_view encoded) {
+    const std::size_t begin = values_.size();
+
+    for (std::size_t i = 0; i < encoded.size(); i++) {
+        if (encoded[i] != '%') {
+            values_ += encoded[i];
+            continue;
+        }
+
+        if (encoded.size() - i < 3 || hex_digit(encoded[i + 1]) < 0 || hex_digit(encoded[i + 2]) < 0) {
+            return false;
+        }
+
+        values_ += static_cast<char>(hex_digit(encoded[i + 1]) << 4 | hex_digit(encoded[i + 2]));
+        i += 2;
+    }
+
+    if (values_.size() - begin > 255) {
+        return false;
+    }
+
+    options_.push_back({ num, static_cast<std::uint16_t>(values_.size() - begin),
+            reinterpret_cast<std::uint8_t *>(values_.data()) + begin, nullptr });
+
+    return true;
+}
+
+
+inline int
+exchange::hex_digit(const char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+
+    return -1;
+}
+
+
+inline void
+exchange::response_callback(const ucoap_request_descriptor * const reqd,
+        const ucoap_result_data * const result) {
+    exchange * const ex = reinterpret_cast<const detail::exchange_node *>(reqd)->owner;
+
+    /* the result lives until the callback returns */
+    if (result->err == UCOAP_OK) {
+        ex->resp_.code_ = result->resp_code;
+        ex->resp_.payload_.assign(result->payload.buf, result->payload.buf + result->payload.len);
+        ex->resp_.options_.assign(result->options.buf, result->options.buf + result->options.len);
+    }
+
+    ex->client_.complete(*ex, result->err);
+}
+
+
+} /* namespace ucoap */
+
+
+#endif /* _UCOAP_UCOAP_CLIENT_HPP_ */
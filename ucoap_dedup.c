@@ -0,0 +1,251 @@
+/**
+ * ucoap_dedup.c
+ *
+ */
+
+
+#include "ucoap_dedup.h"
+#include "ucoap_utils.h"
+
+
+#define UCOAP_DEDUP_SLOTS_MASK       (UCOAP_DEDUP_SLOTS - 1)
+
+
+static uint32_t
+hash_request(const struct ucoap_endpoint * const endpoint, const uint16_t mid);
+static uint32_t
+find_slot(const struct ucoap_dedup * const dedup, const uint32_t hash,
+        const struct ucoap_endpoint * const endpoint, const uint16_t mid);
+static void
+remove_oldest(struct ucoap_dedup * const dedup);
+static void
+expire_entries(struct ucoap_dedup * const dedup, const uint32_t now);
+
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_dedup_init(struct ucoap_dedup * const dedup,
+        const struct ucoap_config * const config) {
+    uint32_t i;
+    uint32_t max_transmit_span;
+
+    /* ACK_TIMEOUT * (2 ** MAX_RETRANSMIT - 1) * ACK_RANDOM_FACTOR */
+    max_transmit_span = (config->ack_timeout_ms * ((1u << config->max_retransmit) - 1)
+            / 100) * UCOAP_ACK_RANDOM_FACTOR;
+
+    /* MAX_TRANSMIT_SPAN + 2 * MAX_LATENCY + PROCESSING_DELAY (ACK_TIMEOUT) */
+    dedup->lifetime = max_transmit_span + 2 * UCOAP_MAX_LATENCY_MS + config->ack_timeout_ms;
+
+    dedup->duplicates = 0;
+    dedup->evicted = 0;
+    dedup->head = 0;
+    dedup->count = 0;
+
+    for (i = 0; i < UCOAP_DEDUP_SLOTS; i++) {
+        dedup->slots[i] = 0;
+    }
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+const struct ucoap_dedup_entry *
+ucoap_dedup_find(struct ucoap_dedup * const dedup,
+        const struct ucoap_endpoint * const endpoint,
+        const uint16_t mid, const uint32_t now) {
+    uint32_t slot;
+
+    expire_entries(dedup, now);
+
+    slot = find_slot(dedup, hash_request(endpoint, mid), endpoint, mid);
+
+    /* without the response the handler has to answer the duplicate */
+    if (dedup->slots[slot] == 0 || dedup->entries[dedup->slots[slot] - 1].response_len == 0) {
+        return NULL;
+    }
+
+    dedup->duplicates++;
+
+    return &dedup->entries[dedup->slots[slot] - 1];
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_dedup_add(struct ucoap_dedup * const dedup,
+        const struct ucoap_endpoint * const endpoint,
+        const uint16_t mid, const uint8_t * response, const uint32_t len,
+        const uint32_t now) {
+    uint32_t slot;
+    uint32_t hash;
+    struct ucoap_dedup_entry * entry;
+
+    expire_entries(dedup, now);
+
+    hash = hash_request(endpoint, mid);
+    slot = find_slot(dedup, hash, endpoint, mid);
+
+    /* it is there already, the handler has answered a duplicate again */
+    if (dedup->slots[slot] != 0) {
+        return;
+    }
+
+    /* the slots move on removal, the free one is looked up again */
+    if (dedup->count == UCOAP_DEDUP_ENTRIES) {
+        remove_oldest(dedup);
+        dedup->evicted++;
+        slot = find_slot(dedup, hash, endpoint, mid);
+    }
+
+    entry = &dedup->entries[dedup->head];
+
+    entry->hash = hash;
+    entry->expires = now + dedup->lifetime;
+    entry->endpoint.len = endpoint->len;
+    mem_copy(entry->endpoint.addr, endpoint->addr, endpoint->len);
+    entry->mid = mid;
+    entry->response_len = 0;
+
+    if (len <= UCOAP_DEDUP_RESPONSE_SIZE) {
+        mem_copy(entry->response, response, len);
+        entry->response_len = len;
+    }
+
+    dedup->slots[slot] = dedup->head + 1;
+    dedup->head = (dedup->head + 1) & (UCOAP_DEDUP_ENTRIES - 1);
+    dedup->count++;
+}
+
+
+/**
+ * @brief FNV-1a of the endpoint and Message ID
+ *
+ * @param endpoint - the peer
+ * @param mid - Message ID
+ *
+ * @return the hash
+ */
+static uint32_t
+hash_request(const struct ucoap_endpoint * const endpoint, const uint16_t mid) {
+    uint32_t i;
+    uint32_t hash;
+
+    hash = 2166136261u;
+
+    for (i = 0; i < endpoint->len; i++) {
+        hash = (hash ^ endpoint->addr[i]) * 16777619u;
+    }
+
+    hash = (hash ^ (mid >> 8)) * 16777619u;
+    hash = (hash ^ (mid & 0xFF)) * 16777619u;
+
+    return hash;
+}
+
+
+/**
+ * @brief Probe the hash table linearly for the request
+ *
+ * @param dedup - the store
+ * @param hash - hash of the request
+ * @param endpoint - the peer
+ * @param mid - Message ID
+ *
+ * @return the slot of the request, or the free slot where it would be
+ */
+static uint32_t
+find_slot(const struct ucoap_dedup * const dedup, const uint32_t hash,
+        const struct ucoap_endpoint * const endpoint, const uint16_t mid) {
+    uint32_t slot;
+    const struct ucoap_dedup_entry * entry;
+
+    for (slot = hash & UCOAP_DEDUP_SLOTS_MASK; dedup->slots[slot] != 0;
+            slot = (slot + 1) & UCOAP_DEDUP_SLOTS_MASK) {
+        entry = &dedup->entries[dedup->slots[slot] - 1];
+
+        if (entry->hash == hash && entry->mid == mid
+                && entry->endpoint.len == endpoint->len
+                && mem_cmp(entry->endpoint.addr, endpoint->addr, endpoint->len)) {
+            break;
+        }
+    }
+
+    return slot;
+}
+
+
+/**
+ * @brief Drop the oldest entry of the ring. Its slot is freed by shifting
+ *        back the entries of the same probe run, so there are no tombstones.
+ *
+ * @param dedup - the store
+ *
+ */
+static void
+remove_oldest(struct ucoap_dedup * const dedup) {
+    uint32_t idx;
+    uint32_t slot;
+    uint32_t next;
+    uint32_t home;
+
+    idx = (dedup->head - dedup->count) & (UCOAP_DEDUP_ENTRIES - 1);
+
+    for (slot = dedup->entries[idx].hash & UCOAP_DEDUP_SLOTS_MASK;
+            dedup->slots[slot] != idx + 1;
+            slot = (slot + 1) & UCOAP_DEDUP_SLOTS_MASK) {
+    }
+
+    dedup->count--;
+
+    for (next = slot;;) {
+        dedup->slots[slot] = 0;
+
+        do {
+            next = (next + 1) & UCOAP_DEDUP_SLOTS_MASK;
+
+            if (dedup->slots[next] == 0) {
+                return;
+            }
+
+            home = dedup->entries[dedup->slots[next] - 1].hash & UCOAP_DEDUP_SLOTS_MASK;
+
+            /* stays if its home is between the freed slot and it */
+        } while (((next - home) & UCOAP_DEDUP_SLOTS_MASK) < ((next - slot) & UCOAP_DEDUP_SLOTS_MASK));
+
+        dedup->slots[slot] = dedup->slots[next];
+        slot = next;
+    }
+}
+
+
+/**
+ * @brief Drop the entries which have outlived EXCHANGE_LIFETIME, they are
+ *        at the tail of the ring
+ *
+ * @param dedup - the store
+ * @param now - current time, ms
+ *
+ */
+static void
+expire_entries(struct ucoap_dedup * const dedup, const uint32_t now) {
+    const struct ucoap_dedup_entry * oldest;
+
+    while (dedup->count) {
+        oldest = &dedup->entries[(dedup->head - dedup->count) & (UCOAP_DEDUP_ENTRIES - 1)];
+
+        if ((int32_t)(now - oldest->expires) < 0) {
+            break;
+        }
+
+        remove_oldest(dedup);
+    }
+}
@@ -0,0 +1,136 @@
+/**
+ * ucoap_dedup.h
+ *
+ * Message deduplication of the server (RFC 7252, section 4.5). Every
+ * confirmable request is remembered by its endpoint and Message ID for
+ * EXCHANGE_LIFETIME together with the response sent to it, so a
+ * retransmission gets the same response and the handler is not called
+ * again. A response too large to keep is not replayed, the handler
+ * serves the retransmission once more instead. Entries live in a ring
+ * in the order they were added, which is also the order they expire in;
+ * an open-addressing hash table over the ring finds them in constant
+ * time.
+ *
+ */
+
+
+#ifndef _UCOAP_UCOAP_DEDUP_H_
+#define _UCOAP_UCOAP_DEDUP_H_
+
+
+#include "ucoap_server.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#ifndef UCOAP_DEDUP_ENTRIES
+#define UCOAP_DEDUP_ENTRIES             64        /* requests per EXCHANGE_LIFETIME, power of 2 */
+#endif /* UCOAP_DEDUP_ENTRIES */
+
+#ifndef UCOAP_DEDUP_RESPONSE_SIZE
+#define UCOAP_DEDUP_RESPONSE_SIZE       32        /* larger responses are made again by the handler */
+#endif /* UCOAP_DEDUP_RESPONSE_SIZE */
+
+#if UCOAP_DEDUP_ENTRIES & (UCOAP_DEDUP_ENTRIES - 1)
+#error "UCOAP_DEDUP_ENTRIES has to be a power of 2"
+#endif
+
+/* the hash table is kept at most half full */
+#define UCOAP_DEDUP_SLOTS               (2 * UCOAP_DEDUP_ENTRIES)
+
+#define UCOAP_MAX_LATENCY_MS            100000    /* RFC 7252, 4.8.2 */
+
+
+/**
+ * @brief A remembered request. Internal, do not use it directly.
+ */
+struct ucoap_dedup_entry {
+
+    uint32_t hash;
+    uint32_t expires;              /* ms */
+
+    struct ucoap_endpoint endpoint;
+    uint16_t mid;
+
+    uint16_t response_len;         /* 0 - the response did not fit, not replayed */
+    uint8_t response[UCOAP_DEDUP_RESPONSE_SIZE];
+
+};
+
+
+struct ucoap_dedup {
+
+    uint32_t lifetime;             /* EXCHANGE_LIFETIME, ms */
+
+    /* counters, may be reset by user */
+    uint32_t duplicates;           /* retransmissions not passed to the handler */
+    uint32_t evicted;              /* entries dropped before expiry, the ring is too small */
+
+    uint32_t head;                 /* the next entry of the ring */
+    uint32_t count;                /* entries in the ring */
+
+    uint32_t slots[UCOAP_DEDUP_SLOTS];     /* index of the entry + 1, 0 - free */
+    struct ucoap_dedup_entry entries[UCOAP_DEDUP_ENTRIES];
+
+};
+
+
+/**
+ * @brief Forget all requests and reset the counters. EXCHANGE_LIFETIME is
+ *        derived from the transmission parameters of the configuration.
+ *
+ * @param dedup - the store
+ * @param config - configuration of the handle of the server
+ *
+ */
+void
+ucoap_dedup_init(struct ucoap_dedup * const dedup,
+        const struct ucoap_config * const config);
+
+
+/**
+ * @brief Find the request by its endpoint and Message ID to replay its
+ *        response. Expired entries are dropped first.
+ *
+ * @param dedup - the store
+ * @param endpoint - the peer which has sent the request
+ * @param mid - Message ID of the request
+ * @param now - current time, ms
+ *
+ * @return the entry or NULL if the request is new or its response has
+ *         not been kept
+ */
+const struct ucoap_dedup_entry *
+ucoap_dedup_find(struct ucoap_dedup * const dedup,
+        const struct ucoap_endpoint * const endpoint,
+        const uint16_t mid, const uint32_t now);
+
+
+/**
+ * @brief Remember the request with the response to it. The oldest entry
+ *        is dropped if the ring is full.
+ *
+ * @param dedup - the store
+ * @param endpoint - the peer which has sent the request
+ * @param mid - Message ID of the request
+ * @param response - the response as it is sent
+ * @param len - length of the response
+ * @param now - current time, ms
+ *
+ */
+void
+ucoap_dedup_add(struct ucoap_dedup * const dedup,
+        const struct ucoap_endpoint * const endpoint,
+        const uint16_t mid, const uint8_t * response, const uint32_t len,
+        const uint32_t now);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* _UCOAP_UCOAP_DEDUP_H_ */
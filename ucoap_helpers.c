@@ -8,6 +8,11 @@
 
 
 #include "ucoap_helpers.h"
+#include "ucoap_utils.h"
+
+
+static void fill_block_opt(ucoap_option_data * const option, const uint16_t opt_num, const ucoap_blockwise_data * const bw, uint8_t * const value);
+static void extract_block_from_opt(const ucoap_option_data * const block, ucoap_blockwise_data * const bw);
 
 
 /**
@@ -50,6 +55,51 @@ uint16_t ucoap_decode_szx_to_size(const uint8_t szx)
  *
  */
 void ucoap_fill_block2_opt(ucoap_option_data * const option, const ucoap_blockwise_data * const bw, uint8_t * const value)
+{
+    fill_block_opt(option, UCOAP_BLOCK2_OPT, bw, value);
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void ucoap_extract_block2_from_opt(const ucoap_option_data * const block2, ucoap_blockwise_data * const bw)
+{
+    extract_block_from_opt(block2, bw);
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void ucoap_fill_block1_opt(ucoap_option_data * const option, const ucoap_blockwise_data * const bw, uint8_t * const value)
+{
+    fill_block_opt(option, UCOAP_BLOCK1_OPT, bw, value);
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void ucoap_extract_block1_from_opt(const ucoap_option_data * const block1, ucoap_blockwise_data * const bw)
+{
+    extract_block_from_opt(block1, bw);
+}
+
+
+/**
+ * @brief Fill block option, the value is the same for Block1 and Block2
+ *
+ * @param option - pointer on the 'ucoap_option_data' struct
+ * @param opt_num - number of the option
+ * @param bw - pointer on the block data
+ * @param value - buffer for storing encoded value (max length is 3)
+ *
+ */
+static void fill_block_opt(ucoap_option_data * const option, const uint16_t opt_num, const ucoap_blockwise_data * const bw, uint8_t * const value)
 {
 /*
  * Block Option Value
@@ -74,7 +124,7 @@ void ucoap_fill_block2_opt(ucoap_option_data * const option, const ucoap_blockwi
  *
  */
 
-    option->num = UCOAP_BLOCK2_OPT;
+    option->num = opt_num;
     option->value = value;
     option->len = 1;
     option->next = NULL;
@@ -90,7 +140,7 @@ void ucoap_fill_block2_opt(ucoap_option_data * const option, const ucoap_blockwi
         value[1] = value[0];
 
         value[0] = (bw->arr[0] >> 4);
-        value[0] |= (bw->arr[1] & 0x0F);
+        value[0] |= (bw->arr[1] << 4);
     }
 
     if (bw->fld.num > 4095) {
@@ -100,43 +150,46 @@ void ucoap_fill_block2_opt(ucoap_option_data * const option, const ucoap_blockwi
         value[1] = value[0];
 
         value[0] = (bw->arr[1] >> 4);
-        value[0] |= (bw->arr[2] & 0x0F);
+        value[0] |= (bw->arr[2] << 4);
     }
 }
 
 
 /**
- * @brief See description in the header file.
+ * @brief Extract block value from Block1 or Block2 option
+ *
+ * @param block - raw option contains block value
+ * @param bw - pointer on the block data to store value
  *
  */
-void ucoap_extract_block2_from_opt(const ucoap_option_data * const block2, ucoap_blockwise_data * const bw)
+static void extract_block_from_opt(const ucoap_option_data * const block, ucoap_blockwise_data * const bw)
 {
     bw->fld.num = 0;
     bw->fld.block_szx = 0;
     bw->fld.more = 0;
 
-    switch (block2->len) {
+    switch (block->len) {
         case 0:
             break;
 
         case 1:
-            bw->fld.num = (block2->value[0] >> 4);
-            bw->arr[3] = (block2->value[0] & 0x0F);
+            bw->fld.num = (block->value[0] >> 4);
+            bw->arr[3] = (block->value[0] & 0x0F);
             break;
 
         case 2:
-            bw->arr[1] = (block2->value[0] >> 4);
-            bw->arr[0] = (block2->value[0] << 4) | (block2->value[1] >> 4);
+            bw->arr[1] = (block->value[0] >> 4);
+            bw->arr[0] = (block->value[0] << 4) | (block->value[1] >> 4);
 
-            bw->arr[3] = (block2->value[1] & 0x0F);
+            bw->arr[3] = (block->value[1] & 0x0F);
             break;
 
         case 3:
-            bw->arr[2] = (block2->value[0] >> 4);
-            bw->arr[1] = (block2->value[0] << 4) | (block2->value[1] >> 4);
-            bw->arr[0] = (block2->value[1] << 4) | (block2->value[2] >> 4);
+            bw->arr[2] = (block->value[0] >> 4);
+            bw->arr[1] = (block->value[0] << 4) | (block->value[1] >> 4);
+            bw->arr[0] = (block->value[1] << 4) | (block->value[2] >> 4);
 
-            bw->arr[3] = (block2->value[2] & 0x0F);
+            bw->arr[3] = (block->value[2] & 0x0F);
             break;
 
         default:
@@ -169,3 +222,81 @@ const ucoap_option_data * ucoap_find_option_by_number(const ucoap_option_data *
 }
 
 
+/**
+ * @brief See description in the header file.
+ *
+ */
+void ucoap_option_iterator_init(ucoap_option_iterator * const it, const ucoap_data * const options)
+{
+    it->buf = options->buf;
+    it->len = options->len;
+    it->idx = 0;
+    it->num = 0;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+bool ucoap_option_next(ucoap_option_iterator * const it, ucoap_option_data * const option)
+{
+    uint32_t value_len;
+
+    if (!next_option(it->buf, it->len, &it->idx, &it->num, &value_len)) {
+        return false;
+    }
+
+    option->num = it->num;
+    option->len = value_len;
+    option->value = (uint8_t *)it->buf + it->idx;
+    option->next = NULL;
+
+    it->idx += value_len;
+
+    return true;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+bool ucoap_option_seek(ucoap_option_iterator * const it, const uint16_t opt_num, ucoap_option_data * const option)
+{
+    uint32_t idx;
+    uint16_t num;
+
+    do {
+        idx = it->idx;
+        num = it->num;
+
+        if (!ucoap_option_next(it, option)) {
+            return false;
+        }
+
+    } while (option->num < opt_num);
+
+    if (option->num > opt_num) {
+        /* step back, the option may be asked for next */
+        it->idx = idx;
+        it->num = num;
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+bool ucoap_find_option(const ucoap_data * const options, const uint16_t opt_num, ucoap_option_data * const option)
+{
+    ucoap_option_iterator it;
+
+    ucoap_option_iterator_init(&it, options);
+
+    return ucoap_option_seek(&it, opt_num, option);
+}
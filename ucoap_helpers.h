@@ -15,6 +15,11 @@
 #include "ucoap.h"
 
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
 typedef enum {
 
     UCOAP_BLOCK_SZX_VAL_0       = 16,
@@ -48,6 +53,20 @@ typedef union ucoap_blockwise_data {
 } ucoap_blockwise_data;
 
 
+/**
+ * Walks the encoded options of a response ('options' of 'ucoap_result_data')
+ * in place: an option is decoded when it is asked for, nothing is copied.
+ */
+typedef struct ucoap_option_iterator {
+
+    const uint8_t * buf;
+    uint32_t len;
+    uint32_t idx;                  /* the next option */
+    uint16_t num;                  /* number of the previous option */
+
+} ucoap_option_iterator;
+
+
 /**
  * @brief Get block size by SZX value
  *
@@ -78,6 +97,27 @@ void ucoap_fill_block2_opt(ucoap_option_data * const option, const ucoap_blockwi
 void ucoap_extract_block2_from_opt(const ucoap_option_data * const block2, ucoap_blockwise_data * const bw);
 
 
+/**
+ * @brief Fill block1 option
+ *
+ * @param option - pointer on the 'ucoap_option_data' struct
+ * @param bw - pointer on the block1 data
+ * @param value - buffer for storing encoded value (max length is 3)
+ *
+ */
+void ucoap_fill_block1_opt(ucoap_option_data * const option, const ucoap_blockwise_data * const bw, uint8_t * const value);
+
+
+/**
+ * @brief Extract block1 value from option
+ *
+ * @param block1 - raw option contains block1
+ * @param bw - pointer on the block1 data to store value
+ *
+ */
+void ucoap_extract_block1_from_opt(const ucoap_option_data * const block1, ucoap_blockwise_data * const bw);
+
+
 /**
  * @brief Find an option by its number
  *
@@ -89,4 +129,57 @@ void ucoap_extract_block2_from_opt(const ucoap_option_data * const block2, ucoap
 const ucoap_option_data * ucoap_find_option_by_number(const ucoap_option_data * options, const uint16_t opt_num);
 
 
+/**
+ * @brief Start walking the encoded options
+ *
+ * @param it - the iterator
+ * @param options - encoded options, e.g. 'options' of 'ucoap_result_data'
+ *
+ */
+void ucoap_option_iterator_init(ucoap_option_iterator * const it, const ucoap_data * const options);
+
+
+/**
+ * @brief Get the next option. Its value points into the encoded options,
+ *        'next' is NULL.
+ *
+ * @param it - the iterator
+ * @param option - pointer on the option to fill
+ *
+ * @return false if there are no more options
+ */
+bool ucoap_option_next(ucoap_option_iterator * const it, ucoap_option_data * const option);
+
+
+/**
+ * @brief Skip to the next option with the number. The options are in
+ *        ascending order, so the walk stops before the first larger one;
+ *        call it again to get a repeated option.
+ *
+ * @param it - the iterator
+ * @param opt_num - number of option
+ * @param option - pointer on the option to fill
+ *
+ * @return false if there is no such option ahead
+ */
+bool ucoap_option_seek(ucoap_option_iterator * const it, const uint16_t opt_num, ucoap_option_data * const option);
+
+
+/**
+ * @brief Find the first option with the number among the encoded options
+ *
+ * @param options - encoded options, e.g. 'options' of 'ucoap_result_data'
+ * @param opt_num - number of option
+ * @param option - pointer on the option to fill
+ *
+ * @return false if option is absent
+ */
+bool ucoap_find_option(const ucoap_data * const options, const uint16_t opt_num, ucoap_option_data * const option);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
 #endif /* _UCOAP_UCOAP_HELPERS_H_ */
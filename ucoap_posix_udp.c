@@ -0,0 +1,501 @@
+/**
+ * ucoap_posix_udp.c
+ *
+ */
+
+
+/* 'recvmmsg' and 'sendmmsg' are GNU extensions */
+#ifndef _GNU_SOURCE
+#error "ucoap_posix_udp.c has to be compiled with -D_GNU_SOURCE"
+#endif /* _GNU_SOURCE */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+
+#include "ucoap_posix_udp.h"
+#include "ucoap_utils.h"
+
+
+#define UCOAP_POSIX_UDP(h)           ((struct ucoap_posix_udp *)(h))
+
+
+static void
+prepare_rx_msgs(struct ucoap_posix_udp * const udp,
+        struct mmsghdr * const msgs, struct iovec * const iov);
+static bool
+from_peer(const struct ucoap_posix_udp * const udp,
+        const struct sockaddr_storage * const addr, const socklen_t addr_len);
+
+#ifdef UCOAP_TX_DATAV
+#define UCOAP_POSIX_UDP_MAX_PARTS    4
+
+
+static enum ucoap_error
+queue_parts(struct ucoap_posix_udp * const udp,
+        const ucoap_data * iov, const uint32_t iovcnt);
+#endif /* UCOAP_TX_DATAV */
+
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_posix_udp_open(struct ucoap_posix_udp * const udp,
+        const struct sockaddr * const peer, const socklen_t peer_len) {
+    struct epoll_event ev;
+
+    if (peer_len > sizeof(udp->peer)) {
+        return UCOAP_PARAM_ERROR;
+    }
+
+    memcpy(&udp->peer, peer, peer_len);
+    udp->peer_len = peer_len;
+    udp->tx_count = 0;
+
+    udp->fd = socket(peer->sa_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (udp->fd < 0) {
+        return UCOAP_IO_ERROR;
+    }
+
+    udp->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (udp->epfd < 0) {
+        close(udp->fd);
+        return UCOAP_IO_ERROR;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = udp;
+
+    if (epoll_ctl(udp->epfd, EPOLL_CTL_ADD, udp->fd, &ev) < 0) {
+        ucoap_posix_udp_close(udp);
+        return UCOAP_IO_ERROR;
+    }
+
+    return UCOAP_OK;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_posix_udp_close(struct ucoap_posix_udp * const udp) {
+    if (udp->epfd >= 0) {
+        close(udp->epfd);
+        udp->epfd = -1;
+    }
+
+    if (udp->fd >= 0) {
+        close(udp->fd);
+        udp->fd = -1;
+    }
+
+    udp->tx_count = 0;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_posix_udp_flush(struct ucoap_posix_udp * const udp) {
+    int sent;
+    uint32_t i;
+    uint32_t done;
+    struct iovec iov[UCOAP_POSIX_UDP_BATCH];
+    struct mmsghdr msgs[UCOAP_POSIX_UDP_BATCH];
+
+    for (i = 0; i < udp->tx_count; i++) {
+        iov[i].iov_base = udp->tx_bufs[i];
+        iov[i].iov_len = udp->tx_lens[i];
+
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &udp->peer;
+        msgs[i].msg_hdr.msg_namelen = udp->peer_len;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    done = 0;
+
+    while (done < udp->tx_count) {
+        sent = sendmmsg(udp->fd, msgs + done, udp->tx_count - done,
+                MSG_DONTWAIT);
+
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            /* keep the rest of queue for the next time */
+            if (done) {
+                memmove(udp->tx_lens, udp->tx_lens + done,
+                        (udp->tx_count - done) * sizeof(udp->tx_lens[0]));
+                memmove(udp->tx_bufs, udp->tx_bufs + done,
+                        (udp->tx_count - done) * UCOAP_POSIX_UDP_DGRAM_SIZE);
+                udp->tx_count -= done;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return UCOAP_BUSY_ERROR;
+            }
+
+            return UCOAP_IO_ERROR;
+        }
+
+        done += sent;
+    }
+
+    udp->tx_count = 0;
+    return UCOAP_OK;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+uint32_t
+ucoap_posix_udp_receive(struct ucoap_posix_udp * const udp) {
+    int i;
+    int received;
+    uint32_t now;
+    uint32_t accepted;
+    enum ucoap_error err;
+    struct iovec iov[UCOAP_POSIX_UDP_BATCH];
+    struct mmsghdr msgs[UCOAP_POSIX_UDP_BATCH];
+
+    accepted = 0;
+
+    do {
+        prepare_rx_msgs(udp, msgs, iov);
+
+        received = recvmmsg(udp->fd, msgs, UCOAP_POSIX_UDP_BATCH,
+                MSG_DONTWAIT, NULL);
+        now = ucoap_posix_now();
+
+        for (i = 0; i < received; i++) {
+            /* a truncated datagram or one from a stranger is dropped */
+            if ((msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+                    || !from_peer(udp, &udp->rx_addrs[i], msgs[i].msg_hdr.msg_namelen)) {
+                continue;
+            }
+
+            /* the datagram stays in 'rx_bufs' during the call */
+            if (UCOAP_CHECK_STATUS(&udp->handle, UCOAP_ZERO_COPY_RX)) {
+                err = ucoap_rx_packet_borrowed(&udp->handle, udp->rx_bufs[i],
+                        msgs[i].msg_len, now);
+            } else {
+                err = ucoap_rx_packet(&udp->handle, udp->rx_bufs[i],
+                        msgs[i].msg_len);
+            }
+
+            if (err == UCOAP_OK) {
+                accepted++;
+            }
+
+            /* the next datagram of the batch may belong to the same transaction */
+            if (!UCOAP_CHECK_STATUS(&udp->handle, UCOAP_ZERO_COPY_RX)) {
+                ucoap_process(&udp->handle, now);
+            }
+        }
+
+    } while (received == UCOAP_POSIX_UDP_BATCH
+            || (received < 0 && errno == EINTR));
+
+    return accepted;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_posix_udp_poll(struct ucoap_posix_udp * const udp,
+        const int timeout_ms) {
+    int ready;
+    enum ucoap_error err;
+    struct epoll_event ev;
+
+    err = ucoap_posix_udp_flush(udp);
+
+    if (err != UCOAP_OK && err != UCOAP_BUSY_ERROR) {
+        return err;
+    }
+
+    ready = epoll_wait(udp->epfd, &ev, 1, timeout_ms);
+
+    if (ready < 0) {
+        return errno == EINTR ? UCOAP_OK : UCOAP_IO_ERROR;
+    }
+
+    if (ready) {
+        ucoap_posix_udp_receive(udp);
+    }
+
+    return UCOAP_OK;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+uint32_t
+ucoap_posix_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t)ts.tv_sec * 1000u + (uint32_t)(ts.tv_nsec / 1000000);
+}
+
+
+/**
+ * @brief Implementation of the 'ucoap' hook: the datagram is queued and
+ *        will be sent with others by 'ucoap_posix_udp_flush'.
+ *
+ */
+enum ucoap_error
+ucoap_tx_data(struct ucoap_handle * const handle, const uint8_t * buf,
+        const uint32_t len) {
+    enum ucoap_error err;
+    struct ucoap_posix_udp * const udp = UCOAP_POSIX_UDP(handle);
+
+    if (len > UCOAP_POSIX_UDP_DGRAM_SIZE) {
+        return UCOAP_PARAM_ERROR;
+    }
+
+    if (udp->tx_count == UCOAP_POSIX_UDP_BATCH) {
+        err = ucoap_posix_udp_flush(udp);
+
+        if (err != UCOAP_OK) {
+            return err;
+        }
+    }
+
+    memcpy(udp->tx_bufs[udp->tx_count], buf, len);
+    udp->tx_lens[udp->tx_count] = len;
+    udp->tx_count++;
+
+    return UCOAP_OK;
+}
+
+
+#ifdef UCOAP_TX_DATAV
+/**
+ * @brief Implementation of the 'ucoap' hook: the queue is flushed to keep
+ *        the order of datagrams and the parts are sent by one 'sendmsg'
+ *        without copying. If the socket is busy the parts are queued.
+ *
+ */
+enum ucoap_error
+ucoap_tx_datav(struct ucoap_handle * const handle, const ucoap_data * iov,
+        const uint32_t iovcnt) {
+    uint32_t i;
+    enum ucoap_error err;
+    struct msghdr msg;
+    struct iovec vec[UCOAP_POSIX_UDP_MAX_PARTS];
+    struct ucoap_posix_udp * const udp = UCOAP_POSIX_UDP(handle);
+
+    if (iovcnt > UCOAP_POSIX_UDP_MAX_PARTS) {
+        return UCOAP_PARAM_ERROR;
+    }
+
+    err = ucoap_posix_udp_flush(udp);
+
+    if (err == UCOAP_BUSY_ERROR) {
+        return queue_parts(udp, iov, iovcnt);
+    } else if (err != UCOAP_OK) {
+        return err;
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        vec[i].iov_base = (void *)iov[i].buf;
+        vec[i].iov_len = iov[i].len;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &udp->peer;
+    msg.msg_namelen = udp->peer_len;
+    msg.msg_iov = vec;
+    msg.msg_iovlen = iovcnt;
+
+    while (sendmsg(udp->fd, &msg, MSG_DONTWAIT) < 0) {
+        if (errno == EINTR) {
+            continue;
+        }
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return queue_parts(udp, iov, iovcnt);
+        }
+
+        return UCOAP_IO_ERROR;
+    }
+
+    return UCOAP_OK;
+}
+#endif /* UCOAP_TX_DATAV */
+
+
+/**
+ * @brief Implementation of the 'ucoap' hook for the blocking mode: flush
+ *        the queue and wait until a datagram is accepted by the handle.
+ *
+ */
+enum ucoap_error
+ucoap_wait_event(struct ucoap_handle * const handle,
+        const uint32_t timeout_ms) {
+    int ready;
+    uint32_t start;
+    uint32_t elapsed;
+    enum ucoap_error err;
+    struct epoll_event ev;
+    struct ucoap_posix_udp * const udp = UCOAP_POSIX_UDP(handle);
+
+    err = ucoap_posix_udp_flush(udp);
+
+    if (err != UCOAP_OK && err != UCOAP_BUSY_ERROR) {
+        return err;
+    }
+
+    start = ucoap_posix_now();
+    elapsed = 0;
+
+    while (elapsed < timeout_ms) {
+        ready = epoll_wait(udp->epfd, &ev, 1, timeout_ms - elapsed);
+
+        if (ready < 0 && errno != EINTR) {
+            return UCOAP_IO_ERROR;
+        }
+
+        if (ready > 0 && ucoap_posix_udp_receive(udp)) {
+            return UCOAP_OK;
+        }
+
+        elapsed = ucoap_posix_now() - start;
+    }
+
+    return UCOAP_TIMEOUT_ERROR;
+}
+
+
+/**
+ * @brief Bind the receive messages to the buffers of backend
+ *
+ * @param udp - backend data
+ * @param msgs - messages for 'recvmmsg'
+ * @param iov - vectors of messages
+ *
+ */
+static void
+prepare_rx_msgs(struct ucoap_posix_udp * const udp,
+        struct mmsghdr * const msgs, struct iovec * const iov) {
+    uint32_t i;
+
+    memset(msgs, 0, UCOAP_POSIX_UDP_BATCH * sizeof(struct mmsghdr));
+
+    for (i = 0; i < UCOAP_POSIX_UDP_BATCH; i++) {
+        iov[i].iov_base = udp->rx_bufs[i];
+        iov[i].iov_len = UCOAP_POSIX_UDP_DGRAM_SIZE;
+
+        msgs[i].msg_hdr.msg_name = &udp->rx_addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+
+#ifdef UCOAP_TX_DATAV
+/**
+ * @brief Gather the parts into one datagram of the transmit queue
+ *
+ * @param udp - backend instance
+ * @param iov - array of parts
+ * @param iovcnt - number of parts
+ *
+ * @return status of operation
+ */
+static enum ucoap_error
+queue_parts(struct ucoap_posix_udp * const udp,
+        const ucoap_data * iov, const uint32_t iovcnt) {
+    uint32_t i;
+    uint32_t len;
+
+    if (udp->tx_count == UCOAP_POSIX_UDP_BATCH) {
+        return UCOAP_BUSY_ERROR;
+    }
+
+    len = 0;
+
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].len > UCOAP_POSIX_UDP_DGRAM_SIZE - len) {
+            return UCOAP_BUSY_ERROR;
+        }
+
+        memcpy(udp->tx_bufs[udp->tx_count] + len, iov[i].buf, iov[i].len);
+        len += iov[i].len;
+    }
+
+    udp->tx_lens[udp->tx_count] = len;
+    udp->tx_count++;
+
+    return UCOAP_OK;
+}
+#endif /* UCOAP_TX_DATAV */
+
+
+/**
+ * @brief Check that the datagram came from the peer of the backend: the
+ *        same family, address and port
+ *
+ * @param udp - backend data
+ * @param addr - source address of the datagram
+ * @param addr_len - length of the address
+ *
+ * @return true if the source is the peer
+ */
+static bool
+from_peer(const struct ucoap_posix_udp * const udp,
+        const struct sockaddr_storage * const addr, const socklen_t addr_len) {
+    const struct sockaddr_in * in;
+    const struct sockaddr_in6 * in6;
+    const struct sockaddr_in * peer_in;
+    const struct sockaddr_in6 * peer_in6;
+
+    if (addr->ss_family != udp->peer.ss_family) {
+        return false;
+    }
+
+    if (addr->ss_family == AF_INET && addr_len >= sizeof(*in)) {
+        in = (const struct sockaddr_in *)addr;
+        peer_in = (const struct sockaddr_in *)&udp->peer;
+
+        return in->sin_port == peer_in->sin_port
+                && in->sin_addr.s_addr == peer_in->sin_addr.s_addr;
+    }
+
+    if (addr->ss_family == AF_INET6 && addr_len >= sizeof(*in6)) {
+        in6 = (const struct sockaddr_in6 *)addr;
+        peer_in6 = (const struct sockaddr_in6 *)&udp->peer;
+
+        return in6->sin6_port == peer_in6->sin6_port
+                && memcmp(&in6->sin6_addr, &peer_in6->sin6_addr, sizeof(in6->sin6_addr)) == 0;
+    }
+
+    return addr_len == udp->peer_len && memcmp(addr, &udp->peer, addr_len) == 0;
+}
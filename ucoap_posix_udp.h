@@ -0,0 +1,151 @@
+/**
+ * ucoap_posix_udp.h
+ *
+ * Reference backend for Linux: implements 'ucoap_tx_data' and
+ * 'ucoap_wait_event' on top of a nonblocking UDP socket and epoll.
+ * Outgoing datagrams are queued and flushed with one 'sendmmsg' call,
+ * the receive queue is drained with 'recvmmsg'.
+ *
+ * All handles of the program have to be embedded into the
+ * 'ucoap_posix_udp' struct if this backend is linked. With the default
+ * sizes the struct takes about 340 KB (two queues of UCOAP_POSIX_UDP_BATCH
+ * datagrams), so keep it static and reduce the batch on small systems.
+ *
+ * The backend is single-threaded: the queue and the socket are not locked
+ * and a blocking 'ucoap_wait_event' receives the datagrams of the whole
+ * handle, so all calls on one handle have to be made from one thread.
+ *
+ * 'recvmmsg' and 'sendmmsg' need the file to be compiled with -D_GNU_SOURCE.
+ *
+ */
+
+
+#ifndef _UCOAP_UCOAP_POSIX_UDP_H_
+#define _UCOAP_UCOAP_POSIX_UDP_H_
+
+
+#include <sys/socket.h>
+
+#include "ucoap.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#ifndef UCOAP_POSIX_UDP_BATCH
+#define UCOAP_POSIX_UDP_BATCH           128       /* datagrams per syscall */
+#endif /* UCOAP_POSIX_UDP_BATCH */
+
+#ifndef UCOAP_POSIX_UDP_DGRAM_SIZE
+#define UCOAP_POSIX_UDP_DGRAM_SIZE      1280      /* the largest datagram to receive */
+#endif /* UCOAP_POSIX_UDP_DGRAM_SIZE */
+
+
+struct ucoap_posix_udp {
+
+    struct ucoap_handle handle;    /* must be the first member */
+
+    int fd;
+    int epfd;
+
+    struct sockaddr_storage peer;
+    socklen_t peer_len;
+
+    /* queue of outgoing datagrams */
+    uint32_t tx_count;
+    uint32_t tx_lens[UCOAP_POSIX_UDP_BATCH];
+    uint8_t tx_bufs[UCOAP_POSIX_UDP_BATCH][UCOAP_POSIX_UDP_DGRAM_SIZE];
+
+    /* incoming datagrams */
+    struct sockaddr_storage rx_addrs[UCOAP_POSIX_UDP_BATCH];
+    uint8_t rx_bufs[UCOAP_POSIX_UDP_BATCH][UCOAP_POSIX_UDP_DGRAM_SIZE];
+
+};
+
+
+/**
+ * @brief Create a nonblocking UDP socket for talking with the peer.
+ *        The 'handle' member has to be initialized by caller.
+ *
+ * @param udp - backend data
+ * @param peer - address of the server
+ * @param peer_len - length of the address
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_posix_udp_open(struct ucoap_posix_udp * const udp,
+        const struct sockaddr * const peer, const socklen_t peer_len);
+
+
+/**
+ * @brief Close the socket.
+ *
+ * @param udp - backend data
+ *
+ */
+void
+ucoap_posix_udp_close(struct ucoap_posix_udp * const udp);
+
+
+/**
+ * @brief Send all queued datagrams, as few 'sendmmsg' calls as possible.
+ *
+ * @param udp - backend data
+ *
+ * @return UCOAP_BUSY_ERROR if the socket buffer is full (the rest of queue
+ *         is kept), status of operation otherwise
+ */
+enum ucoap_error
+ucoap_posix_udp_flush(struct ucoap_posix_udp * const udp);
+
+
+/**
+ * @brief Drain the receive queue of the socket and pass every datagram
+ *        of the peer to 'ucoap_rx_packet' followed by 'ucoap_process', or
+ *        to 'ucoap_rx_packet_borrowed' if the zero-copy receiving is
+ *        enabled for the handle, so a datagram is handled before the next
+ *        one of the batch. Datagrams
+ *        from other sources and truncated ones (longer than
+ *        UCOAP_POSIX_UDP_DGRAM_SIZE) are dropped.
+ *
+ * @param udp - backend data
+ *
+ * @return count of datagrams which were accepted by the handle
+ */
+uint32_t
+ucoap_posix_udp_receive(struct ucoap_posix_udp * const udp);
+
+
+/**
+ * @brief One step of the asynchronous mode: flush the queue, wait for
+ *        datagrams not longer than timeout and receive them. Call
+ *        'ucoap_process' after it for the timeouts.
+ *
+ * @param udp - backend data
+ * @param timeout_ms - timeout of waiting, -1 for infinite waiting
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_posix_udp_poll(struct ucoap_posix_udp * const udp,
+        const int timeout_ms);
+
+
+/**
+ * @brief Monotonic time for the asynchronous mode.
+ *
+ * @return current time, ms
+ */
+uint32_t
+ucoap_posix_now(void);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* _UCOAP_UCOAP_POSIX_UDP_H_ */
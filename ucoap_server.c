@@ -0,0 +1,515 @@
+/**
+ * ucoap_server.c
+ *
+ */
+
+
+#include "ucoap_server.h"
+#include "ucoap_dedup.h"
+#include "ucoap_utils.h"
+
+
+#define UCOAP_URI_PATH_MAX_LEN       255
+
+
+static enum ucoap_error
+check_options(const uint8_t * const buf, const uint32_t len, uint32_t idx,
+        uint8_t * const code);
+static bool
+known_option(const uint16_t num);
+static uint16_t
+find_child(const struct ucoap_server * const server, const uint16_t parent,
+        const char * const segment, const uint32_t len);
+static enum ucoap_error
+send_response(struct ucoap_server * const server,
+        const struct ucoap_server_request * const request,
+        const struct ucoap_server_response * const response,
+        const uint32_t now);
+static enum ucoap_error
+replay_response(struct ucoap_server * const server,
+        const struct ucoap_endpoint * const endpoint,
+        const struct ucoap_dedup_entry * const entry);
+static enum ucoap_error
+reject_request(struct ucoap_server * const server,
+        const struct ucoap_server_request * const request);
+
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_server_init(struct ucoap_server * const server,
+        struct ucoap_handle * const handle) {
+    if (handle->transport != UCOAP_UDP) {
+        return UCOAP_PARAM_ERROR;
+    }
+
+    server->handle = handle;
+    server->dedup = NULL;
+
+    /* the root, the empty path */
+    server->nodes_count = 1;
+    server->nodes[0].segment = "";
+    server->nodes[0].len = 0;
+    server->nodes[0].child = 0;
+    server->nodes[0].sibling = 0;
+    server->nodes[0].resource = NULL;
+
+    return ucoap_alloc_mem_block(&server->buf, UCOAP_PDU_SIZE(handle));
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_server_deinit(struct ucoap_server * const server) {
+    if (server->buf != NULL) {
+        ucoap_free_mem_block(server->buf, UCOAP_PDU_SIZE(server->handle));
+        server->buf = NULL;
+    }
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_server_dedup(struct ucoap_server * const server,
+        struct ucoap_dedup * const dedup) {
+    if (dedup != NULL) {
+        ucoap_dedup_init(dedup, UCOAP_CONFIG(server->handle));
+    }
+
+    server->dedup = dedup;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_server_add(struct ucoap_server * const server,
+        const struct ucoap_resource * const resource) {
+    uint16_t node;
+    uint16_t child;
+    const char * end;
+    const char * segment;
+
+    node = 0;
+    segment = resource->path;
+
+    if (*segment == '/') {
+        segment++;
+    }
+
+    while (*segment != '\0') {
+        for (end = segment; *end != '\0' && *end != '/'; end++) {
+        }
+
+        if (end == segment || end - segment > UCOAP_URI_PATH_MAX_LEN) {
+            return UCOAP_PARAM_ERROR;
+        }
+
+        child = find_child(server, node, segment, end - segment);
+
+        if (child == 0) {
+            if (server->nodes_count == UCOAP_SERVER_TRIE_NODES) {
+                return UCOAP_NO_FREE_MEM_ERROR;
+            }
+
+            child = server->nodes_count++;
+
+            server->nodes[child].segment = segment;
+            server->nodes[child].len = end - segment;
+            server->nodes[child].child = 0;
+            server->nodes[child].resource = NULL;
+
+            server->nodes[child].sibling = server->nodes[node].child;
+            server->nodes[node].child = child;
+        }
+
+        node = child;
+        segment = *end == '/' ? end + 1 : end;
+    }
+
+    if (server->nodes[node].resource != NULL) {
+        return UCOAP_PARAM_ERROR;
+    }
+
+    server->nodes[node].resource = resource;
+
+    return UCOAP_OK;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+const struct ucoap_resource *
+ucoap_server_route(const struct ucoap_server * const server,
+        const ucoap_option_data * options) {
+    uint16_t node;
+
+    node = 0;
+
+    /* options are in ascending order, Uri-Path ones are in the path order */
+    for (; options != NULL && options->num <= UCOAP_URI_PATH_OPT; options = options->next) {
+        if (options->num != UCOAP_URI_PATH_OPT) {
+            continue;
+        }
+
+        node = find_child(server, node, (const char *)options->value, options->len);
+
+        if (node == 0) {
+            return NULL;
+        }
+    }
+
+    return server->nodes[node].resource;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_server_rx_packet(struct ucoap_server * const server,
+        const struct ucoap_endpoint * const endpoint,
+        const uint8_t * buf, const uint32_t len, const uint32_t now) {
+    enum ucoap_error err;
+    uint8_t code;
+    uint32_t payload_idx;
+    ucoap_data packet;
+    const struct ucoap_resource * resource;
+    const struct ucoap_dedup_entry * entry;
+    struct ucoap_server_request request;
+    struct ucoap_server_response response;
+    struct ucoap_handle * const handle = server->handle;
+
+    /* responses, ACK and RST are for the client */
+    if (len < UCOAP_UDP_HEADER_LEN
+            || (buf[0] >> 6) != UCOAP_DEFAULT_VERSION
+            || UCOAP_EXTRACT_CLASS(buf[1]) != UCOAP_REQUEST_CLASS
+            || ((buf[0] >> 4) & 0x03) == UCOAP_MESSAGE_ACK
+            || ((buf[0] >> 4) & 0x03) == UCOAP_MESSAGE_RST) {
+        return ucoap_rx_packet(handle, buf, len);
+    }
+
+    request.endpoint = endpoint;
+    request.type = (buf[0] >> 4) & 0x03;
+    request.code = buf[1];
+    request.mid = (buf[2] << 8) | buf[3];
+    request.tkl = buf[0] & 0x0F;
+    request.token = buf + UCOAP_UDP_HEADER_LEN;
+    request.options = NULL;
+    request.payload.buf = NULL;
+    request.payload.len = 0;
+
+    /* debug support */
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
+        ucoap_debug_print_packet(handle, "coap << ", (uint8_t *)buf, len);
+    }
+
+    /* ping, or the header is broken */
+    if (request.code == UCOAP_CODE_EMPTY_MSG
+            || request.tkl > UCOAP_MAX_TOKEN_LEN
+            || len - UCOAP_UDP_HEADER_LEN < request.tkl) {
+        return reject_request(server, &request);
+    }
+
+    /* a retransmission, the handler has been called already */
+    if (server->dedup != NULL && request.type == UCOAP_MESSAGE_CON) {
+        entry = ucoap_dedup_find(server->dedup, endpoint, request.mid, now);
+
+        if (entry != NULL) {
+            return replay_response(server, endpoint, entry);
+        }
+    }
+
+    /* unknown critical options and too many options are answered before decoding */
+    err = check_options(buf, len, UCOAP_UDP_HEADER_LEN + request.tkl, &code);
+
+    if (err != UCOAP_OK) {
+        return reject_request(server, &request);
+    }
+
+    response.code = UCOAP_RESP_SUCCESS_CONTENT_205;
+    response.options = NULL;
+    response.payload.buf = NULL;
+    response.payload.len = 0;
+
+    if (code != UCOAP_CODE_EMPTY_MSG) {
+        response.code = code;
+        return send_response(server, &request, &response, now);
+    }
+
+    packet.buf = (uint8_t *)buf;
+    packet.len = len;
+
+    err = decoding_options(&packet, server->options, UCOAP_SERVER_MAX_OPTIONS,
+            UCOAP_UDP_HEADER_LEN + request.tkl, &payload_idx);
+
+    if (err == UCOAP_OK) {
+        request.options = server->options;
+    }
+
+    if (payload_idx < len) {
+        request.payload.buf = (uint8_t *)buf + payload_idx;
+        request.payload.len = len - payload_idx;
+    }
+
+    resource = ucoap_server_route(server, request.options);
+
+    if (resource == NULL) {
+        response.code = UCOAP_RESP_NOT_FOUND_404;
+    } else if (!(resource->methods & UCOAP_METHOD(request.code))) {
+        response.code = UCOAP_RESP_METHOD_NOT_ALLOWED_405;
+    } else {
+        resource->handler(resource, &request, &response);
+    }
+
+    return send_response(server, &request, &response, now);
+}
+
+
+/**
+ * @brief Check the options of the request before decoding them
+ *
+ * @param buf - pointer on the request
+ * @param len - length of the request
+ * @param idx - index of the options
+ * @param code - pointer on variable for storing the code of the error
+ *        response, or UCOAP_CODE_EMPTY_MSG if the request may be served
+ *
+ * @return UCOAP_WRONG_OPTIONS_ERROR if the options (or the payload marker)
+ *         are broken
+ */
+static enum ucoap_error
+check_options(const uint8_t * const buf, const uint32_t len, uint32_t idx,
+        uint8_t * const code) {
+    uint16_t num;
+    uint32_t count;
+    uint32_t value_len;
+
+    num = 0;
+    count = 0;
+    *code = UCOAP_CODE_EMPTY_MSG;
+
+    while (next_option(buf, len, &idx, &num, &value_len)) {
+        idx += value_len;
+        count++;
+
+        if (*code != UCOAP_CODE_EMPTY_MSG) {
+            continue;
+        }
+
+        if (num == UCOAP_PROXY_URI_OPT || num == UCOAP_PROXY_SCHEME_OPT) {
+            *code = UCOAP_RESP_PROXYING_NOT_SUPPORTED_505;
+        } else if (!known_option(num)) {
+            *code = UCOAP_RESP_BAD_OPTION_402;
+        }
+    }
+
+    /* the options end by the payload marker with payload or by the end */
+    if (idx < len && (buf[idx] != UCOAP_PAYLOAD_PREFIX || idx + 1 == len)) {
+        return UCOAP_WRONG_OPTIONS_ERROR;
+    }
+
+    if (*code == UCOAP_CODE_EMPTY_MSG && count > UCOAP_SERVER_MAX_OPTIONS) {
+        *code = UCOAP_RESP_ERROR_BAD_REQUEST_400;
+    }
+
+    return UCOAP_OK;
+}
+
+
+/**
+ * @brief Check whether the option of the request may be served. Elective
+ *        options may be ignored, critical ones have to be understood.
+ *
+ * @param num - number of the option
+ *
+ * @return true if the option is known or elective
+ */
+static bool
+known_option(const uint16_t num) {
+    switch (num) {
+        case UCOAP_IF_MATCH_OPT:
+        case UCOAP_URI_HOST_OPT:
+        case UCOAP_IF_NON_MATCH_OPT:
+        case UCOAP_URI_PORT_OPT:
+        case UCOAP_URI_PATH_OPT:
+        case UCOAP_URI_QUERY_OPT:
+        case UCOAP_ACCEPT_OPT:
+        case UCOAP_BLOCK2_OPT:
+        case UCOAP_BLOCK1_OPT:
+            return true;
+
+        default:
+            return !(num & 1);
+    }
+}
+
+
+/**
+ * @brief Find the child of the trie node by its path segment
+ *
+ * @param server - the server
+ * @param parent - index of the node
+ * @param segment - the path segment
+ * @param len - length of the segment
+ *
+ * @return index of the child, 0 if there is no such one
+ */
+static uint16_t
+find_child(const struct ucoap_server * const server, const uint16_t parent,
+        const char * const segment, const uint32_t len) {
+    uint16_t child;
+
+    for (child = server->nodes[parent].child; child != 0; child = server->nodes[child].sibling) {
+        if (server->nodes[child].len == len
+                && mem_cmp(server->nodes[child].segment, segment, len)) {
+            return child;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Assemble the response in the buffer of the server and send it:
+ *        piggybacked in ACK to CON, as NON to NON. The response which does
+ *        not fit PDU is replaced by 5.00. The response to a confirmable
+ *        request is kept for its duplicates.
+ *
+ * @param server - the server
+ * @param request - the request
+ * @param response - the response
+ * @param now - current time, ms
+ *
+ * @return status of operation
+ */
+static enum ucoap_error
+send_response(struct ucoap_server * const server,
+        const struct ucoap_server_request * const request,
+        const struct ucoap_server_response * const response,
+        const uint32_t now) {
+    uint8_t code;
+    uint16_t mid;
+    uint32_t len;
+    const ucoap_option_data * options;
+    const ucoap_data * payload;
+    uint8_t * const buf = server->buf;
+    struct ucoap_handle * const handle = server->handle;
+
+    code = response->code;
+    options = response->options;
+    payload = &response->payload;
+
+    len = UCOAP_UDP_HEADER_LEN + request->tkl + encoded_options_length(options)
+            + (payload->len ? payload->len + 1 : 0);
+
+    if (len > UCOAP_PDU_SIZE(handle)) {
+        code = UCOAP_RESP_INTERNAL_SERVER_ERROR_500;
+        options = NULL;
+        payload = NULL;
+    }
+
+    if (request->type == UCOAP_MESSAGE_CON) {
+        buf[0] = (UCOAP_DEFAULT_VERSION << 6) | (UCOAP_MESSAGE_ACK << 4) | request->tkl;
+        mid = request->mid;
+    } else {
+        buf[0] = (UCOAP_DEFAULT_VERSION << 6) | (UCOAP_MESSAGE_NON << 4) | request->tkl;
+        mid = ucoap_get_message_id(handle);
+    }
+
+    buf[1] = code;
+    buf[2] = mid >> 8;
+    buf[3] = mid;
+    len = UCOAP_UDP_HEADER_LEN;
+
+    if (request->tkl) {
+        mem_copy(buf + len, request->token, request->tkl);
+        len += request->tkl;
+    }
+
+    if (options != NULL) {
+        len += encoding_options(buf + len, options);
+    }
+
+    if (payload != NULL && payload->len) {
+        len += fill_payload(buf + len, payload);
+    }
+
+    if (server->dedup != NULL && request->type == UCOAP_MESSAGE_CON) {
+        ucoap_dedup_add(server->dedup, request->endpoint, request->mid, buf, len, now);
+    }
+
+    /* debug support */
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
+        ucoap_debug_print_packet(handle, "coap >> ", buf, len);
+    }
+
+    return ucoap_server_tx_data(server, request->endpoint, buf, len);
+}
+
+
+/**
+ * @brief Send the kept response again to the duplicate of the request
+ *
+ * @param server - the server
+ * @param endpoint - the peer which has sent the duplicate
+ * @param entry - the kept request
+ *
+ * @return status of operation
+ */
+static enum ucoap_error
+replay_response(struct ucoap_server * const server,
+        const struct ucoap_endpoint * const endpoint,
+        const struct ucoap_dedup_entry * const entry) {
+    /* debug support */
+    if (UCOAP_CHECK_STATUS(server->handle, UCOAP_DEBUG_ON)) {
+        ucoap_debug_print_packet(server->handle, "coap >> ",
+                (uint8_t *)entry->response, entry->response_len);
+    }
+
+    return ucoap_server_tx_data(server, endpoint, entry->response, entry->response_len);
+}
+
+
+/**
+ * @brief Answer the confirmable request which can not be served (or ping)
+ *        by Reset, a non-confirmable one is ignored
+ *
+ * @param server - the server
+ * @param request - the request, only its header is valid
+ *
+ * @return status of operation
+ */
+static enum ucoap_error
+reject_request(struct ucoap_server * const server,
+        const struct ucoap_server_request * const request) {
+    uint8_t rst[UCOAP_UDP_HEADER_LEN];
+
+    if (request->type != UCOAP_MESSAGE_CON) {
+        return UCOAP_OK;
+    }
+
+    rst[0] = (UCOAP_DEFAULT_VERSION << 6) | (UCOAP_MESSAGE_RST << 4);
+    rst[1] = UCOAP_CODE_EMPTY_MSG;
+    rst[2] = request->mid >> 8;
+    rst[3] = request->mid;
+
+    ucoap_tx_signal(server->handle, UCOAP_TX_RST_PACKET);
+
+    return ucoap_server_tx_data(server, request->endpoint, rst, sizeof(rst));
+}
@@ -0,0 +1,265 @@
+/**
+ * ucoap_server.h
+ *
+ * Server role over CoAP over UDP. Incoming requests are routed by their
+ * Uri-Path to the registered resources through a trie of path segments,
+ * the handler fills the response and it is sent at once: piggybacked in
+ * ACK for a confirmable request, as NON for a non-confirmable one. Other
+ * packets (responses to our own requests) go to the client handle. With a
+ * deduplication store (ucoap_dedup.h) retransmitted confirmable requests
+ * get the response sent before and are not passed to the handler again.
+ *
+ */
+
+
+#ifndef _UCOAP_UCOAP_SERVER_H_
+#define _UCOAP_UCOAP_SERVER_H_
+
+
+#include "ucoap.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#ifndef UCOAP_SERVER_TRIE_NODES
+#define UCOAP_SERVER_TRIE_NODES         32        /* path segments of all resources, with the root */
+#endif /* UCOAP_SERVER_TRIE_NODES */
+
+#ifndef UCOAP_SERVER_MAX_OPTIONS
+#define UCOAP_SERVER_MAX_OPTIONS        16        /* options of a request, more are answered by 4.00 */
+#endif /* UCOAP_SERVER_MAX_OPTIONS */
+
+#ifndef UCOAP_ENDPOINT_SIZE
+#define UCOAP_ENDPOINT_SIZE             18        /* e.g. IPv6 address and port */
+#endif /* UCOAP_ENDPOINT_SIZE */
+
+/* mask of methods of 'struct ucoap_resource' */
+#define UCOAP_METHOD(code)              (1u << (code))
+
+
+/**
+ * @brief Address of the peer as bytes, e.g. address and port of UDP
+ *        socket. Responses are sent back to it by 'ucoap_server_tx_data'.
+ */
+struct ucoap_endpoint {
+
+    uint8_t len;
+    uint8_t addr[UCOAP_ENDPOINT_SIZE];
+
+};
+
+
+struct ucoap_server;
+struct ucoap_resource;
+struct ucoap_dedup;
+
+
+/**
+ * @brief The request passed to the handler, valid only during the call
+ */
+struct ucoap_server_request {
+
+    const struct ucoap_endpoint * endpoint;
+
+    uint8_t type;                  /* CON or NON */
+    uint8_t code;                  /* method */
+    uint16_t mid;
+    uint8_t tkl;
+    const uint8_t * token;
+
+    const ucoap_option_data * options;   /* in ascending order, NULL - none */
+    ucoap_data payload;
+
+};
+
+
+/**
+ * @brief The response filled by the handler. It is 2.05 without options and
+ *        payload before the call. Options and payload have to be valid until
+ *        the handler returns, they are copied to the response.
+ */
+struct ucoap_server_response {
+
+    uint8_t code;
+    const ucoap_option_data * options;   /* in ascending order, NULL - none */
+    ucoap_data payload;
+
+};
+
+
+/**
+ * @brief Serves the request to the resource
+ *
+ * @param resource - the resource the request is routed to
+ * @param request - the request
+ * @param response - the response to fill
+ *
+ */
+typedef void (* ucoap_resource_handler)(const struct ucoap_resource * const resource,
+        const struct ucoap_server_request * const request,
+        struct ucoap_server_response * const response);
+
+
+/**
+ * @brief A resource of the server, it has to live while the server does
+ */
+struct ucoap_resource {
+
+    const char * path;             /* e.g. "sensors/temp", "" - the root */
+    uint32_t methods;              /* e.g. UCOAP_METHOD(UCOAP_REQ_GET) */
+    ucoap_resource_handler handler;
+    void * user;
+
+};
+
+
+/**
+ * @brief A segment of registered paths. Internal, do not use it directly.
+ */
+struct ucoap_trie_node {
+
+    const char * segment;          /* in the path of the resource, not terminated */
+    uint16_t len;
+
+    uint16_t child;                /* the first one, 0 - none (the root is never a child) */
+    uint16_t sibling;              /* the next child of the parent, 0 - none */
+
+    const struct ucoap_resource * resource;    /* NULL - only a part of longer paths */
+
+};
+
+
+struct ucoap_server {
+
+    struct ucoap_handle * handle;  /* its PDU size, debug and client packets */
+    uint8_t * buf;                 /* the response, PDU size, own block */
+    struct ucoap_dedup * dedup;    /* NULL - requests are not deduplicated */
+
+    uint16_t nodes_count;
+    struct ucoap_trie_node nodes[UCOAP_SERVER_TRIE_NODES];
+
+    ucoap_option_data options[UCOAP_SERVER_MAX_OPTIONS];
+
+};
+
+
+/**
+ * @brief Send the response to the endpoint of the request. It has to be
+ *        implemented by user if the server is used.
+ *
+ * @param server - the server
+ * @param endpoint - the peer which has sent the request
+ * @param buf - pointer on buffer with the response
+ * @param len - length of the response
+ *
+ * @return status of operation
+ */
+extern enum ucoap_error
+ucoap_server_tx_data(struct ucoap_server * const server,
+        const struct ucoap_endpoint * const endpoint,
+        const uint8_t * buf, const uint32_t len);
+
+
+/**
+ * @brief Init the server without resources. The response buffer of PDU
+ *        size of the handle is allocated by 'ucoap_alloc_mem_block': the
+ *        handle has no buffer of its own to borrow, the buffers of its
+ *        transactions belong to the client requests in flight, may
+ *        hold a received response when a request arrives and are not
+ *        allocated at all in the zero-copy mode.
+ *
+ * @param server - the server
+ * @param handle - coap handle (UDP) which takes the other packets
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_server_init(struct ucoap_server * const server,
+        struct ucoap_handle * const handle);
+
+
+/**
+ * @brief Free the response buffer of the server
+ *
+ * @param server - the server
+ *
+ */
+void
+ucoap_server_deinit(struct ucoap_server * const server);
+
+
+/**
+ * @brief Deduplicate confirmable requests by the store. It is reset, its
+ *        EXCHANGE_LIFETIME is derived from the configuration of the handle.
+ *
+ * @param server - the server
+ * @param dedup - the store, NULL to stop deduplication
+ *
+ */
+void
+ucoap_server_dedup(struct ucoap_server * const server,
+        struct ucoap_dedup * const dedup);
+
+
+/**
+ * @brief Register the resource. Its path segments are added to the trie,
+ *        they are not copied.
+ *
+ * @param server - the server
+ * @param resource - the resource
+ *
+ * @return status of operation, UCOAP_PARAM_ERROR if the path is taken
+ *         already, UCOAP_NO_FREE_MEM_ERROR if there are no free nodes
+ */
+enum ucoap_error
+ucoap_server_add(struct ucoap_server * const server,
+        const struct ucoap_resource * const resource);
+
+
+/**
+ * @brief Find the resource by Uri-Path options of the request, one step
+ *        per segment
+ *
+ * @param server - the server
+ * @param options - options of the request in ascending order, may be NULL
+ *
+ * @return the resource or NULL if it is not registered
+ */
+const struct ucoap_resource *
+ucoap_server_route(const struct ucoap_server * const server,
+        const ucoap_option_data * options);
+
+
+/**
+ * @brief Receive a packet from the endpoint. A request is answered at once:
+ *        by the handler of its resource, by 4.04 (no resource), 4.05 (the
+ *        method is not allowed), 4.02 (unknown critical option), 5.05
+ *        (proxying) or 4.00; a confirmable request with a broken header or
+ *        options and an empty one (ping) are answered by Reset. A duplicate
+ *        of a confirmable request gets the kept response, or is passed to
+ *        the handler again if the response was too large to keep. Other
+ *        packets are passed to 'ucoap_rx_packet' of the handle.
+ *
+ * @param server - the server
+ * @param endpoint - the peer which has sent the packet
+ * @param buf - pointer on buffer with data
+ * @param len - length of data
+ * @param now - current time, ms
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_server_rx_packet(struct ucoap_server * const server,
+        const struct ucoap_endpoint * const endpoint,
+        const uint8_t * buf, const uint32_t len, const uint32_t now);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* _UCOAP_UCOAP_SERVER_H_ */
@@ -12,15 +12,17 @@
 
 
 
-#define UCOAP_MIN_TCP_HEADER_LEN     2u
-
 #define UCOAP_TCP_LEN_1BYTE          13
 #define UCOAP_TCP_LEN_2BYTES         14
 #define UCOAP_TCP_LEN_4BYTES         15
 
-#define UCOAP_TCP_LEN_MIN            13
-#define UCOAP_TCP_LEN_MED            269
-#define UCOAP_TCP_LEN_MAX            65805
+/* options of signals (RFC 8323, section 5) */
+#define UCOAP_CSM_MAX_MESSAGE_SIZE_OPT     2
+#define UCOAP_CSM_BLOCK_WISE_TRANSFER_OPT  4
+#define UCOAP_PING_CUSTODY_OPT             2
+#define UCOAP_ABORT_BAD_CSM_OPTION_OPT     2
+
+#define UCOAP_TCP_PING_TKL           4
 
 
 /**
@@ -51,11 +53,43 @@ typedef struct {
 
 static void
 asemble_request(struct ucoap_handle * const handle,
-        ucoap_data * const request,
+        struct ucoap_transaction * const trans,
         const ucoap_request_descriptor * const reqd);
 static uint32_t parse_response(const ucoap_data * const request, const ucoap_data * const response, uint32_t * const options_shift);
 static uint32_t extract_data_length(ucoap_tcp_header * const header, const uint8_t * const buf);
-static void shift_data(uint8_t * dst, const uint8_t * src, uint32_t len);
+static uint32_t fill_data_length(uint8_t * const buf, const uint32_t tkl, const uint32_t data_len);
+static uint32_t length_field_size(const uint32_t data_len);
+static uint32_t extended_length_size(const uint8_t len);
+static void
+start_frame_body(struct ucoap_handle * const handle,
+        struct ucoap_rx_stream * const stream);
+static enum ucoap_error
+transmit_request(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const ucoap_request_descriptor * const reqd);
+static enum ucoap_error
+deliver_response(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const uint32_t option_start_idx, const uint32_t now);
+static enum ucoap_error
+write_request(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans);
+static uint32_t
+frame_length(const struct ucoap_transaction * const trans,
+        const ucoap_request_descriptor * const reqd);
+static enum ucoap_error
+send_signal(struct ucoap_handle * const handle, const uint8_t code,
+        const uint8_t * const token, const uint8_t tkl,
+        const ucoap_option_data * const options);
+static void
+receive_csm(struct ucoap_handle * const handle,
+        const uint8_t * const buf, const uint32_t len);
+static void
+abort_connection(struct ucoap_handle * const handle, const uint16_t bad_option);
+static void
+fail_submitted(struct ucoap_handle * const handle, const enum ucoap_error err);
+static void
+release_held(struct ucoap_handle * const handle, const enum ucoap_error err);
 
 
 
@@ -65,25 +99,19 @@ static void shift_data(uint8_t * dst, const uint8_t * src, uint32_t len);
  */
 enum ucoap_error
 ucoap_send_coap_request_tcp(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
         const ucoap_request_descriptor * const reqd) {
-    ucoap_error err;
+    enum ucoap_error err;
     uint32_t resp_mask;
     uint32_t option_start_idx;
-    ucoap_result_data result;
 
-    /* assembling packet */
-    asemble_request(handle, &handle->request, reqd);
+    err = transmit_request(handle, trans, reqd);
 
-    /* debug support */
-    if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
-        ucoap_debug_print_packet(handle, "coap >> ", handle->request.buf, handle->request.len);
+    /* the response is awaited right now, the held frames go first */
+    if (err == UCOAP_OK) {
+        err = ucoap_flush_tcp(handle);
     }
 
-    /* sending packet */
-    ucoap_tx_signal(handle, UCOAP_ROUTINE_PACKET_WILL_START);
-
-    err = ucoap_tx_data(handle, handle->request.buf, handle->request.len);
-
     if (err != UCOAP_OK) {
         return err;
     }
@@ -92,13 +120,10 @@ ucoap_send_coap_request_tcp(struct ucoap_handle * const handle,
     resp_mask = UCOAP_RESP_EMPTY;
     if (reqd->response_callback != NULL) {
 
-        handle->response.len = 0;
-        UCOAP_SET_STATUS(handle, UCOAP_WAITING_RESP);
-
         /* waiting either data arriving or timeout expiring */
-        err = ucoap_wait_event(handle, UCOAP_RESP_TIMEOUT_MS);
+        err = ucoap_wait_transaction(handle, trans, UCOAP_CONFIG(handle)->resp_timeout_ms);
 
-        UCOAP_RESET_STATUS(handle, UCOAP_WAITING_RESP);
+        UCOAP_RESET_STATUS(trans, UCOAP_TRANS_WAITING_RESP);
 
         if (err != UCOAP_OK) {
             return err;
@@ -106,11 +131,11 @@ ucoap_send_coap_request_tcp(struct ucoap_handle * const handle,
 
         /* debug support */
         if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
-            ucoap_debug_print_packet(handle, "coap << ", handle->response.buf, handle->response.len);
+            ucoap_debug_print_packet(handle, "coap << ", trans->response.buf, trans->response.len);
         }
 
         /* parsing incoming packet */
-        resp_mask = parse_response(&handle->request, &handle->response, &option_start_idx);
+        resp_mask = parse_response(&trans->request, &trans->response, &option_start_idx);
 
         if (UCOAP_CHECK_RESP(resp_mask, UCOAP_RESP_INVALID_PACKET)) {
 
@@ -126,177 +151,904 @@ ucoap_send_coap_request_tcp(struct ucoap_handle * const handle,
             return err;
         }
 
-        /* We are using the same request buffer for storing incoming options, bcoz
-         * outgoing packet is not needed already. It allows us to save ram-memory.
-         */
-        err = decoding_options(&handle->response,
-                (ucoap_option_data *)handle->request.buf,
-                option_start_idx,
-                &handle->request.len);
+        err = deliver_response(handle, trans, option_start_idx, 0);
+    }
 
-        if (err == UCOAP_WRONG_OPTIONS_ERROR) {
-            return err;
+    return err;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_submit_coap_request_tcp(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const ucoap_request_descriptor * const reqd,
+        const uint32_t now) {
+    trans->deadline = now + UCOAP_CONFIG(handle)->resp_timeout_ms;
+
+    return transmit_request(handle, trans, reqd);
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_process_transaction_tcp(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const uint32_t now) {
+    enum ucoap_error err;
+    uint32_t resp_mask;
+    uint32_t option_start_idx;
+
+    /* nothing is expected, e.g. failed by Abort */
+    if (!UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_WAITING_RESP)) {
+        return;
+    }
+
+    if (!UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_RECEIVED)) {
+        /* notifications may come at any time */
+        if (!UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_OBSERVING)
+                && UCOAP_TIME_REACHED(now, trans->deadline)) {
+            ucoap_fail_transaction(handle, trans, UCOAP_TIMEOUT_ERROR);
         }
 
-        /* check the payload len */
-        if (handle->response.len > handle->request.len) {
-            result.payload.len = handle->response.len - handle->request.len;
-            result.payload.buf = handle->response.buf + handle->request.len;
-        } else {
-            result.payload.len = 0;
-            result.payload.buf = NULL;
+        return;
+    }
+
+    /* debug support */
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
+        ucoap_debug_print_packet(handle, "coap << ", trans->response.buf, trans->response.len);
+    }
+
+    resp_mask = parse_response(&trans->request, &trans->response, &option_start_idx);
+
+    if (UCOAP_CHECK_RESP(resp_mask, UCOAP_RESP_INVALID_PACKET)) {
+        /* ignore it, the right one may still come */
+        ucoap_tx_signal(handle, UCOAP_WRONG_PACKET_DID_RECEIVE);
+
+        trans->response.len = 0;
+        UCOAP_RESET_STATUS(trans, UCOAP_TRANS_RECEIVED);
+        return;
+    }
+
+    err = deliver_response(handle, trans, option_start_idx, now);
+
+    if (UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_OBSERVING)) {
+        ucoap_rearm_observation(handle, trans);
+        return;
+    }
+
+    if (err != UCOAP_OK) {
+        ucoap_fail_transaction(handle, trans, err);
+        return;
+    }
+
+    UCOAP_RESET_STATUS(trans, UCOAP_TRANS_WAITING_RESP | UCOAP_TRANS_RECEIVED);
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+struct ucoap_transaction *
+ucoap_route_packet_tcp(struct ucoap_handle * const handle,
+        const uint8_t * buf, const uint32_t len) {
+    uint32_t i;
+    uint32_t idx;
+    ucoap_tcp_header header;
+    struct ucoap_transaction * trans;
+
+    if (len < UCOAP_MIN_TCP_HEADER_LEN) {
+        return NULL;
+    }
+
+    header.len_header.byte = buf[0];
+    idx = 1;
+
+    /* the extended length must fit in the packet before reading it */
+    idx += extended_length_size(header.len_header.fields.len);
+
+    /* skip the code */
+    idx += 1;
+
+    if (len < idx + header.len_header.fields.tkl) {
+        return NULL;
+    }
+
+    /* signals are not responses, see 'ucoap_rx_signal_tcp' */
+    if (UCOAP_EXTRACT_CLASS(buf[idx - 1]) == UCOAP_TCP_SIGNAL_CLASS) {
+        return NULL;
+    }
+
+    /* responses are matched by token only */
+    for (i = 0; i < UCOAP_MAX_TRANSACTIONS; i++) {
+        trans = &handle->transactions[i];
+
+        if (UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_WAITING_RESP)
+                && ucoap_can_receive(trans)
+                && header.len_header.fields.tkl == trans->tkl
+                && mem_cmp(buf + idx, trans->token, trans->tkl)) {
+            return trans;
         }
+    }
 
-        /* response_code_idx = option_start_idx - (handle->response.buf[0] & 0x0f) - 1 */
-        result.resp_code = handle->response.buf[option_start_idx - (handle->response.buf[0] & 0x0f) - 1];
-        result.options = err == UCOAP_NO_OPTIONS_ERROR ? NULL : (ucoap_option_data *)handle->request.buf;
+    return NULL;
+}
 
-        reqd->response_callback(reqd, &result);
 
-        /* debug support */
-        if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
-            ucoap_debug_print_options(handle, "coap opt << ", result.options);
-            ucoap_debug_print_payload(handle, "coap pld << ", &result.payload);
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_frame_stream_tcp(struct ucoap_handle * const handle,
+        const uint8_t * buf, const uint32_t len,
+        uint32_t * const used, struct ucoap_transaction ** const trans) {
+    uint32_t idx;
+    uint32_t chunk;
+    ucoap_tcp_len_header len_header;
+    struct ucoap_rx_stream * const stream = &handle->rx_stream;
+
+    idx = 0;
+    *trans = NULL;
+
+    /* header, byte by byte: it is 14 bytes at most */
+    while (stream->header_need == 0 || stream->header_len < stream->header_need) {
+        if (idx == len) {
+            *used = idx;
+            return UCOAP_OK;
+        }
+
+        stream->header[stream->header_len++] = buf[idx++];
+
+        if (stream->header_len == 1) {
+            len_header.byte = stream->header[0];
+
+            /* the next frames can not be found after a broken one */
+            if (len_header.fields.tkl > UCOAP_MAX_TOKEN_LEN) {
+                ucoap_tx_signal(handle, UCOAP_WRONG_PACKET_DID_RECEIVE);
+                return UCOAP_WRONG_STATE_ERROR;
+            }
+
+            stream->header_need = 1 + extended_length_size(len_header.fields.len)
+                    + 1 + len_header.fields.tkl;
+        }
+
+        if (stream->header_len == stream->header_need) {
+            start_frame_body(handle, stream);
+        }
+    }
+
+    /* body, by blocks */
+    chunk = len - idx < stream->body_left ? len - idx : stream->body_left;
+
+    if (chunk != 0) {
+        /* the transaction may have timed out meanwhile */
+        if (stream->trans != NULL && ucoap_route_packet_tcp(handle,
+                    stream->header, stream->header_need) != stream->trans) {
+            stream->trans = NULL;
+        }
+
+        if (stream->trans != NULL) {
+            mem_copy(stream->trans->response.buf + stream->trans->response.len,
+                    buf + idx, chunk);
+            stream->trans->response.len += chunk;
+        } else if (stream->signal && !stream->signal_cut) {
+            mem_copy(stream->signal_buf + stream->signal_len, buf + idx, chunk);
+            stream->signal_len += chunk;
         }
+
+        idx += chunk;
+        stream->body_left -= chunk;
+    }
+
+    if (stream->body_left == 0) {
+        *trans = stream->trans;
+
+        if (stream->signal) {
+            ucoap_rx_signal_tcp(handle, stream->signal_buf, stream->signal_len);
+        }
+
+        ucoap_rx_stream_reset(handle);
+    }
+
+    *used = idx;
+    return UCOAP_OK;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_start_signaling_tcp(struct ucoap_handle * const handle) {
+    uint8_t size_value[4];
+    ucoap_option_data max_message_size;
+    struct ucoap_tcp_signaling * const signaling = &handle->signaling;
+
+    signaling->max_message_size = UCOAP_TCP_DEFAULT_MESSAGE_SIZE;
+    signaling->csm_received = false;
+    signaling->block_wise = false;
+    signaling->released = false;
+    signaling->ping_pending = false;
+
+    /* CSM is the first frame of the connection, the held ones are lost */
+    handle->tx_batch.len = 0;
+    release_held(handle, UCOAP_IO_ERROR);
+
+    UCOAP_SET_STATUS(handle, UCOAP_TCP_SIGNALING);
+
+    /* the whole frame has to be less than PDU, see 'start_frame_body' */
+    max_message_size.num = UCOAP_CSM_MAX_MESSAGE_SIZE_OPT;
+    max_message_size.len = encode_uint_value(size_value, UCOAP_PDU_SIZE(handle) - 1);
+    max_message_size.value = size_value;
+    max_message_size.next = NULL;
+
+    return send_signal(handle, UCOAP_TCP_SIGNAL_CSM_701, NULL, 0, &max_message_size);
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_ping_tcp(struct ucoap_handle * const handle, const uint32_t now) {
+    enum ucoap_error err;
+    ucoap_option_data custody;
+    struct ucoap_tcp_signaling * const signaling = &handle->signaling;
+
+    if (signaling->ping_pending) {
+        return UCOAP_BUSY_ERROR;
+    }
+
+    custody.num = UCOAP_PING_CUSTODY_OPT;
+    custody.len = 0;
+    custody.value = NULL;
+    custody.next = NULL;
+
+    ucoap_fill_token(handle, signaling->ping_token, UCOAP_TCP_PING_TKL);
+
+    /* Pong may arrive before 'ucoap_tx_data' returns */
+    signaling->ping_pending = true;
+    signaling->ping_deadline = now + UCOAP_CONFIG(handle)->resp_timeout_ms;
+
+    err = send_signal(handle, UCOAP_TCP_SIGNAL_PING_702, signaling->ping_token,
+            UCOAP_TCP_PING_TKL, &custody);
+
+    if (err != UCOAP_OK) {
+        signaling->ping_pending = false;
+    }
+
+    return err;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_release_tcp(struct ucoap_handle * const handle) {
+    handle->signaling.released = true;
+
+    return send_signal(handle, UCOAP_TCP_SIGNAL_RELEASE_704, NULL, 0, NULL);
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_flush_tcp(struct ucoap_handle * const handle) {
+    uint32_t len;
+    enum ucoap_error err;
+    struct ucoap_tx_batch * const batch = &handle->tx_batch;
+
+    if (batch->len == 0) {
+        return UCOAP_OK;
     }
 
+    /* the frames are gone even if writing fails, they are not resent */
+    len = batch->len;
+    batch->len = 0;
+
+    err = ucoap_tx_data(handle, batch->buf, len);
+    release_held(handle, err);
+
     return err;
 }
 
 
 /**
- * @brief Assemble CoAP over TCP request.
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_rx_signal_tcp(struct ucoap_handle * const handle,
+        const uint8_t * buf, const uint32_t len) {
+    uint32_t idx;
+    uint32_t value_len;
+    uint16_t num;
+    bool custody;
+    const uint8_t * token;
+    ucoap_tcp_header header;
+    ucoap_option_data custody_option;
+    struct ucoap_tcp_signaling * const signaling = &handle->signaling;
+
+    if (!UCOAP_CHECK_STATUS(handle, UCOAP_TCP_SIGNALING)
+            || len < UCOAP_MIN_TCP_HEADER_LEN) {
+        return;
+    }
+
+    header.len_header.byte = buf[0];
+    idx = 1 + extended_length_size(header.len_header.fields.len);
+
+    if (len < idx + 1 + header.len_header.fields.tkl) {
+        return;
+    }
+
+    extract_data_length(&header, buf + 1);
+    header.code = buf[idx++];
+    token = buf + idx;
+    idx += header.len_header.fields.tkl;
+
+    if (UCOAP_EXTRACT_CLASS(header.code) != UCOAP_TCP_SIGNAL_CLASS
+            || len - idx != header.data_len) {
+        return;
+    }
+
+    /* debug support */
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
+        ucoap_debug_print_packet(handle, "coap << ", (uint8_t *)buf, len);
+    }
+
+    switch (header.code) {
+        case UCOAP_TCP_SIGNAL_CSM_701:
+            receive_csm(handle, buf + idx, len - idx);
+            break;
+
+        case UCOAP_TCP_SIGNAL_PING_702:
+            custody = false;
+            num = 0;
+
+            while (next_option(buf, len, &idx, &num, &value_len)) {
+                custody |= num == UCOAP_PING_CUSTODY_OPT;
+                idx += value_len;
+            }
+
+            /* the signals before Ping are handled already */
+            custody_option.num = UCOAP_PING_CUSTODY_OPT;
+            custody_option.len = 0;
+            custody_option.value = NULL;
+            custody_option.next = NULL;
+
+            send_signal(handle, UCOAP_TCP_SIGNAL_PONG_703, token,
+                    header.len_header.fields.tkl, custody ? &custody_option : NULL);
+            break;
+
+        case UCOAP_TCP_SIGNAL_PONG_703:
+            if (signaling->ping_pending
+                    && header.len_header.fields.tkl == UCOAP_TCP_PING_TKL
+                    && mem_cmp(token, signaling->ping_token, UCOAP_TCP_PING_TKL)) {
+                signaling->ping_pending = false;
+
+                ucoap_tx_signal(handle, UCOAP_TCP_PONG_DID_RECEIVE);
+            }
+            break;
+
+        case UCOAP_TCP_SIGNAL_RELEASE_704:
+            /* Alternative-Address and Hold-Off are up to the user */
+            signaling->released = true;
+
+            ucoap_tx_signal(handle, UCOAP_TCP_RELEASE_DID_RECEIVE);
+            break;
+
+        case UCOAP_TCP_SIGNAL_ABORT_705:
+            signaling->released = true;
+            signaling->ping_pending = false;
+
+            ucoap_tx_signal(handle, UCOAP_TCP_ABORT_DID_RECEIVE);
+            fail_submitted(handle, UCOAP_NRST_ANSWER);
+            break;
+
+        default:
+            /* 7.00 and unknown signals are ignored */
+            break;
+    }
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_process_signaling_tcp(struct ucoap_handle * const handle,
+        const uint32_t now) {
+    struct ucoap_tcp_signaling * const signaling = &handle->signaling;
+
+    if (!signaling->ping_pending || !UCOAP_TIME_REACHED(now, signaling->ping_deadline)) {
+        return;
+    }
+
+    /* nothing more will come over this connection */
+    signaling->ping_pending = false;
+    signaling->released = true;
+
+    ucoap_tx_signal(handle, UCOAP_TCP_PING_TIMEOUT);
+    fail_submitted(handle, UCOAP_TIMEOUT_ERROR);
+}
+
+
+/**
+ * @brief Find the transaction which waits for the frame of the collected
+ *        header and put the header to its response buffer, or start
+ *        collecting the signal
  *
  * @param handle - coap handle
- * @param request - data struct for storing request
- * @param reqd - descriptor of request
+ * @param stream - state of the stream with the whole header
  *
  */
 static void
-asemble_request(struct ucoap_handle * const handle,
-        ucoap_data * const request,
+start_frame_body(struct ucoap_handle * const handle,
+        struct ucoap_rx_stream * const stream) {
+    uint8_t code_idx;
+    ucoap_tcp_header header;
+    struct ucoap_transaction * trans;
+
+    header.len_header.byte = stream->header[0];
+    extract_data_length(&header, stream->header + 1);
+    code_idx = stream->header_need - 1 - header.len_header.fields.tkl;
+
+    stream->body_left = header.data_len;
+    trans = ucoap_route_packet_tcp(handle, stream->header, stream->header_need);
+
+    if (trans != NULL && stream->header_need + header.data_len >= UCOAP_PDU_SIZE(handle)) {
+        ucoap_tx_signal(handle, UCOAP_RESPONSE_TO_LONG_ERROR);
+        trans = NULL;
+    }
+
+    if (trans != NULL) {
+        mem_copy(trans->response.buf, stream->header, stream->header_need);
+        trans->response.len = stream->header_need;
+    }
+
+    stream->trans = trans;
+
+    if (trans != NULL || UCOAP_EXTRACT_CLASS(stream->header[code_idx]) != UCOAP_TCP_SIGNAL_CLASS) {
+        return;
+    }
+
+    /* a signal is collected whole, if it is small enough */
+    if (header.data_len <= UCOAP_TCP_SIGNAL_SIZE) {
+        mem_copy(stream->signal_buf, stream->header, stream->header_need);
+        stream->signal_len = stream->header_need;
+        stream->signal = true;
+    } else if (stream->header[code_idx] != UCOAP_TCP_SIGNAL_CSM_701) {
+        /* as if it had no options, unknown critical ones of CSM can not be checked */
+        stream->signal_buf[0] = header.len_header.fields.tkl;
+        mem_copy(stream->signal_buf + 1, stream->header + code_idx, 1 + header.len_header.fields.tkl);
+        stream->signal_len = 2 + header.len_header.fields.tkl;
+        stream->signal = true;
+        stream->signal_cut = true;
+    }
+}
+
+
+/**
+ * @brief Assemble and send the request, mark the transaction as waiting
+ *        for the response if it is expected
+ *
+ * @param handle - coap handle
+ * @param trans - reserved transaction
+ * @param reqd - descriptor of request
+ *
+ * @return status of operation
+ */
+static enum ucoap_error
+transmit_request(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
         const ucoap_request_descriptor * const reqd) {
-    uint32_t options_shift;
-    uint32_t options_len;
-    ucoap_tcp_len_header header;
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_TCP_SIGNALING)) {
+        if (handle->signaling.released) {
+            return UCOAP_WRONG_STATE_ERROR;
+        }
+
+        /* the peer may not take more, see its CSM */
+        if (frame_length(trans, reqd) > handle->signaling.max_message_size) {
+            return UCOAP_PARAM_ERROR;
+        }
+    }
+
+    /* assembling packet */
+    asemble_request(handle, trans, reqd);
+
+    /* debug support */
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
+        ucoap_debug_print_packet(handle, "coap >> ", trans->request.buf, trans->request.len);
+    }
+
+    /* the answer may arrive before 'ucoap_tx_data' returns */
+    if (reqd->response_callback != NULL) {
+        UCOAP_SET_STATUS(trans, UCOAP_TRANS_WAITING_RESP);
+    }
+
+    /* sending packet */
+    ucoap_tx_signal(handle, UCOAP_ROUTINE_PACKET_WILL_START);
+
+    return write_request(handle, trans);
+}
+
 
 /**
-  * CoAP over TCP has a header with variable length. Therefore we should calculate
-  * length of Options & Payload before assembling the header.
-  * At first we will try to predict length of header.
-  * We should be shift a data, if we will predict wrong length of header.
-  *
-  */
-    options_len = 0;
-    options_shift = UCOAP_MIN_TCP_HEADER_LEN + reqd->tkl;
+ * @brief Decode the response and pass it to the callback
+ *
+ * @param handle - coap handle
+ * @param trans - transaction which has received the response
+ * @param option_start_idx - index of options in the response
+ * @param now - current time, ms
+ *
+ * @return status of operation
+ */
+static enum ucoap_error
+deliver_response(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const uint32_t option_start_idx, const uint32_t now) {
+    enum ucoap_error err;
+    ucoap_result_data result;
+
+    /* the options are walked in place by the callback, see 'ucoap_option_iterator' */
+    err = split_options(&trans->response, option_start_idx,
+            &result.options, &result.payload);
 
-    if (reqd->payload.len > 10) {
-        options_shift += 1;
+    if (err != UCOAP_OK) {
+        return err;
     }
 
-    /* assemble options */
-    if (reqd->options != NULL) {
-        options_len += encoding_options(request->buf + options_shift, reqd->options);
+    /* response_code_idx = option_start_idx - (trans->response.buf[0] & 0x0f) - 1 */
+    result.resp_code = trans->response.buf[option_start_idx - (trans->response.buf[0] & 0x0f) - 1];
+    result.err = UCOAP_OK;
+
+    /* debug support */
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
+        debug_print_options(handle, "coap opt << ", &result.options);
+        ucoap_debug_print_payload(handle, "coap pld << ", &result.payload);
     }
 
-    /* assemble header */
-    request->len = options_len + (reqd->payload.len ? reqd->payload.len + 1 : 0);
-    header.fields.tkl = reqd->tkl;
+    /* a stale notification is dropped */
+    if (!UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_OBSERVE)
+            || ucoap_observe_notification(trans, &result, now)) {
+        ucoap_complete_transaction(handle, trans, &result);
+    }
+
+    return UCOAP_OK;
+}
+
+
+/**
+ * @brief Write the assembled request, or append it to the held frames if
+ *        they are coalesced
+ *
+ * @param handle - coap handle
+ * @param trans - transaction with the assembled request
+ *
+ * @return status of operation
+ */
+static enum ucoap_error
+write_request(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans) {
+    enum ucoap_error err;
+    uint32_t len;
+    struct ucoap_tx_batch * const batch = &handle->tx_batch;
+
+    if (batch->buf == NULL) {
+        return ucoap_tx_request(handle, trans);
+    }
 
-    if (request->len < UCOAP_TCP_LEN_MIN) {
+    len = trans->request.len;
 
-        header.fields.len = request->len;
+#ifdef UCOAP_TX_DATAV
+    /* the payload is not in the request buffer */
+    len += trans->reqd->payload.len;
+#endif /* UCOAP_TX_DATAV */
 
-        request->buf[0] = header.byte;
-        request->buf[1] = reqd->code;
+    if (batch->len + len > batch->size) {
+        err = ucoap_flush_tcp(handle);
 
-        /* check on shift data */
-        if (options_shift > (UCOAP_MIN_TCP_HEADER_LEN + reqd->tkl)) {
-            shift_data(request->buf + reqd->tkl + UCOAP_MIN_TCP_HEADER_LEN, request->buf + options_shift, options_len);
+        if (err != UCOAP_OK) {
+            return err;
         }
+    }
 
-        request->len = 2;
+    if (len > batch->size) {
+        return ucoap_tx_request(handle, trans);
+    }
 
-    } else if (request->len < UCOAP_TCP_LEN_MED) {
+    mem_copy(batch->buf + batch->len, trans->request.buf, trans->request.len);
+    batch->len += trans->request.len;
 
-        header.fields.len = UCOAP_TCP_LEN_1BYTE;
+#ifdef UCOAP_TX_DATAV
+    if (trans->reqd->payload.len) {
+        mem_copy(batch->buf + batch->len, trans->reqd->payload.buf, trans->reqd->payload.len);
+        batch->len += trans->reqd->payload.len;
+    }
+#endif /* UCOAP_TX_DATAV */
 
-        request->buf[0] = header.byte;
-        request->buf[1] = request->len - UCOAP_TCP_LEN_MIN;
+    UCOAP_SET_STATUS(trans, UCOAP_TRANS_HELD);
 
-        /* check on shift data */
-        if (options_shift > reqd->tkl + UCOAP_MIN_TCP_HEADER_LEN + 1) {
+    return UCOAP_OK;
+}
+
+
+/**
+ * @brief Get the length of the frame of the request, as 'asemble_request'
+ *        would assemble it
+ *
+ * @param trans - transaction of the request
+ * @param reqd - descriptor of request
+ *
+ * @return length of the frame
+ */
+static uint32_t
+frame_length(const struct ucoap_transaction * const trans,
+        const ucoap_request_descriptor * const reqd) {
+    return request_frame_length(UCOAP_TCP, reqd->tkl,
+            trans->tmpl != NULL ? trans->tmpl->options_len : encoded_options_length(reqd->options),
+            reqd->payload.len);
+}
 
-            shift_data(request->buf + reqd->tkl + UCOAP_MIN_TCP_HEADER_LEN + 1,
-                    request->buf + options_shift, options_len);
 
-        } else if (options_shift < reqd->tkl + UCOAP_MIN_TCP_HEADER_LEN + 1) {
+/**
+ * @brief Assemble the signal and send it at once, it does not take a
+ *        transaction
+ *
+ * @param handle - coap handle
+ * @param code - code of the signal, 7.xx
+ * @param token - token of the signal, may be NULL if 'tkl' is 0
+ * @param tkl - length of token
+ * @param options - options of the signal (a few bytes), may be NULL
+ *
+ * @return status of operation
+ */
+static enum ucoap_error
+send_signal(struct ucoap_handle * const handle, const uint8_t code,
+        const uint8_t * const token, const uint8_t tkl,
+        const ucoap_option_data * const options) {
+    uint32_t len;
+    enum ucoap_error err;
+    uint8_t buf[UCOAP_MAX_TCP_HEADER_LEN + UCOAP_TCP_SIGNAL_SIZE];
+
+    /* keep the order of frames */
+    err = ucoap_flush_tcp(handle);
+
+    if (err != UCOAP_OK) {
+        return err;
+    }
+
+    len = fill_data_length(buf, tkl, encoded_options_length(options));
+    buf[len++] = code;
+
+    if (tkl) {
+        mem_copy(buf + len, token, tkl);
+        len += tkl;
+    }
+
+    if (options != NULL) {
+        len += encoding_options(buf + len, options);
+    }
+
+    /* debug support */
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
+        ucoap_debug_print_packet(handle, "coap >> ", buf, len);
+    }
+
+    return ucoap_tx_data(handle, buf, len);
+}
+
+
+/**
+ * @brief Take over the settings of the peer. An unknown critical option
+ *        is answered by Abort, elective ones are ignored.
+ *
+ * @param handle - coap handle
+ * @param buf - options of CSM
+ * @param len - length of options
+ *
+ */
+static void
+receive_csm(struct ucoap_handle * const handle,
+        const uint8_t * const buf, const uint32_t len) {
+    uint32_t idx;
+    uint32_t value_len;
+    uint16_t num;
+    struct ucoap_tcp_signaling * const signaling = &handle->signaling;
 
-            shift_data(request->buf + options_len + reqd->tkl + UCOAP_MIN_TCP_HEADER_LEN,
-                    request->buf + options_shift + options_len - 1, options_len);
+    idx = 0;
+    num = 0;
+
+    /* the settings which are not repeated stay as they were */
+    while (next_option(buf, len, &idx, &num, &value_len)) {
+        switch (num) {
+            case UCOAP_CSM_MAX_MESSAGE_SIZE_OPT:
+                signaling->max_message_size = decode_uint_value(buf + idx, value_len);
+                break;
+
+            case UCOAP_CSM_BLOCK_WISE_TRANSFER_OPT:
+                signaling->block_wise = true;
+                break;
+
+            default:
+                if (num & 1) {
+                    abort_connection(handle, num);
+                    return;
+                }
+                break;
         }
 
-        request->buf[2] = reqd->code;
-        request->len = 3;
+        idx += value_len;
+    }
 
-    } else if (request->len < UCOAP_TCP_LEN_MAX) {
+    signaling->csm_received = true;
 
-        header.fields.len = UCOAP_TCP_LEN_2BYTES;
-        request->buf[0] = header.byte;
+    ucoap_tx_signal(handle, UCOAP_TCP_CSM_DID_RECEIVE);
+}
 
-        /* check on shift data */
-        if (options_shift > reqd->tkl + UCOAP_MIN_TCP_HEADER_LEN + 2) {
 
-            shift_data(request->buf + reqd->tkl + UCOAP_MIN_TCP_HEADER_LEN + 2,
-                    request->buf + options_shift, options_len);
+/**
+ * @brief Send Abort with Bad-CSM-Option and fail the submitted requests
+ *
+ * @param handle - coap handle
+ * @param bad_option - number of the option which is not understood
+ *
+ */
+static void
+abort_connection(struct ucoap_handle * const handle, const uint16_t bad_option) {
+    uint8_t option_value[4];
+    ucoap_option_data bad_csm_option;
+
+    bad_csm_option.num = UCOAP_ABORT_BAD_CSM_OPTION_OPT;
+    bad_csm_option.len = encode_uint_value(option_value, bad_option);
+    bad_csm_option.value = option_value;
+    bad_csm_option.next = NULL;
+
+    handle->signaling.released = true;
+    handle->signaling.ping_pending = false;
+
+    ucoap_tx_signal(handle, UCOAP_TX_ABORT_PACKET);
+    send_signal(handle, UCOAP_TCP_SIGNAL_ABORT_705, NULL, 0, &bad_csm_option);
+
+    fail_submitted(handle, UCOAP_WRONG_OPTIONS_ERROR);
+}
+
+
+/**
+ * @brief Fail the submitted requests of the closing connection, they are
+ *        released by 'ucoap_process'. A blocking waiter times out.
+ *
+ * @param handle - coap handle
+ * @param err - the reason
+ *
+ */
+static void
+fail_submitted(struct ucoap_handle * const handle, const enum ucoap_error err) {
+    uint32_t i;
+    struct ucoap_transaction * trans;
 
-        } else if (options_shift < reqd->tkl + UCOAP_MIN_TCP_HEADER_LEN + 2) {
+    for (i = 0; i < UCOAP_MAX_TRANSACTIONS; i++) {
+        trans = &handle->transactions[i];
 
-            shift_data(request->buf + options_len + reqd->tkl + UCOAP_MIN_TCP_HEADER_LEN + 1,
-                    request->buf + options_shift + options_len - 1, options_len);
+        if (!UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_ASYNC)
+                || !UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_QUEUED | UCOAP_TRANS_WAITING_RESP)) {
+            continue;
         }
 
-        request->buf[1] = (request->len - UCOAP_TCP_LEN_MED) >> 8;
-        request->buf[2] = (request->len - UCOAP_TCP_LEN_MED);
-        request->buf[3] = reqd->code;
-        request->len = 4;
+        UCOAP_RESET_STATUS(trans, UCOAP_TRANS_QUEUED);
+        ucoap_fail_transaction(handle, trans, err);
+    }
+}
 
-    } else {
 
-        header.fields.len = UCOAP_TCP_LEN_4BYTES;
-        request->buf[0] = header.byte;
+/**
+ * @brief Forget that the frames of the transactions are held, as they have
+ *        been written or lost. If they have not been written, the
+ *        submitted requests fail, they are released by 'ucoap_process'; a
+ *        blocking request gets the error from its own write.
+ *
+ * @param handle - coap handle
+ * @param err - result of writing the frames
+ *
+ */
+static void
+release_held(struct ucoap_handle * const handle, const enum ucoap_error err) {
+    uint32_t i;
+    struct ucoap_transaction * trans;
+
+    for (i = 0; i < UCOAP_MAX_TRANSACTIONS; i++) {
+        trans = &handle->transactions[i];
+
+        if (!UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_HELD)) {
+            continue;
+        }
+
+        UCOAP_RESET_STATUS(trans, UCOAP_TRANS_HELD);
+
+        if (err != UCOAP_OK && UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_ASYNC)
+                && UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_WAITING_RESP)) {
+            ucoap_fail_transaction(handle, trans, err);
+        }
+    }
+}
+
+
+/**
+ * @brief Assemble CoAP over TCP request. The length of the header is
+ *        predicted by the payload and the options are encoded right after
+ *        the token, then the header and the token are written before them.
+ *        Only if the options push the body over the boundary of the
+ *        extended length, they are encoded once more at the right place.
+ *
+ * @param handle - coap handle
+ * @param trans - transaction for storing request and its token
+ * @param reqd - descriptor of request
+ *
+ */
+static void
+asemble_request(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const ucoap_request_descriptor * const reqd) {
+    uint32_t idx;
+    uint32_t payload_len;
+    uint32_t options_len;
+    ucoap_data * const request = &trans->request;
 
-        /* check on shift data */
-        if (options_shift > reqd->tkl + UCOAP_MIN_TCP_HEADER_LEN + 4) {
+    payload_len = reqd->payload.len ? reqd->payload.len + 1 : 0;
 
-            shift_data(request->buf + reqd->tkl + UCOAP_MIN_TCP_HEADER_LEN + 1,
-                    request->buf + options_shift, options_len);
+    /* assemble options, a template has them encoded already */
+    if (trans->tmpl != NULL) {
+        options_len = trans->tmpl->options_len;
+        idx = length_field_size(options_len + payload_len) + 1 + reqd->tkl;
 
-        } else if (options_shift < reqd->tkl + UCOAP_MIN_TCP_HEADER_LEN + 4) {
+        mem_copy(request->buf + idx, trans->tmpl->options, options_len);
+    } else {
+        options_len = 0;
+        idx = length_field_size(payload_len) + 1 + reqd->tkl;
 
-            shift_data(request->buf + options_len + reqd->tkl + UCOAP_MIN_TCP_HEADER_LEN + 3,
-                    request->buf + options_shift + options_len - 1, options_len);
+        if (reqd->options != NULL) {
+            options_len = encoding_options(request->buf + idx, reqd->options);
         }
 
-        request->buf[1] = (request->len - UCOAP_TCP_LEN_MAX) >> 24;
-        request->buf[2] = (request->len - UCOAP_TCP_LEN_MAX) >> 16;
-        request->buf[3] = (request->len - UCOAP_TCP_LEN_MAX) >> 8;
-        request->buf[4] = (request->len - UCOAP_TCP_LEN_MAX);
-        request->buf[5] = reqd->code;
-        request->len = 6;
+        if (length_field_size(options_len + payload_len) != length_field_size(payload_len)) {
+            idx = length_field_size(options_len + payload_len) + 1 + reqd->tkl;
+            encoding_options(request->buf + idx, reqd->options);
+        }
     }
 
+    /* assemble header */
+    request->len = fill_data_length(request->buf, reqd->tkl, options_len + payload_len);
+    request->buf[request->len++] = reqd->code;
+
     /* assemble token */
+    trans->tkl = reqd->tkl;
+
     if (reqd->tkl) {
         ucoap_fill_token(handle, request->buf + request->len, reqd->tkl);
-        request->len += reqd->tkl;
+        mem_copy(trans->token, request->buf + request->len, reqd->tkl);
     }
 
-    request->len += options_len;
+    request->len = idx + options_len;
 
     /* assemble payload */
     if (reqd->payload.len) {
-        request->len += fill_payload(request->buf + request->len, &reqd->payload);
+        request->len += fill_request_payload(request->buf + request->len, &reqd->payload);
     }
 }
 
@@ -429,18 +1181,93 @@ static uint32_t extract_data_length(ucoap_tcp_header * const header, const uint8
 
 
 /**
- * @brief Shift the data in the packet if we did predict a wrong length
+ * @brief Get size of the extended length by Len field of TCP header
+ *
+ * @param len - Len field (4 bits)
  *
- * @param dst - pointer on new position of data
- * @param src - pointer on current position of data
- * @param len - length of the shift
+ * @return count of bytes of the extended length
  */
-static void shift_data(uint8_t * dst, const uint8_t * src, uint32_t len)
+static uint32_t extended_length_size(const uint8_t len)
 {
-    if (dst < src) {
-        while (len--) *dst++ = *src++;
+    switch (len) {
+        case UCOAP_TCP_LEN_1BYTE:
+            return 1;
+
+        case UCOAP_TCP_LEN_2BYTES:
+            return 2;
+
+        case UCOAP_TCP_LEN_4BYTES:
+            return 4;
+
+        default:
+            return 0;
+    }
+}
+
+
+/**
+ * @brief Fill Len/TKL byte and extended length of TCP packet
+ *
+ * @param buf - pointer on packet buffer
+ * @param tkl - length of token
+ * @param data_len - length of options and payload (with its marker)
+ *
+ * @return length of filled bytes
+ */
+static uint32_t fill_data_length(uint8_t * const buf, const uint32_t tkl, const uint32_t data_len)
+{
+    uint32_t idx;
+    uint32_t ext_len;
+    ucoap_tcp_len_header header;
+
+    idx = 1;
+    header.fields.tkl = tkl;
+
+    if (data_len < UCOAP_TCP_LEN_MIN) {
+
+        header.fields.len = data_len;
+    } else if (data_len < UCOAP_TCP_LEN_MED) {
+
+        header.fields.len = UCOAP_TCP_LEN_1BYTE;
+        buf[idx++] = data_len - UCOAP_TCP_LEN_MIN;
+    } else if (data_len < UCOAP_TCP_LEN_MAX) {
+
+        ext_len = data_len - UCOAP_TCP_LEN_MED;
+        header.fields.len = UCOAP_TCP_LEN_2BYTES;
+        buf[idx++] = ext_len >> 8;
+        buf[idx++] = ext_len;
     } else {
-        while (len--) *dst-- = *src--;
+
+        ext_len = data_len - UCOAP_TCP_LEN_MAX;
+        header.fields.len = UCOAP_TCP_LEN_4BYTES;
+        buf[idx++] = ext_len >> 24;
+        buf[idx++] = ext_len >> 16;
+        buf[idx++] = ext_len >> 8;
+        buf[idx++] = ext_len;
     }
+
+    buf[0] = header.byte;
+
+    return idx;
 }
 
+
+/**
+ * @brief Length of Len/TKL byte and extended length of TCP packet
+ *
+ * @param data_len - length of options and payload (with its marker)
+ *
+ * @return length of the field, bytes
+ */
+static uint32_t length_field_size(const uint32_t data_len)
+{
+    if (data_len < UCOAP_TCP_LEN_MIN) {
+        return 1;
+    }
+
+    if (data_len < UCOAP_TCP_LEN_MED) {
+        return 2;
+    }
+
+    return data_len < UCOAP_TCP_LEN_MAX ? 3 : 5;
+}
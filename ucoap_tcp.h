@@ -36,13 +36,154 @@
  * @brief Send a CoAP packet over TCP. Do not use it directly.
  *
  * @param handle - coap handle
+ * @param trans - reserved transaction of the handle
  * @param reqd - descriptor of request
  *
  * @return status of operation
  */
 enum ucoap_error
 ucoap_send_coap_request_tcp(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
         const ucoap_request_descriptor * const reqd);
 
 
+/**
+ * @brief Submit a CoAP packet over TCP without waiting. Do not use it directly.
+ *
+ * @param handle - coap handle
+ * @param trans - reserved transaction of the handle
+ * @param reqd - descriptor of request
+ * @param now - current time, ms
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_submit_coap_request_tcp(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const ucoap_request_descriptor * const reqd,
+        const uint32_t now);
+
+
+/**
+ * @brief Handle the received packet or the expired timer of the submitted
+ *        transaction. Do not use it directly.
+ *
+ * @param handle - coap handle
+ * @param trans - submitted transaction
+ * @param now - current time, ms
+ *
+ */
+void
+ucoap_process_transaction_tcp(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const uint32_t now);
+
+
+/**
+ * @brief Find a transaction which is waiting the incoming TCP packet.
+ *        Do not use it directly.
+ *
+ * @param handle - coap handle
+ * @param buf - pointer on buffer with data
+ * @param len - length of data
+ *
+ * @return pointer on the transaction or NULL if packet is unexpected
+ */
+struct ucoap_transaction *
+ucoap_route_packet_tcp(struct ucoap_handle * const handle,
+        const uint8_t * buf, const uint32_t len);
+
+
+/**
+ * @brief Take bytes of the incoming stream up to the end of the next frame
+ *        (or all of them). The body of the frame is copied to the response
+ *        buffer of the transaction waiting for it. Do not use it directly.
+ *
+ * @param handle - coap handle
+ * @param buf - pointer on buffer with data
+ * @param len - length of data, not 0
+ * @param used - pointer on variable for storing count of taken bytes
+ * @param trans - pointer on variable for storing the transaction which has
+ *        received the whole frame, or NULL
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_frame_stream_tcp(struct ucoap_handle * const handle,
+        const uint8_t * buf, const uint32_t len,
+        uint32_t * const used, struct ucoap_transaction ** const trans);
+
+
+/**
+ * @brief Forget the signaling state of the previous connection and send
+ *        CSM. Do not use it directly.
+ *
+ * @param handle - coap handle
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_start_signaling_tcp(struct ucoap_handle * const handle);
+
+
+/**
+ * @brief Send Ping with Custody option. Do not use it directly.
+ *
+ * @param handle - coap handle
+ * @param now - current time, ms
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_ping_tcp(struct ucoap_handle * const handle, const uint32_t now);
+
+
+/**
+ * @brief Send Release and refuse new requests. Do not use it directly.
+ *
+ * @param handle - coap handle
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_release_tcp(struct ucoap_handle * const handle);
+
+
+/**
+ * @brief Write the held frames of requests. Do not use it directly.
+ *
+ * @param handle - coap handle
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_flush_tcp(struct ucoap_handle * const handle);
+
+
+/**
+ * @brief Handle the signal (7.xx) of the peer, other packets are ignored.
+ *        Do not use it directly.
+ *
+ * @param handle - coap handle
+ * @param buf - pointer on buffer with the whole packet
+ * @param len - length of data
+ *
+ */
+void
+ucoap_rx_signal_tcp(struct ucoap_handle * const handle,
+        const uint8_t * buf, const uint32_t len);
+
+
+/**
+ * @brief Check whether Pong has come in time. Do not use it directly.
+ *
+ * @param handle - coap handle
+ * @param now - current time, ms
+ *
+ */
+void
+ucoap_process_signaling_tcp(struct ucoap_handle * const handle,
+        const uint32_t now);
+
+
 #endif /* _UCOAP_UCOAP_TCP_H_ */
@@ -33,16 +33,40 @@ typedef struct {
 
 static void
 asemble_request(struct ucoap_handle * const handle,
-        ucoap_data * const request,
+        struct ucoap_transaction * const trans,
         const ucoap_request_descriptor * const reqd);
 static uint32_t
 parse_response(const ucoap_data * const request,
         const ucoap_data * const response);
 static void
 asemble_ack(ucoap_data * const ack, const ucoap_data * const response);
-static ucoap_error
+static enum ucoap_error
 waiting_ack(struct ucoap_handle * const handle,
-        const ucoap_data * const request);
+        struct ucoap_transaction * const trans);
+static uint32_t
+initial_ack_timeout(struct ucoap_handle * const handle, const uint32_t rto);
+static uint32_t
+next_ack_timeout(const uint32_t rto, const uint32_t timeout);
+static uint32_t
+adaptive_rto(struct ucoap_handle * const handle, const uint32_t now);
+static void
+update_rto(struct ucoap_handle * const handle,
+        const struct ucoap_transaction * const trans, const uint32_t now);
+static enum ucoap_error
+retransmit(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans);
+static enum ucoap_error
+transmit_request(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const ucoap_request_descriptor * const reqd);
+static enum ucoap_error
+deliver_response(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const uint32_t resp_mask, const uint32_t now);
+static void
+process_packet(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const uint32_t now);
 
 
 
@@ -51,24 +75,13 @@ waiting_ack(struct ucoap_handle * const handle,
  *
  */
 enum ucoap_error
-ucoap_send_coap_request_udp(ucoap_handle * const handle,
+ucoap_send_coap_request_udp(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
         const ucoap_request_descriptor * const reqd) {
-    ucoap_error err;
+    enum ucoap_error err;
     uint32_t resp_mask;
-    ucoap_result_data result;
-
-    /* assembling packet */
-    asemble_request(handle, &handle->request, reqd);
 
-    /* debug support */
-    if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
-        ucoap_debug_print_packet(handle, "coap >> ", handle->request.buf, handle->request.len);
-    }
-
-    /* sending packet */
-    ucoap_tx_signal(handle, UCOAP_ROUTINE_PACKET_WILL_START);
-
-    err = ucoap_tx_data(handle, handle->request.buf, handle->request.len);
+    err = transmit_request(handle, trans, reqd);
 
     if (err != UCOAP_OK) {
         return err;
@@ -78,11 +91,7 @@ ucoap_send_coap_request_udp(ucoap_handle * const handle,
     resp_mask = UCOAP_RESP_EMPTY;
     if (reqd->type == UCOAP_MESSAGE_CON) {
 
-        UCOAP_SET_STATUS(handle, UCOAP_WAITING_RESP);
-
-        err = waiting_ack(handle, &handle->request);
-
-        UCOAP_RESET_STATUS(handle, UCOAP_WAITING_RESP);
+        err = waiting_ack(handle, trans);
 
         if (err != UCOAP_OK) {
             return err;
@@ -90,16 +99,25 @@ ucoap_send_coap_request_udp(ucoap_handle * const handle,
 
         /* debug support */
         if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
-            ucoap_debug_print_packet(handle, "coap << ", handle->response.buf, handle->response.len);
+            ucoap_debug_print_packet(handle, "coap << ", trans->response.buf, trans->response.len);
         }
 
         /* parsing incoming ack packet */
-        resp_mask = parse_response(&handle->request, &handle->response);
+        resp_mask = parse_response(&trans->request, &trans->response);
+        UCOAP_RESET_STATUS(trans, UCOAP_TRANS_WAITING_ACK);
 
         if (UCOAP_CHECK_RESP(resp_mask, UCOAP_RESP_ACK)) {
 
             ucoap_tx_signal(handle, UCOAP_ACK_DID_RECEIVE);
 
+            /* an empty ACK, the response will be separate */
+            if (reqd->response_callback != NULL
+                    && !UCOAP_CHECK_RESP(resp_mask, UCOAP_RESP_PIGGYBACKED)) {
+                UCOAP_SET_STATUS(trans, UCOAP_TRANS_WAITING_RESP);
+                trans->response.len = 0;
+                UCOAP_RESET_STATUS(trans, UCOAP_TRANS_RECEIVED);
+            }
+
         } else if (UCOAP_CHECK_RESP(resp_mask, UCOAP_RESP_NRST)) {
 
             ucoap_tx_signal(handle, UCOAP_NRST_DID_RECEIVE);
@@ -118,15 +136,13 @@ ucoap_send_coap_request_udp(ucoap_handle * const handle,
     /* waiting response if needed */
     if (reqd->response_callback != NULL) {
 
-        if (reqd->type != UCOAP_MESSAGE_CON || !UCOAP_CHECK_RESP(resp_mask, UCOAP_RESP_PIGGYBACKED)) {
-
-            handle->response.len = 0;
-            UCOAP_SET_STATUS(handle, UCOAP_WAITING_RESP);
+        /* a separate response may overtake the empty ACK */
+        if (!UCOAP_CHECK_RESP(resp_mask, UCOAP_RESP_PIGGYBACKED | UCOAP_RESP_SEPARATE)) {
 
             /* waiting either data arriving or timeout expiring */
-            err = ucoap_wait_event(handle, UCOAP_RESP_TIMEOUT_MS);
+            err = ucoap_wait_transaction(handle, trans, UCOAP_CONFIG(handle)->resp_timeout_ms);
 
-            UCOAP_RESET_STATUS(handle, UCOAP_WAITING_RESP);
+            UCOAP_RESET_STATUS(trans, UCOAP_TRANS_WAITING_RESP);
 
             if (err != UCOAP_OK) {
                 return err;
@@ -134,10 +150,10 @@ ucoap_send_coap_request_udp(ucoap_handle * const handle,
 
             /* debug support */
             if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
-                ucoap_debug_print_packet(handle, "rcv coap << ", handle->response.buf, handle->response.len);
+                ucoap_debug_print_packet(handle, "rcv coap << ", trans->response.buf, trans->response.len);
             }
 
-            resp_mask = parse_response(&handle->request, &handle->response);
+            resp_mask = parse_response(&trans->request, &trans->response);
 
             if (UCOAP_CHECK_RESP(resp_mask, UCOAP_RESP_INVALID_PACKET)) {
 
@@ -154,63 +170,379 @@ ucoap_send_coap_request_udp(ucoap_handle * const handle,
             }
         }
 
-        /* We are using the same request buffer for storing incoming options, bcoz
-         * outgoing packet is not needed already. It allows us to save ram-memory.
-         */
-        err = decoding_options(&handle->response,
-                (ucoap_option_data *)handle->request.buf,
-                ((handle->response.buf[0] & 0x0F) + 4),
-                &handle->request.len);
+        err = deliver_response(handle, trans, resp_mask, 0);
+    }
 
-        if (err == UCOAP_WRONG_OPTIONS_ERROR) {
-            return err;
-        }
+    return err;
+}
 
-        /* check the payload len */
-        if (handle->response.len > handle->request.len) {
-            result.payload.len = handle->response.len - handle->request.len;
-            result.payload.buf = handle->response.buf + handle->request.len;
-        } else {
-            result.payload.len = 0;
-            result.payload.buf = NULL;
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_submit_coap_request_udp(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const ucoap_request_descriptor * const reqd,
+        const uint32_t now) {
+    enum ucoap_error err;
+
+    err = transmit_request(handle, trans, reqd);
+
+    if (err != UCOAP_OK) {
+        return err;
+    }
+
+    trans->retransmition = 0;
+    trans->sent_at = now;
+
+    if (reqd->type == UCOAP_MESSAGE_CON) {
+        trans->ack_timeout = initial_ack_timeout(handle, adaptive_rto(handle, now));
+        trans->deadline = now + trans->ack_timeout;
+    } else {
+        trans->deadline = now + UCOAP_CONFIG(handle)->resp_timeout_ms;
+    }
+
+    return UCOAP_OK;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_process_transaction_udp(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const uint32_t now) {
+    enum ucoap_error err;
+
+    if (UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_RECEIVED)) {
+        process_packet(handle, trans, now);
+        return;
+    }
+
+    /* notifications may come at any time */
+    if (UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_OBSERVING)
+            || !UCOAP_TIME_REACHED(now, trans->deadline)) {
+        return;
+    }
+
+    if (UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_WAITING_ACK)
+            && trans->retransmition < UCOAP_CONFIG(handle)->max_retransmit) {
+
+        trans->retransmition++;
+        trans->ack_timeout = next_ack_timeout(adaptive_rto(handle, now),
+                trans->ack_timeout);
+
+        ucoap_update_window(handle, true);
+        trans->deadline = now + trans->ack_timeout;
+
+        err = retransmit(handle, trans);
+
+        if (err != UCOAP_OK) {
+            ucoap_fail_transaction(handle, trans, err);
         }
+    } else {
+        ucoap_fail_transaction(handle, trans, UCOAP_TIMEOUT_ERROR);
+    }
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+struct ucoap_transaction *
+ucoap_route_packet_udp(struct ucoap_handle * const handle,
+        const uint8_t * buf, const uint32_t len) {
+    uint32_t i;
+    ucoap_udp_header header;
+    struct ucoap_transaction * trans;
 
-        result.resp_code = UCOAP_RESPONSE_CODE(handle->response.buf);
-        result.options = err == UCOAP_NO_OPTIONS_ERROR ? NULL : (ucoap_option_data *)handle->request.buf;
+    if (len < sizeof(ucoap_udp_header)) {
+        return NULL;
+    }
 
-        reqd->response_callback(reqd, &result);
+    mem_copy(&header, buf, sizeof(ucoap_udp_header));
 
-        /* debug support */
-        if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
-            ucoap_debug_print_options(handle, "coap opt << ", result.options);
-            ucoap_debug_print_payload(handle, "coap pld << ", &result.payload);
+    for (i = 0; i < UCOAP_MAX_TRANSACTIONS; i++) {
+        trans = &handle->transactions[i];
+
+        /* one packet behind the received one, until the owner will take it */
+        if (!ucoap_can_receive(trans)) {
+            continue;
         }
 
-        /* send ACK back if needed */
-        if (UCOAP_CHECK_RESP(resp_mask, UCOAP_RESP_NEED_SEND_ACK)) {
+        switch (header.type) {
+            case UCOAP_MESSAGE_ACK:
+            case UCOAP_MESSAGE_RST:
+                /* ACK and RST echo the Message ID */
+                if (UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_WAITING_ACK)
+                        && header.mid == trans->mid) {
+                    return trans;
+                }
+                break;
 
-            asemble_ack(&handle->request, &handle->response);
-            ucoap_tx_signal(handle, UCOAP_TX_ACK_PACKET);
+            default:
+                /* separate responses are matched by token */
+                if (UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_WAITING_ACK | UCOAP_TRANS_WAITING_RESP)
+                        && header.tkl == trans->tkl
+                        && len >= sizeof(ucoap_udp_header) + header.tkl
+                        && mem_cmp(buf + sizeof(ucoap_udp_header), trans->token, header.tkl)) {
+                    return trans;
+                }
+                break;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_reject_packet_udp(struct ucoap_handle * const handle,
+        const uint8_t * buf, const uint32_t len) {
+    uint32_t i;
+    ucoap_udp_header header;
+    const struct ucoap_transaction * trans;
+
+    if (len < sizeof(ucoap_udp_header)) {
+        return;
+    }
+
+    mem_copy(&header, buf, sizeof(ucoap_udp_header));
 
-            err = ucoap_tx_data(handle, handle->request.buf, handle->request.len);
+    if (header.vers != UCOAP_DEFAULT_VERSION
+            || (header.type != UCOAP_MESSAGE_CON && header.type != UCOAP_MESSAGE_NON)
+            || header.code == UCOAP_CODE_EMPTY_MSG
+            || len < sizeof(ucoap_udp_header) + header.tkl) {
+        return;
+    }
+
+    /* the owner of the token has not taken its previous packet yet */
+    for (i = 0; i < UCOAP_MAX_TRANSACTIONS; i++) {
+        trans = &handle->transactions[i];
+
+        if (UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_BUSY)
+                && header.tkl == trans->tkl
+                && mem_cmp(buf + sizeof(ucoap_udp_header), trans->token, header.tkl)) {
+            return;
         }
     }
 
+    header.type = UCOAP_MESSAGE_RST;
+    header.code = UCOAP_CODE_EMPTY_MSG;
+    header.tkl = 0;
+
+    ucoap_tx_signal(handle, UCOAP_TX_RST_PACKET);
+    ucoap_tx_data(handle, (const uint8_t *)&header, sizeof(ucoap_udp_header));
+}
+
+
+/**
+ * @brief Assemble and send the request, mark the transaction as waiting
+ *        for the answer if any is expected
+ *
+ * @param handle - coap handle
+ * @param trans - reserved transaction
+ * @param reqd - descriptor of request
+ *
+ * @return status of operation
+ */
+static enum ucoap_error
+transmit_request(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const ucoap_request_descriptor * const reqd) {
+    /* assembling packet */
+    asemble_request(handle, trans, reqd);
+
+    /* debug support */
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
+        ucoap_debug_print_packet(handle, "coap >> ", trans->request.buf, trans->request.len);
+    }
+
+    /* the answer may arrive before 'ucoap_tx_data' returns */
+    if (reqd->type == UCOAP_MESSAGE_CON) {
+        UCOAP_SET_STATUS(trans, UCOAP_TRANS_WAITING_ACK);
+    } else if (reqd->response_callback != NULL) {
+        UCOAP_SET_STATUS(trans, UCOAP_TRANS_WAITING_RESP);
+    }
+
+    /* sending packet */
+    ucoap_tx_signal(handle, UCOAP_ROUTINE_PACKET_WILL_START);
+
+    return ucoap_tx_request(handle, trans);
+}
+
+
+/**
+ * @brief Decode the response, pass it to the callback and send an ACK back
+ *        if the response is confirmable
+ *
+ * @param handle - coap handle
+ * @param trans - transaction which has received the response
+ * @param resp_mask - results of parsing the response
+ * @param now - current time, ms
+ *
+ * @return status of operation
+ */
+static enum ucoap_error
+deliver_response(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const uint32_t resp_mask, const uint32_t now) {
+    enum ucoap_error err;
+    ucoap_data ack;
+    ucoap_result_data result;
+    uint8_t ack_buf[sizeof(ucoap_udp_header)];
+
+    ack.buf = ack_buf;
+
+    /* the options are walked in place by the callback, see 'ucoap_option_iterator' */
+    err = split_options(&trans->response, (trans->response.buf[0] & 0x0F) + 4,
+            &result.options, &result.payload);
+
+    if (err != UCOAP_OK) {
+        return err;
+    }
+
+    result.resp_code = UCOAP_RESPONSE_CODE(trans->response.buf);
+    result.err = UCOAP_OK;
+
+    /* debug support */
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
+        debug_print_options(handle, "coap opt << ", &result.options);
+        ucoap_debug_print_payload(handle, "coap pld << ", &result.payload);
+    }
+
+    /* a stale notification is dropped, but acknowledged */
+    if (!UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_OBSERVE)
+            || ucoap_observe_notification(trans, &result, now)) {
+        ucoap_complete_transaction(handle, trans, &result);
+    }
+
+    /* send ACK back if needed */
+    if (UCOAP_CHECK_RESP(resp_mask, UCOAP_RESP_NEED_SEND_ACK)) {
+
+        asemble_ack(&ack, &trans->response);
+        ucoap_tx_signal(handle, UCOAP_TX_ACK_PACKET);
+
+        err = ucoap_tx_data(handle, ack.buf, ack.len);
+    }
+
     return err;
 }
 
 
+/**
+ * @brief Handle a packet which was routed to the asynchronous transaction
+ *
+ * @param handle - coap handle
+ * @param trans - transaction which has received the packet
+ * @param now - current time, ms
+ *
+ */
+static void
+process_packet(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const uint32_t now) {
+    enum ucoap_error err;
+    uint32_t resp_mask;
+
+    /* debug support */
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
+        ucoap_debug_print_packet(handle, "coap << ", trans->response.buf, trans->response.len);
+    }
+
+    resp_mask = parse_response(&trans->request, &trans->response);
+
+    if (UCOAP_CHECK_RESP(resp_mask, UCOAP_RESP_INVALID_PACKET)) {
+        /* ignore it, the right one may still come */
+        ucoap_tx_signal(handle, UCOAP_WRONG_PACKET_DID_RECEIVE);
+
+        trans->response.len = 0;
+        UCOAP_RESET_STATUS(trans, UCOAP_TRANS_RECEIVED);
+        return;
+    }
+
+    if (UCOAP_CHECK_RESP(resp_mask, UCOAP_RESP_NRST)) {
+        ucoap_tx_signal(handle, UCOAP_NRST_DID_RECEIVE);
+        ucoap_fail_transaction(handle, trans, UCOAP_NRST_ANSWER);
+        return;
+    }
+
+    if (UCOAP_CHECK_RESP(resp_mask, UCOAP_RESP_ACK)) {
+        ucoap_tx_signal(handle, UCOAP_ACK_DID_RECEIVE);
+
+        if (UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_WAITING_ACK)) {
+            if (UCOAP_CHECK_STATUS(handle, UCOAP_ADAPTIVE_RTO)) {
+                update_rto(handle, trans, now);
+            }
+
+            if (trans->retransmition == 0) {
+                ucoap_update_window(handle, false);
+            }
+        }
+    }
+
+    UCOAP_RESET_STATUS(trans, UCOAP_TRANS_WAITING_ACK);
+
+    if (trans->reqd->response_callback == NULL) {
+        /* nobody is waiting for the response, but a confirmable one needs ACK */
+        if (UCOAP_CHECK_RESP(resp_mask, UCOAP_RESP_NEED_SEND_ACK)) {
+            asemble_ack(&trans->request, &trans->response);
+            ucoap_tx_signal(handle, UCOAP_TX_ACK_PACKET);
+            ucoap_tx_data(handle, trans->request.buf, trans->request.len);
+        }
+
+        UCOAP_RESET_STATUS(trans, UCOAP_TRANS_WAITING_RESP | UCOAP_TRANS_RECEIVED);
+        return;
+    }
+
+    if (!UCOAP_CHECK_RESP(resp_mask, UCOAP_RESP_PIGGYBACKED | UCOAP_RESP_SEPARATE)) {
+        /* an empty ACK, the response will be separate */
+        UCOAP_SET_STATUS(trans, UCOAP_TRANS_WAITING_RESP);
+        trans->deadline = now + UCOAP_CONFIG(handle)->resp_timeout_ms;
+        trans->response.len = 0;
+        UCOAP_RESET_STATUS(trans, UCOAP_TRANS_RECEIVED);
+        return;
+    }
+
+    err = deliver_response(handle, trans, resp_mask, now);
+
+    if (UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_OBSERVING)) {
+        ucoap_rearm_observation(handle, trans);
+        return;
+    }
+
+    if (err == UCOAP_WRONG_OPTIONS_ERROR) {
+        ucoap_fail_transaction(handle, trans, err);
+        return;
+    }
+
+    UCOAP_RESET_STATUS(trans, UCOAP_TRANS_WAITING_RESP | UCOAP_TRANS_RECEIVED);
+}
+
+
 /**
  * @brief Assemble CoAP over UDP request.
  *
  * @param handle - coap handle
- * @param request - data struct for storing request
+ * @param trans - transaction for storing request, its Message ID and token
  * @param reqd - descriptor of request
  *
  */
-static void asemble_request(ucoap_handle * const handle, ucoap_data * const request, const ucoap_request_descriptor * const reqd)
-{
+static void
+asemble_request(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const ucoap_request_descriptor * const reqd) {
     ucoap_udp_header header;
+    ucoap_data * const request = &trans->request;
 
     request->len = sizeof(ucoap_udp_header);
 
@@ -221,20 +553,27 @@ static void asemble_request(ucoap_handle * const handle, ucoap_data * const requ
     header.tkl = reqd->tkl;
     header.mid = ucoap_get_message_id(handle);
 
+    trans->mid = header.mid;
+    trans->tkl = reqd->tkl;
+
     /* assemble token */
     if (reqd->tkl) {
         ucoap_fill_token(handle, request->buf + request->len, reqd->tkl);
+        mem_copy(trans->token, request->buf + request->len, reqd->tkl);
         request->len += reqd->tkl;
     }
 
-    /* assemble options */
-    if (reqd->options != NULL) {
+    /* assemble options, a template has them encoded already */
+    if (trans->tmpl != NULL) {
+        mem_copy(request->buf + request->len, trans->tmpl->options, trans->tmpl->options_len);
+        request->len += trans->tmpl->options_len;
+    } else if (reqd->options != NULL) {
         request->len += encoding_options(request->buf + request->len, reqd->options);
     }
 
     /* assemble payload */
     if (reqd->payload.len) {
-        request->len += fill_payload(request->buf + request->len, &reqd->payload);
+        request->len += fill_request_payload(request->buf + request->len, &reqd->payload);
     }
 
     /* copy header */
@@ -379,7 +718,7 @@ static void asemble_ack(ucoap_data * const ack, const ucoap_data * const respons
     ucoap_udp_header ack_header;
 
     /* get header from incoming packet */
-    mem_copy(&ack_header, response, sizeof(ucoap_udp_header));
+    mem_copy(&ack_header, response->buf, sizeof(ucoap_udp_header));
 
     /* assemble header */
     ack_header.type = UCOAP_MESSAGE_ACK;
@@ -397,34 +736,31 @@ static void asemble_ack(ucoap_data * const ack, const ucoap_data * const respons
  * @brief Waiting ACK functionality (retransmission and etc)
  *
  * @param handle - coap handle
- * @param request - outgoing packet
+ * @param trans - transaction with outgoing packet
  *
  * @return result of operation
  */
-static ucoap_error waiting_ack(ucoap_handle * const handle, const ucoap_data * const request)
-{
-    ucoap_error err;
+static enum ucoap_error
+waiting_ack(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans) {
+    enum ucoap_error err;
+    uint32_t timeout;
     uint32_t retransmition;
 
     retransmition = 0;
+    /* no clock to measure RTT, the configured timeout is used */
+    timeout = initial_ack_timeout(handle, 0);
 
     do {
 
-        err = ucoap_wait_event(handle, retransmition * ((UCOAP_ACK_TIMEOUT_MS * UCOAP_ACK_RANDOM_FACTOR) / 100) + UCOAP_ACK_TIMEOUT_MS);
+        err = ucoap_wait_transaction(handle, trans, timeout);
 
         if (err == UCOAP_TIMEOUT_ERROR) {
 
-            if (retransmition < UCOAP_MAX_RETRANSMIT) {
-                /* retransmission */
-                ucoap_tx_signal(handle, UCOAP_TX_RETR_PACKET);
-
-                /* debug support */
-                if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
-                    ucoap_debug_print_packet(handle, "coap retr >> ", handle->request.buf, handle->request.len);
-                }
-
+            if (retransmition < UCOAP_CONFIG(handle)->max_retransmit) {
                 retransmition++;
-                err = ucoap_tx_data(handle, request->buf, request->len);
+                timeout = next_ack_timeout(0, timeout);
+                err = retransmit(handle, trans);
 
                 if (err != UCOAP_OK) {
                     break;
@@ -440,3 +776,195 @@ static ucoap_error waiting_ack(ucoap_handle * const handle, const ucoap_data * c
     return err;
 }
 
+
+/**
+ * @brief Initial timeout of waiting ACK, a random value between ACK_TIMEOUT
+ *        and ACK_TIMEOUT * ACK_RANDOM_FACTOR (RFC 7252, 4.2), or ACK_TIMEOUT
+ *        if the random hook is not built in. The timeout is doubled after
+ *        every retransmission.
+ *
+ * @param handle - coap handle
+ * @param rto - adaptive RTO replacing ACK_TIMEOUT, 0 - not used
+ *
+ * @return timeout, ms
+ */
+static uint32_t
+initial_ack_timeout(struct ucoap_handle * const handle, const uint32_t rto) {
+#ifdef UCOAP_RANDOM_HOOK
+    uint32_t spread;
+#endif /* UCOAP_RANDOM_HOOK */
+    uint32_t timeout;
+
+    timeout = UCOAP_CONFIG(handle)->ack_timeout_ms;
+
+    if (rto) {
+        timeout = rto;
+    }
+
+#ifdef UCOAP_RANDOM_HOOK
+    spread = (timeout * (UCOAP_ACK_RANDOM_FACTOR - 100)) / 100;
+
+    if (spread == 0) {
+        return timeout;
+    }
+
+    return timeout + ucoap_random(handle) % (spread + 1);
+#else
+    return timeout;
+#endif /* UCOAP_RANDOM_HOOK */
+}
+
+
+/**
+ * @brief Timeout of waiting ACK after one more retransmission. It is doubled,
+ *        or with adaptive RTO multiplied by the variable backoff factor of
+ *        CoCoA: 3 for RTO below 1 s, 1.5 for RTO above 3 s, 2 otherwise.
+ *
+ * @param rto - adaptive RTO, 0 - not used
+ * @param timeout - previous timeout, ms
+ *
+ * @return timeout, ms
+ */
+static uint32_t
+next_ack_timeout(const uint32_t rto, const uint32_t timeout) {
+    if (rto) {
+        if (rto < UCOAP_RTO_SMALL_MS) {
+            return timeout * 3;
+        }
+
+        if (rto > UCOAP_RTO_LARGE_MS) {
+            return timeout + timeout / 2;
+        }
+    }
+
+    return timeout * 2;
+}
+
+
+/**
+ * @brief Feed one RTT estimator with the sample (RFC 6298 with given K)
+ *
+ * @param srtt - smoothed RTT of estimator
+ * @param rttvar - RTT variation of estimator
+ * @param rtt - sample, ms
+ * @param k - weight of variation
+ *
+ * @return RTO of the estimator, ms
+ */
+static uint32_t
+estimate_rto(uint32_t * const srtt, uint32_t * const rttvar,
+        const uint32_t rtt, const uint32_t k) {
+    uint32_t delta;
+
+    if (*srtt == 0) {
+        *srtt = rtt;
+        *rttvar = rtt / 2;
+    } else {
+        delta = *srtt > rtt ? *srtt - rtt : rtt - *srtt;
+
+        *rttvar = (3 * *rttvar + delta) / 4;
+        *srtt = (7 * *srtt + rtt) / 8;
+    }
+
+    return *srtt + k * *rttvar;
+}
+
+
+/**
+ * @brief Update the overall RTO of the handle by the ACK of the transaction.
+ *        RTT is measured from the first transmission of the request; the
+ *        exchanges with more than two retransmissions are not taken into
+ *        account as ambiguous.
+ *
+ * @param handle - coap handle
+ * @param trans - transaction which has received the ACK
+ * @param now - current time, ms
+ *
+ */
+static void
+update_rto(struct ucoap_handle * const handle,
+        const struct ucoap_transaction * const trans, const uint32_t now) {
+    uint32_t rtt;
+    uint32_t rto;
+    struct ucoap_rto_estimator * const est = &handle->rto;
+
+    rtt = now - trans->sent_at;
+
+    if (rtt == 0) {
+        rtt = 1;
+    }
+
+    if (trans->retransmition == 0) {
+        rto = estimate_rto(&est->strong_srtt, &est->strong_rttvar, rtt, 4);
+        est->rto = est->rto ? (rto + est->rto) / 2 : rto;
+    } else if (trans->retransmition <= 2) {
+        rto = estimate_rto(&est->weak_srtt, &est->weak_rttvar, rtt, 1);
+        est->rto = est->rto ? (rto + 3 * est->rto) / 4 : rto;
+    } else {
+        return;
+    }
+
+    est->updated_at = now;
+
+    if (est->rto < UCOAP_RTO_MIN_MS) {
+        est->rto = UCOAP_RTO_MIN_MS;
+    } else if (est->rto > UCOAP_RTO_MAX_MS) {
+        est->rto = UCOAP_RTO_MAX_MS;
+    }
+}
+
+
+/**
+ * @brief RTO of the handle for the next exchange, aged as CoCoA does if it
+ *        has not been updated for a long time: an RTO below 1 s is doubled
+ *        after 16 RTOs, an RTO above 3 s becomes 1 s + RTO / 2 after 4 RTOs.
+ *
+ * @param handle - coap handle
+ * @param now - current time, ms
+ *
+ * @return RTO, ms, or 0 if the configured ACK_TIMEOUT is used
+ */
+static uint32_t
+adaptive_rto(struct ucoap_handle * const handle, const uint32_t now) {
+    struct ucoap_rto_estimator * const est = &handle->rto;
+
+    if (!UCOAP_CHECK_STATUS(handle, UCOAP_ADAPTIVE_RTO) || est->rto == 0) {
+        return 0;
+    }
+
+    while (est->rto < UCOAP_RTO_SMALL_MS
+            && now - est->updated_at >= 16 * est->rto) {
+        est->updated_at += 16 * est->rto;
+        est->rto *= 2;
+    }
+
+    while (est->rto > UCOAP_RTO_LARGE_MS
+            && now - est->updated_at >= 4 * est->rto) {
+        est->updated_at += 4 * est->rto;
+        est->rto = 1000 + est->rto / 2;
+    }
+
+    return est->rto;
+}
+
+
+/**
+ * @brief Send the request of the transaction once again
+ *
+ * @param handle - coap handle
+ * @param trans - transaction with outgoing packet
+ *
+ * @return result of operation
+ */
+static enum ucoap_error
+retransmit(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans) {
+    ucoap_tx_signal(handle, UCOAP_TX_RETR_PACKET);
+
+    /* debug support */
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_DEBUG_ON)) {
+        ucoap_debug_print_packet(handle, "coap retr >> ", trans->request.buf, trans->request.len);
+    }
+
+    return ucoap_tx_request(handle, trans);
+}
@@ -36,13 +36,76 @@
  * @brief Send a CoAP packet over UDP. Do not use it directly.
  *
  * @param handle - coap handle
+ * @param trans - reserved transaction of the handle
  * @param reqd - descriptor of request
  *
  * @return status of operation
  */
 enum ucoap_error
 ucoap_send_coap_request_udp(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
         const ucoap_request_descriptor * const reqd);
 
 
+/**
+ * @brief Submit a CoAP packet over UDP without waiting. Do not use it directly.
+ *
+ * @param handle - coap handle
+ * @param trans - reserved transaction of the handle
+ * @param reqd - descriptor of request
+ * @param now - current time, ms
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_submit_coap_request_udp(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const ucoap_request_descriptor * const reqd,
+        const uint32_t now);
+
+
+/**
+ * @brief Handle the received packet or the expired timer of the submitted
+ *        transaction. Do not use it directly.
+ *
+ * @param handle - coap handle
+ * @param trans - submitted transaction
+ * @param now - current time, ms
+ *
+ */
+void
+ucoap_process_transaction_udp(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const uint32_t now);
+
+
+/**
+ * @brief Find a transaction which is waiting the incoming UDP packet.
+ *        Do not use it directly.
+ *
+ * @param handle - coap handle
+ * @param buf - pointer on buffer with data
+ * @param len - length of data
+ *
+ * @return pointer on the transaction or NULL if packet is unexpected
+ */
+struct ucoap_transaction *
+ucoap_route_packet_udp(struct ucoap_handle * const handle,
+        const uint8_t * buf, const uint32_t len);
+
+
+/**
+ * @brief Answer by Reset an unexpected response, e.g. a notification of
+ *        the cancelled observation. Do not use it directly.
+ *
+ * @param handle - coap handle
+ * @param buf - pointer on buffer with data
+ * @param len - length of data
+ *
+ */
+void
+ucoap_reject_packet_udp(struct ucoap_handle * const handle,
+        const uint8_t * buf, const uint32_t len);
+
+
 #endif /* _UCOAP_UCOAP_UDP_H_ */
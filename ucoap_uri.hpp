@@ -0,0 +1,493 @@
+/**
+ * ucoap_uri.hpp
+ *
+ * Options of a request encoded at compile time (C++20, header only). The
+ * URI is a template parameter, it is split into Uri-Path and Uri-Query
+ * options as RFC 7252, section 6.4 does it and encoded into a constexpr
+ * array of bytes, the same 'encoding_options' would write at runtime:
+ *
+ *     using telemetry = ucoap::options<
+ *             ucoap::uri<"/sensors/temp?unit=c">,
+ *             ucoap::uint_option<UCOAP_CONTENT_FORMAT_OPT, 50>>;
+ *
+ *     ucoap::init_template<telemetry>(handle, tmpl, reqd);
+ *
+ * The options of all parts are sorted by their numbers (options with the
+ * same number keep the order given), a malformed URI does not compile.
+ *
+ */
+
+
+#ifndef _UCOAP_UCOAP_URI_HPP_
+#define _UCOAP_UCOAP_URI_HPP_
+
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "ucoap.h"
+#include "ucoap_utils.h"
+
+
+namespace ucoap {
+
+
+/**
+ * @brief String literal as a template parameter
+ *
+ */
+template <std::size_t N>
+struct fixed_string {
+
+    char value[N] {};
+
+    consteval
+    fixed_string(const char (& str)[N]) {
+        for (std::size_t i = 0; i < N; i++) {
+            value[i] = str[i];
+        }
+    }
+
+    static constexpr std::size_t length = N - 1;
+
+};
+
+
+namespace detail {
+
+
+inline constexpr std::size_t max_option_value_len = 255;    /* Uri-Path, Uri-Query, Uri-Host */
+
+
+/* not constexpr: reaching it stops the compilation with the reason */
+inline void
+compile_error(const char * reason) {
+    (void)reason;
+}
+
+
+/**
+ * @brief Option collected from a part, its value is at 'at' of the values
+ *
+ */
+struct option_entry {
+
+    std::uint16_t num;
+    std::size_t at;
+    std::size_t len;
+
+};
+
+
+/**
+ * @brief Collector of options of the parts in any order. Without buffers
+ *        only the options and bytes of values are counted, so the sizes
+ *        of the buffers are known before collecting.
+ *
+ */
+class option_collector {
+
+public:
+
+    constexpr
+    option_collector(option_entry * entries, std::uint8_t * values)
+            : entries_(entries), values_(values) {}
+
+    constexpr std::size_t
+    count() const {
+        return count_;
+    }
+
+    constexpr std::size_t
+    bytes() const {
+        return bytes_;
+    }
+
+    constexpr void
+    put(const std::uint16_t num, const std::uint8_t * value, const std::size_t len) {
+        if (len > max_option_value_len) {
+            compile_error("option value is longer than 255 bytes");
+        }
+
+        if (entries_ != nullptr) {
+            entries_[count_] = option_entry { num, bytes_, len };
+
+            for (std::size_t i = 0; i < len; i++) {
+                values_[bytes_ + i] = value[i];
+            }
+        }
+
+        count_++;
+        bytes_ += len;
+    }
+
+private:
+
+    option_entry * entries_;
+    std::uint8_t * values_;
+    std::size_t count_ = 0;
+    std::size_t bytes_ = 0;
+
+};
+
+
+/**
+ * @brief Writer of options in order of their numbers. Without a buffer
+ *        only the length is counted, so the size of the array is known
+ *        before encoding.
+ *
+ */
+class option_writer {
+
+public:
+
+    constexpr explicit
+    option_writer(std::uint8_t * out) : out_(out) {}
+
+    constexpr std::size_t
+    length() const {
+        return len_;
+    }
+
+    constexpr void
+    put(const std::uint16_t num, const std::uint8_t * value, const std::size_t len) {
+        std::size_t header;
+
+        header = len_++;
+        byte(header, 0);
+        put_extended(header, 4, num - last_);
+        put_extended(header, 0, len);
+
+        for (std::size_t i = 0; i < len; i++) {
+            byte(len_++, value[i]);
+        }
+
+        last_ = num;
+    }
+
+private:
+
+    /* the nibble of the header at 'shift' and the extended bytes after it */
+    constexpr void
+    put_extended(const std::size_t header, const unsigned shift, const std::size_t value) {
+        if (value < 13) {
+            or_byte(header, value << shift);
+        } else if (value < 269) {
+            or_byte(header, 13 << shift);
+            byte(len_++, value - 13);
+        } else {
+            or_byte(header, 14 << shift);
+            byte(len_++, (value - 269) >> 8);
+            byte(len_++, value - 269);
+        }
+    }
+
+    constexpr void
+    byte(const std::size_t idx, const std::size_t value) {
+        if (out_ != nullptr) {
+            out_[idx] = static_cast<std::uint8_t>(value);
+        }
+    }
+
+    constexpr void
+    or_byte(const std::size_t idx, const std::size_t value) {
+        if (out_ != nullptr) {
+            out_[idx] |= static_cast<std::uint8_t>(value);
+        }
+    }
+
+    std::uint8_t * out_;
+    std::size_t len_ = 0;
+    std::uint16_t last_ = 0;
+
+};
+
+
+constexpr int
+hex_digit(const char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+
+    compile_error("bad percent-encoding in URI");
+    return 0;
+}
+
+
+/* percent-decode 'str[begin, end)' and put it as an option */
+constexpr void
+put_component(option_collector & collector, const std::uint16_t num,
+        const char * str, std::size_t begin, const std::size_t end) {
+    std::size_t len;
+    std::uint8_t value[max_option_value_len + 1] {};
+
+    for (len = 0; begin < end && len <= max_option_value_len; len++) {
+        if (str[begin] == '%') {
+            if (end - begin < 3) {
+                compile_error("bad percent-encoding in URI");
+            }
+
+            value[len] = hex_digit(str[begin + 1]) << 4 | hex_digit(str[begin + 2]);
+            begin += 3;
+        } else {
+            value[len] = str[begin++];
+        }
+    }
+
+    if (begin < end) {
+        compile_error("option value is longer than 255 bytes");
+    }
+
+    collector.put(num, value, len);
+}
+
+
+/* each part of 'str[begin, end)' separated by 'sep' is an option */
+constexpr void
+put_components(option_collector & collector, const std::uint16_t num,
+        const char * str, std::size_t begin, const std::size_t end, const char sep) {
+    std::size_t i;
+
+    for (i = begin; i <= end; i++) {
+        if (i == end || str[i] == sep) {
+            put_component(collector, num, str, begin, i);
+            begin = i + 1;
+        }
+    }
+}
+
+
+template <class... Parts>
+consteval option_collector
+collected() {
+    option_collector collector(nullptr, nullptr);
+
+    (Parts::write(collector), ...);
+
+    return collector;
+}
+
+
+/* collect the options of the parts and write them sorted by their numbers */
+template <class... Parts>
+constexpr void
+write_sorted(option_writer & writer) {
+    constexpr option_collector sizes = collected<Parts...>();
+    std::array<option_entry, sizes.count() + 1> entries {};
+    std::array<std::uint8_t, sizes.bytes() + 1> values {};
+    option_collector collector(entries.data(), values.data());
+
+    (Parts::write(collector), ...);
+
+    /* insertion sort keeps the order of options with the same number */
+    for (std::size_t i = 1; i < sizes.count(); i++) {
+        const option_entry entry = entries[i];
+        std::size_t j;
+
+        for (j = i; j > 0 && entries[j - 1].num > entry.num; j--) {
+            entries[j] = entries[j - 1];
+        }
+
+        entries[j] = entry;
+    }
+
+    for (std::size_t i = 0; i < sizes.count(); i++) {
+        writer.put(entries[i].num, values.data() + entries[i].at, entries[i].len);
+    }
+}
+
+
+template <class... Parts>
+consteval std::size_t
+encoded_length() {
+    option_writer writer(nullptr);
+
+    write_sorted<Parts...>(writer);
+
+    return writer.length();
+}
+
+
+template <class... Parts>
+consteval std::array<std::uint8_t, encoded_length<Parts...>()>
+encode() {
+    std::array<std::uint8_t, encoded_length<Parts...>()> out {};
+    option_writer writer(out.data());
+
+    write_sorted<Parts...>(writer);
+
+    return out;
+}
+
+
+} /* namespace detail */
+
+
+/**
+ * @brief Uri-Path and Uri-Query options of the path and query of the URI,
+ *        e.g. "/sensors/temp?unit=c". The path "/" has no Uri-Path options.
+ *
+ */
+template <fixed_string Uri>
+struct uri {
+
+    static constexpr void
+    write(detail::option_collector & collector) {
+        std::size_t query;
+        const char * str = Uri.value;
+
+        if (Uri.length == 0 || str[0] != '/') {
+            detail::compile_error("URI has to start with '/'");
+        }
+
+        for (query = 0; query < Uri.length && str[query] != '?'; query++) {
+            if (str[query] == '#') {
+                detail::compile_error("URI fragment is not sent in CoAP");
+            }
+        }
+
+        if (query > 1) {
+            detail::put_components(collector, UCOAP_URI_PATH_OPT, str, 1, query, '/');
+        }
+
+        if (query < Uri.length) {
+            for (std::size_t i = query; i < Uri.length; i++) {
+                if (str[i] == '#') {
+                    detail::compile_error("URI fragment is not sent in CoAP");
+                }
+            }
+
+            detail::put_components(collector, UCOAP_URI_QUERY_OPT, str, query + 1, Uri.length, '&');
+        }
+    }
+
+};
+
+
+/**
+ * @brief Option with unsigned integer value in the fewest bytes, e.g.
+ *        Content-Format or Accept
+ *
+ */
+template <std::uint16_t Num, std::uint32_t Value>
+struct uint_option {
+
+    static constexpr void
+    write(detail::option_collector & collector) {
+        std::size_t len;
+        std::uint8_t value[4] {};
+
+        for (len = 0; len < 4 && Value >> (8 * len); len++) {
+        }
+
+        for (std::size_t i = 0; i < len; i++) {
+            value[i] = static_cast<std::uint8_t>(Value >> (8 * (len - 1 - i)));
+        }
+
+        collector.put(Num, value, len);
+    }
+
+};
+
+
+/**
+ * @brief Option with string value, e.g. Uri-Host
+ *
+ */
+template <std::uint16_t Num, fixed_string Value>
+struct string_option {
+
+    static constexpr void
+    write(detail::option_collector & collector) {
+        std::uint8_t value[Value.length + 1] {};
+
+        for (std::size_t i = 0; i < Value.length; i++) {
+            value[i] = static_cast<std::uint8_t>(Value.value[i]);
+        }
+
+        collector.put(Num, value, Value.length);
+    }
+
+};
+
+
+/**
+ * @brief Encoded options of the parts, sorted by their numbers
+ *
+ */
+template <class... Parts>
+struct options {
+
+    static constexpr std::size_t length = detail::encoded_length<Parts...>();
+
+    static constexpr std::array<std::uint8_t, length> bytes = detail::encode<Parts...>();
+
+};
+
+
+/**
+ * @brief Encoded Uri-Path and Uri-Query options of the URI
+ *
+ */
+template <fixed_string Uri>
+inline constexpr const auto & uri_options = options<uri<Uri>>::bytes;
+
+
+/* the example of the description above: Uri-Path, Content-Format, Uri-Query */
+static_assert(options<uri<"/sensors/temp?unit=c">, uint_option<UCOAP_CONTENT_FORMAT_OPT, 50>>::bytes
+        == std::array<std::uint8_t, 22> {
+            0xb7, 's', 'e', 'n', 's', 'o', 'r', 's', 0x04, 't', 'e', 'm', 'p',
+            0x11, 50, 0x36, 'u', 'n', 'i', 't', '=', 'c'
+        });
+
+
+/**
+ * @brief Make the template of the request with the options encoded at
+ *        compile time, see 'ucoap_template_init'. The options of the
+ *        descriptor are ignored.
+ *
+ * @param handle - coap handle, the request without payload has to fit it
+ * @param tmpl - the template
+ * @param reqd - descriptor of request (type, code, tkl, callback)
+ *
+ * @return status of operation
+ */
+template <class Options>
+enum ucoap_error
+init_template(ucoap_handle & handle, ucoap_request_template & tmpl,
+        const ucoap_request_descriptor & reqd) {
+    static_assert(Options::length <= UCOAP_TEMPLATE_OPTIONS_SIZE,
+            "the options exceed UCOAP_TEMPLATE_OPTIONS_SIZE");
+
+    if (request_frame_length(handle.transport, reqd.tkl, Options::length, 0)
+            > UCOAP_PDU_SIZE(&handle)) {
+        return UCOAP_PARAM_ERROR;
+    }
+
+    tmpl.reqd = reqd;
+    tmpl.reqd.options = nullptr;
+    tmpl.reqd.payload.buf = nullptr;
+    tmpl.reqd.payload.len = 0;
+    tmpl.options_len = Options::length;
+
+    for (std::size_t i = 0; i < Options::length; i++) {
+        tmpl.options[i] = Options::bytes[i];
+    }
+
+    return UCOAP_OK;
+}
+
+
+} /* namespace ucoap */
+
+
+#endif /* _UCOAP_UCOAP_URI_HPP_ */
@@ -9,16 +9,18 @@
 
 
 #include "ucoap_utils.h"
+#include "ucoap_helpers.h"
 
 
-#define UCOAP_OPT_MIN                13
-#define UCOAP_OPT_MED                269
+#define UCOAP_OBSERVE_SEQ_HALF       (1ul << 23)
+#define UCOAP_OBSERVE_FRESH_MS       128000
 
-#define UCOAP_OPT_1BYTE              13
-#define UCOAP_OPT_2BYTE              14
-#define UCOAP_OPT_DIS                15
 
-#define UCOAP_PAYLOAD_PREFIX         0xff
+static uint32_t
+window_limit(const struct ucoap_handle * const handle);
+static bool
+extend_option_field(const uint8_t * const buf, const uint32_t len,
+        uint32_t * const idx, uint32_t * const field);
 
 
 
@@ -73,9 +75,11 @@ uint32_t encoding_options(uint8_t * const buf, const ucoap_option_data * options
             buf[idx++] = (options->len - UCOAP_OPT_MED) & 0x00FF;
         }
 
-        /* value */
-        mem_copy(buf + idx, options->value, options->len);
-        idx += options->len;
+        /* value, an empty one may have no buffer (e.g. Custody) */
+        if (options->len) {
+            mem_copy(buf + idx, options->value, options->len);
+            idx += options->len;
+        }
 
         options = options->next;
 
@@ -86,109 +90,514 @@ uint32_t encoding_options(uint8_t * const buf, const ucoap_option_data * options
 }
 
 
+/**
+ * @brief See description in the header file.
+ *
+ */
+uint32_t encoded_options_length(const ucoap_option_data * options)
+{
+    uint32_t len;
+    uint16_t delta;
+    uint16_t delta_sum;
+
+    delta_sum = 0;
+    len = 0;
+
+    for (; options != NULL; options = options->next) {
+        delta = options->num - delta_sum;
+        delta_sum += delta;
+
+        /* the byte of delta and length, extended delta and extended length */
+        len += 1 + options->len;
+        len += delta < UCOAP_OPT_MIN ? 0 : (delta < UCOAP_OPT_MED ? 1 : 2);
+        len += options->len < UCOAP_OPT_MIN ? 0 : (options->len < UCOAP_OPT_MED ? 1 : 2);
+    }
+
+    return len;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+uint32_t request_frame_length(const uint16_t transport, const uint32_t tkl,
+        const uint32_t options_len, const uint32_t payload_len)
+{
+    uint32_t len;
+    uint32_t data_len;
+
+    data_len = options_len + (payload_len ? payload_len + 1 : 0);
+
+    if (transport != UCOAP_TCP) {
+        return UCOAP_UDP_HEADER_LEN + tkl + data_len;
+    }
+
+    /* Len/TKL, extended length and code */
+    len = UCOAP_MIN_TCP_HEADER_LEN + tkl + data_len;
+
+    if (data_len >= UCOAP_TCP_LEN_MAX) {
+        len += 4;
+    } else if (data_len >= UCOAP_TCP_LEN_MED) {
+        len += 2;
+    } else if (data_len >= UCOAP_TCP_LEN_MIN) {
+        len += 1;
+    }
+
+    return len;
+}
+
+
 /**
  * @brief See description in the header file.
  *
  */
 enum ucoap_error
-decoding_options(const ucoap_data * const response,
-        ucoap_option_data * options,
-        const uint32_t const opt_start_idx,
-        uint32_t * const payload_start_idx) {
-    ucoap_error err;
+decoding_options(const ucoap_data * const packet,
+        ucoap_option_data * const options, const uint32_t max_options,
+        const uint32_t opt_start_idx, uint32_t * const payload_start_idx) {
     uint32_t idx;
+    uint32_t count;
+    uint16_t num;
+    uint32_t value_len;
 
-    uint8_t opt;
-    uint16_t delta_sum;
-
-    /* initialize */
-    err = UCOAP_NO_OPTIONS_ERROR;
     idx = opt_start_idx;
-    opt = response->buf[idx++];
+    count = 0;
+    num = 0;
 
-    /* decoding */
-    if (response->len > idx && opt != UCOAP_PAYLOAD_PREFIX) {
-        delta_sum = 0;
-        options->next = NULL;
+    while (next_option(packet->buf, packet->len, &idx, &num, &value_len)) {
+        if (count == max_options) {
+            return UCOAP_WRONG_OPTIONS_ERROR;
+        }
 
-        do {
+        options[count].num = num;
+        options[count].len = value_len;
+        options[count].value = packet->buf + idx;
+        options[count].next = NULL;
 
-            if (options->next != NULL) {
-                options = options->next;
-            }
+        if (count != 0) {
+            options[count - 1].next = &options[count];
+        }
+
+        idx += value_len;
+        count++;
+    }
+
+    /* the options run up to the payload marker or to the end of the packet */
+    if (idx < packet->len && packet->buf[idx++] != UCOAP_PAYLOAD_PREFIX) {
+        return UCOAP_WRONG_OPTIONS_ERROR;
+    }
+
+    *payload_start_idx = idx;
+
+    return count != 0 ? UCOAP_OK : UCOAP_NO_OPTIONS_ERROR;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+split_options(const ucoap_data * const packet, const uint32_t opt_start_idx,
+        ucoap_data * const options, ucoap_data * const payload) {
+    uint32_t idx;
+    uint16_t num;
+    uint32_t value_len;
+
+    idx = opt_start_idx < packet->len ? opt_start_idx : packet->len;
+    num = 0;
+
+    options->buf = packet->buf + idx;
+
+    while (next_option(packet->buf, packet->len, &idx, &num, &value_len)) {
+        idx += value_len;
+    }
 
-            /* option */
-            switch (opt >> 4) {
-                case UCOAP_OPT_1BYTE:
-                    options->num = response->buf[idx++] + UCOAP_OPT_MIN + delta_sum;
-                    delta_sum = options->num;
-                    break;
-
-                case UCOAP_OPT_2BYTE:
-                    options->num = response->buf[idx++];
-                    options->num <<= 8;
-                    options->num |= response->buf[idx++];
-                    options->num += delta_sum + UCOAP_OPT_MED;
-
-                    delta_sum = options->num;
-                    break;
-
-                case UCOAP_OPT_DIS:
-                    err = UCOAP_WRONG_OPTIONS_ERROR;
-                    goto return_label;
-
-                default:
-                    options->num = (opt >> 4) + delta_sum;
-                    delta_sum += (opt >> 4);
-                    break;
+    options->len = packet->buf + idx - options->buf;
+
+    if (idx < packet->len && packet->buf[idx++] != UCOAP_PAYLOAD_PREFIX) {
+        return UCOAP_WRONG_OPTIONS_ERROR;
+    }
+
+    payload->buf = idx < packet->len ? packet->buf + idx : NULL;
+    payload->len = packet->len - idx;
+
+    return UCOAP_OK;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+debug_print_options(struct ucoap_handle * const handle, const char * msg,
+        const ucoap_data * const options) {
+    ucoap_option_data option;
+    ucoap_option_iterator it;
+
+    ucoap_option_iterator_init(&it, options);
+
+    if (!ucoap_option_next(&it, &option)) {
+        ucoap_debug_print_options(handle, msg, NULL);
+        return;
+    }
+
+    do {
+        ucoap_debug_print_options(handle, msg, &option);
+    } while (ucoap_option_next(&it, &option));
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+bool
+next_option(const uint8_t * const buf, const uint32_t len,
+        uint32_t * const idx, uint16_t * const num, uint32_t * const value_len) {
+    uint32_t i;
+    uint32_t delta;
+
+    i = *idx;
+
+    if (i >= len || buf[i] == UCOAP_PAYLOAD_PREFIX) {
+        return false;
+    }
+
+    delta = buf[i] >> 4;
+    *value_len = buf[i] & 0x0F;
+    i++;
+
+    /* the extended fields are rare, the short ones are taken as they are */
+    if ((delta >= UCOAP_OPT_1BYTE || *value_len >= UCOAP_OPT_1BYTE)
+            && (!extend_option_field(buf, len, &i, &delta)
+                    || !extend_option_field(buf, len, &i, value_len))) {
+        return false;
+    }
+
+    if (len - i < *value_len) {
+        return false;
+    }
+
+    *num += delta;
+    *idx = i;
+
+    return true;
+}
+
+
+/**
+ * @brief Read the extended delta or length of the option
+ *
+ * @param buf - pointer on options
+ * @param len - length of options
+ * @param idx - index of the extended field, moved past it
+ * @param field - 4-bit field of the option header, replaced by its value
+ *
+ * @return false if the field is reserved (15) or truncated
+ */
+static bool
+extend_option_field(const uint8_t * const buf, const uint32_t len,
+        uint32_t * const idx, uint32_t * const field) {
+    switch (*field) {
+        case UCOAP_OPT_1BYTE:
+            if (len - *idx < 1) {
+                return false;
             }
 
-            /* length */
-            switch (opt & 0x0F) {
-                case UCOAP_OPT_1BYTE:
-                    options->len = response->buf[idx++] + UCOAP_OPT_MIN;
-                    break;
-
-                case UCOAP_OPT_2BYTE:
-                    options->len = response->buf[idx++];
-                    options->len <<= 8;
-                    options->len |= response->buf[idx++];
-                    options->len += UCOAP_OPT_MED;
-                    break;
-
-                case UCOAP_OPT_DIS:
-                    err = UCOAP_WRONG_OPTIONS_ERROR;
-                    goto return_label;
-
-                default:
-                    options->len = (opt & 0x0F);
-                    break;
+            *field = buf[(*idx)++] + UCOAP_OPT_MIN;
+            return true;
+
+        case UCOAP_OPT_2BYTE:
+            if (len - *idx < 2) {
+                return false;
             }
 
-            /* value */
-            options->value = response->buf + idx;
+            *field = ((buf[*idx] << 8) | buf[*idx + 1]) + UCOAP_OPT_MED;
+            *idx += 2;
+            return true;
 
-            /* shift counters */
-            idx += options->len;
-            options->next = (options + 1);
+        case UCOAP_OPT_DIS:
+            return false;
+
+        default:
+            return true;
+    }
+}
 
-            opt = response->buf[idx++];
 
-        } while (opt != UCOAP_PAYLOAD_PREFIX);
+/**
+ * @brief See description in the header file.
+ *
+ */
+uint32_t
+decode_uint_value(const uint8_t * const buf, const uint32_t len) {
+    uint32_t i;
+    uint32_t value;
 
-        options->next = NULL;
-        err = UCOAP_OK;
+    value = 0;
+
+    for (i = 0; i < len && i < 4; i++) {
+        value = (value << 8) | buf[i];
     }
 
-/***********/
-return_label:
-/***********/
+    return value;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+uint32_t
+encode_uint_value(uint8_t * const buf, uint32_t value) {
+    uint32_t i;
+    uint32_t len;
+
+    len = 0;
+
+    for (i = value; i != 0; i >>= 8) {
+        len++;
+    }
+
+    for (i = len; i > 0; i--) {
+        buf[i - 1] = value;
+        value >>= 8;
+    }
+
+    return len;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_wait_transaction(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const uint32_t timeout_ms) {
+    enum ucoap_error err;
+
+    err = UCOAP_OK;
+
+    while (!UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_RECEIVED)) {
+        err = ucoap_wait_event(handle, timeout_ms);
+
+        if (err != UCOAP_OK) {
+            break;
+        }
+    }
 
-    *payload_start_idx = idx;
     return err;
 }
 
 
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_fail_transaction(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const enum ucoap_error err) {
+    ucoap_result_data result;
+
+    UCOAP_RESET_STATUS(trans, UCOAP_TRANS_WAITING_ACK
+            | UCOAP_TRANS_WAITING_RESP | UCOAP_TRANS_RECEIVED);
+
+    if (trans->reqd->response_callback != NULL) {
+        result.resp_code = UCOAP_CODE_EMPTY_MSG;
+        result.payload.buf = NULL;
+        result.payload.len = 0;
+        result.options.buf = NULL;
+        result.options.len = 0;
+        result.err = err;
+
+        ucoap_complete_transaction(handle, trans, &result);
+    }
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+bool
+ucoap_can_receive(const struct ucoap_transaction * const trans) {
+    return !UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_RECEIVED)
+            || (UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_ASYNC) && trans->pending.len == 0);
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_complete_transaction(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const ucoap_result_data * const result) {
+    /* notifications are not ordered with other requests */
+    if (UCOAP_CHECK_STATUS(handle, UCOAP_IN_ORDER)
+            && !UCOAP_CHECK_STATUS(handle, UCOAP_ZERO_COPY_RX)
+            && UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_ASYNC)
+            && !UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_OBSERVE)) {
+        trans->result = *result;
+        UCOAP_SET_STATUS(trans, UCOAP_TRANS_DONE);
+        return;
+    }
+
+    trans->reqd->response_callback(trans->reqd, result);
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+bool
+ucoap_observe_notification(struct ucoap_transaction * const trans,
+        const ucoap_result_data * const result, const uint32_t now) {
+    uint32_t seq;
+    ucoap_option_data observe;
+
+    if (!ucoap_find_option(&result->options, UCOAP_OBSERVE_OPT, &observe)
+            || observe.len > 3
+            || UCOAP_EXTRACT_CLASS(result->resp_code) != UCOAP_SUCCESS_CLASS) {
+        UCOAP_RESET_STATUS(trans, UCOAP_TRANS_OBSERVE | UCOAP_TRANS_OBSERVING);
+        return true;
+    }
+
+    seq = decode_uint_value(observe.value, observe.len);
+
+    /* V1 < V2 and V2 - V1 < 2^23, or V1 > V2 and V1 - V2 > 2^23, or T2 > T1 + 128 s */
+    if (UCOAP_CHECK_STATUS(trans, UCOAP_TRANS_OBSERVING)
+            && !(trans->observe_seq < seq && seq - trans->observe_seq < UCOAP_OBSERVE_SEQ_HALF)
+            && !(trans->observe_seq > seq && trans->observe_seq - seq > UCOAP_OBSERVE_SEQ_HALF)
+            && !UCOAP_TIME_REACHED(now, trans->observe_at + UCOAP_OBSERVE_FRESH_MS)) {
+        return false;
+    }
+
+    trans->observe_seq = seq;
+    trans->observe_at = now;
+    UCOAP_SET_STATUS(trans, UCOAP_TRANS_OBSERVING);
+
+    return true;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_rearm_observation(const struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans) {
+    uint32_t idx;
+
+    if (handle->transport == UCOAP_TCP) {
+        /* Len/TKL without options and payload, code */
+        trans->request.buf[0] = trans->tkl;
+        trans->request.buf[1] = UCOAP_REQ_GET;
+        idx = UCOAP_MIN_TCP_HEADER_LEN;
+    } else {
+        /* version, type and TKL, code, Message ID in network byte order */
+        trans->request.buf[0] = (uint8_t)((UCOAP_DEFAULT_VERSION << 6)
+                | (UCOAP_MESSAGE_CON << 4) | trans->tkl);
+        trans->request.buf[1] = UCOAP_REQ_GET;
+        mem_copy(trans->request.buf + 2, &trans->mid, sizeof(trans->mid));
+        idx = UCOAP_UDP_HEADER_LEN;
+    }
+
+    mem_copy(trans->request.buf + idx, trans->token, trans->tkl);
+    trans->request.len = idx + trans->tkl;
+
+    trans->response.len = 0;
+    UCOAP_SET_STATUS(trans, UCOAP_TRANS_WAITING_RESP);
+    UCOAP_RESET_STATUS(trans, UCOAP_TRANS_RECEIVED);
+}
+
+
+/**
+ * @brief Configured limit of outstanding CON requests
+ *
+ * @param handle - coap handle
+ *
+ * @return count of requests
+ */
+static uint32_t
+window_limit(const struct ucoap_handle * const handle) {
+    const uint32_t nstart = UCOAP_CONFIG(handle)->nstart;
+
+    if (nstart == 0 || nstart > UCOAP_MAX_TRANSACTIONS) {
+        return UCOAP_MAX_TRANSACTIONS;
+    }
+
+    return nstart;
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+uint32_t
+ucoap_window(const struct ucoap_handle * const handle) {
+    return handle->cwnd ? handle->cwnd : window_limit(handle);
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+void
+ucoap_update_window(struct ucoap_handle * const handle, const bool congested) {
+    const uint32_t limit = window_limit(handle);
+
+    if (handle->cwnd == 0) {
+        handle->cwnd = limit;
+    }
+
+    if (congested) {
+        handle->cwnd = handle->cwnd > 1 ? handle->cwnd / 2 : 1;
+        handle->cwnd_acks = 0;
+        return;
+    }
+
+    /* one more request per window of timely ACKs */
+    if (handle->cwnd < limit && ++handle->cwnd_acks >= handle->cwnd) {
+        handle->cwnd++;
+        handle->cwnd_acks = 0;
+    }
+}
+
+
+/**
+ * @brief See description in the header file.
+ *
+ */
+enum ucoap_error
+ucoap_tx_request(struct ucoap_handle * const handle,
+        const struct ucoap_transaction * const trans) {
+#ifdef UCOAP_TX_DATAV
+    ucoap_data iov[2];
+
+    if (trans->reqd->payload.len) {
+        iov[0] = trans->request;
+        iov[1] = trans->reqd->payload;
+
+        return ucoap_tx_datav(handle, iov, 2);
+    }
+#endif /* UCOAP_TX_DATAV */
+
+    return ucoap_tx_data(handle, trans->request.buf, trans->request.len);
+}
+
+
 /**
  * @brief See description in the header file.
  *
@@ -203,3 +612,21 @@ uint32_t fill_payload(uint8_t * const buf, const ucoap_data * const payload)
 }
 
 
+/**
+ * @brief See description in the header file.
+ *
+ */
+uint32_t fill_request_payload(uint8_t * const buf, const ucoap_data * const payload)
+{
+#ifdef UCOAP_TX_DATAV
+    (void)payload;
+
+    *buf = UCOAP_PAYLOAD_PREFIX;
+
+    return 1;
+#else
+    return fill_payload(buf, payload);
+#endif /* UCOAP_TX_DATAV */
+}
+
+
@@ -23,14 +23,43 @@
 #include "ucoap.h"
 
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
 #define UCOAP_CHECK_STATUS(h,s)      ((h)->statuses_mask & (s))
 #define UCOAP_SET_STATUS(h,s)        ((h)->statuses_mask |= (s))
 #define UCOAP_RESET_STATUS(h,s)      ((h)->statuses_mask &= ~(s))
 
+#define UCOAP_CONFIG(h)              ((h)->config != NULL ? (h)->config : &ucoap_default_config)
+#define UCOAP_PDU_SIZE(h)            (UCOAP_CONFIG(h)->max_pdu_size)
+
+#define UCOAP_TIME_REACHED(now,t)    ((int32_t)((uint32_t)(now) - (uint32_t)(t)) >= 0)
+
 #define UCOAP_CHECK_RESP(m,s)        ((m) & (s))
 #define UCOAP_SET_RESP(m,s)          ((m) |= (s))
 #define UCOAP_RESET_RESP(m,s)        ((m) = ~(s))
 
+/* encoding of option delta/length and the payload marker */
+#define UCOAP_OPT_MIN                13
+#define UCOAP_OPT_MED                269
+
+#define UCOAP_OPT_1BYTE              13
+#define UCOAP_OPT_2BYTE              14
+#define UCOAP_OPT_DIS                15
+
+#define UCOAP_PAYLOAD_PREFIX         0xff
+
+/* headers of the transports, without token */
+#define UCOAP_UDP_HEADER_LEN         4
+#define UCOAP_MIN_TCP_HEADER_LEN     2u
+
+/* thresholds of the extended length of CoAP over TCP */
+#define UCOAP_TCP_LEN_MIN            13
+#define UCOAP_TCP_LEN_MED            269
+#define UCOAP_TCP_LEN_MAX            65805
+
 
 
 typedef enum {
@@ -38,14 +67,37 @@ typedef enum {
      UCOAP_UNKNOWN         = (int) 0x0000,
      UCOAP_ALL_STATUSES    = (int) 0xffff,
 
-     UCOAP_SENDING_PACKET  = (int) 0x0001,
-     UCOAP_WAITING_RESP    = (int) 0x0002,
+     UCOAP_PERSISTENT_BUFS = (int) 0x0001,
+     UCOAP_STATIC_BUFS     = (int) 0x0002,
+     UCOAP_ZERO_COPY_RX    = (int) 0x0004,
+     UCOAP_ADAPTIVE_RTO    = (int) 0x0008,
+     UCOAP_IN_ORDER        = (int) 0x0010,
+     UCOAP_TCP_SIGNALING   = (int) 0x0020,
 
      UCOAP_DEBUG_ON        = (int) 0x0080
 
 } ucoap_handle_status;
 
 
+typedef enum {
+
+     UCOAP_TRANS_FREE          = (int) 0x0000,
+
+     UCOAP_TRANS_BUSY          = (int) 0x0001,
+     UCOAP_TRANS_WAITING_ACK   = (int) 0x0002,
+     UCOAP_TRANS_WAITING_RESP  = (int) 0x0004,
+     UCOAP_TRANS_RECEIVED      = (int) 0x0008,
+
+     UCOAP_TRANS_ASYNC         = (int) 0x0010,
+     UCOAP_TRANS_QUEUED        = (int) 0x0020,     /* waits for the window */
+     UCOAP_TRANS_DONE          = (int) 0x0040,     /* waits for in-order completion */
+     UCOAP_TRANS_OBSERVE       = (int) 0x0080,     /* registration of observation */
+     UCOAP_TRANS_OBSERVING     = (int) 0x0100,     /* notifications are coming */
+     UCOAP_TRANS_HELD          = (int) 0x0200      /* the frame is held to be coalesced (TCP) */
+
+} ucoap_transaction_status;
+
+
 typedef enum {
 
     UCOAP_RESP_EMPTY            = (int) 0x00000000,
@@ -57,7 +109,7 @@ typedef enum {
 
     UCOAP_RESP_SUCCESS_CODE     = (int) 0x00000010,
     UCOAP_RESP_FAILURE_CODE     = (int) 0x00000020,
-    UCOAP_RESP_TCP_SIGNAL_CODE  = (int) 0x00000020,
+    UCOAP_RESP_TCP_SIGNAL_CODE  = (int) 0x00000040,
 
     UCOAP_RESP_NEED_SEND_ACK    = (int) 0x00000100,
 
@@ -81,21 +133,249 @@ uint32_t encoding_options(uint8_t * const buf,
 
 
 /**
- * @brief Decoding options from response
+ * @brief Get length of the options encoded by 'encoding_options' without
+ *        encoding them
  *
- * @param response - incoming packet
- * @param option - pointer on first element of linked list
+ * @param option - pointer on first element of linked list of options,
+ *        may be NULL
+ *
+ * @return length of encoded options
+ */
+uint32_t encoded_options_length(const ucoap_option_data * option);
+
+
+/**
+ * @brief Get length of the request frame as the transport assembles it
+ *
+ * @param transport - UCOAP_UDP or UCOAP_TCP
+ * @param tkl - length of token
+ * @param options_len - length of encoded options
+ * @param payload_len - length of payload, 0 - without payload marker
+ *
+ * @return length of the frame
+ */
+uint32_t request_frame_length(const uint16_t transport, const uint32_t tkl,
+        const uint32_t options_len, const uint32_t payload_len);
+
+
+/**
+ * @brief Decoding options of the incoming packet to an array linked as a list
+ *
+ * @param packet - incoming packet
+ * @param options - array for the options
+ * @param max_options - count of elements of the array
  * @param opt_start_idx - index of options in the incoming packet
  * @param payload_start_idx - pointer on variable for storing idx of payload
-          in the incoming packet
+ *        in the incoming packet
+ *
+ * @return UCOAP_NO_OPTIONS_ERROR if there are no options,
+ *         UCOAP_WRONG_OPTIONS_ERROR if they are broken or do not fit
+ */
+enum ucoap_error
+decoding_options(const ucoap_data * const packet,
+        ucoap_option_data * const options, const uint32_t max_options,
+        const uint32_t opt_start_idx, uint32_t * const payload_start_idx);
+
+
+/**
+ * @brief Find the encoded options and the payload of the incoming packet.
+ *        The options are checked, but not decoded.
+ *
+ * @param packet - incoming packet
+ * @param opt_start_idx - index of options in the incoming packet
+ * @param options - pointer on variable for storing the encoded options
+ * @param payload - pointer on variable for storing the payload
  *
- * @return status of operations
+ * @return UCOAP_WRONG_OPTIONS_ERROR if the options are broken
  */
 enum ucoap_error
-decoding_options(const ucoap_data * const response,
-        ucoap_option_data * option,
-        const uint32_t opt_start_idx,
-        uint32_t * const payload_start_idx);
+split_options(const ucoap_data * const packet, const uint32_t opt_start_idx,
+        ucoap_data * const options, ucoap_data * const payload);
+
+
+/**
+ * @brief Pass the encoded options to 'ucoap_debug_print_options' one by one
+ *
+ * @param handle - coap handle
+ * @param msg - message for the hook
+ * @param options - encoded options
+ *
+ */
+void
+debug_print_options(struct ucoap_handle * const handle, const char * msg,
+        const ucoap_data * const options);
+
+
+/**
+ * @brief Find the next option in place, without decoding them to a list.
+ *        Every length is checked against the end of the packet.
+ *
+ * @param buf - pointer on options
+ * @param len - length of options (and payload)
+ * @param idx - index of the next option, moved to its value
+ * @param num - number of the previous option (0 before the first one),
+ *        replaced by the found one
+ * @param value_len - pointer on variable for storing length of the value
+ *
+ * @return false if there are no more options (the payload marker or the
+ *         end) or they are broken, see the byte at 'idx'
+ */
+bool
+next_option(const uint8_t * const buf, const uint32_t len,
+        uint32_t * const idx, uint16_t * const num, uint32_t * const value_len);
+
+
+/**
+ * @brief Decode the unsigned integer value of the option
+ *
+ * @param buf - pointer on the value
+ * @param len - length of the value, 0..4 bytes
+ *
+ * @return the value
+ */
+uint32_t
+decode_uint_value(const uint8_t * const buf, const uint32_t len);
+
+
+/**
+ * @brief Encode the unsigned integer value of the option in the fewest bytes
+ *
+ * @param buf - pointer on buffer of 4 bytes
+ * @param value - the value
+ *
+ * @return length of the value
+ */
+uint32_t
+encode_uint_value(uint8_t * const buf, uint32_t value);
+
+
+/**
+ * @brief Wait until a packet will be routed to the transaction. Packets of
+ *        other transactions of the same handle wake us too, in this case
+ *        waiting is continued.
+ *
+ * @param handle - coap handle
+ * @param trans - transaction which is waiting a packet
+ * @param timeout_ms - timeout of waiting
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_wait_transaction(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const uint32_t timeout_ms);
+
+
+/**
+ * @brief Check that the transaction can take a packet: it has none, or it
+ *        is asynchronous and has no packet behind the received one yet
+ *
+ * @param trans - the transaction
+ *
+ * @return true if the packet may be routed to the transaction
+ */
+bool
+ucoap_can_receive(const struct ucoap_transaction * const trans);
+
+
+/**
+ * @brief Pass the result of the transaction to the callback, or keep it in
+ *        the transaction for in-order completion.
+ *
+ * @param handle - coap handle
+ * @param trans - completed transaction
+ * @param result - result of the request
+ *
+ */
+void
+ucoap_complete_transaction(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const ucoap_result_data * const result);
+
+
+/**
+ * @brief Check the response of observed resource (RFC 7641, 3.4) and update
+ *        state of the subscription. A response without Observe option or
+ *        with error code ends the subscription.
+ *
+ * @param trans - transaction of the subscription
+ * @param result - decoded response
+ * @param now - current time, ms
+ *
+ * @return false if the notification is older than the last one
+ */
+bool
+ucoap_observe_notification(struct ucoap_transaction * const trans,
+        const ucoap_result_data * const result, const uint32_t now);
+
+
+/**
+ * @brief Get the observation ready for the next notification. Each one is
+ *        checked by 'parse_response' against the header and the token at
+ *        the start of the request buffer, so they are written there from
+ *        the transaction in the framing of the transport and the request
+ *        is cut to them: the options and payload of the registration are
+ *        not needed any more.
+ *
+ * @param handle - coap handle, its transport
+ * @param trans - transaction of the observation
+ *
+ */
+void
+ucoap_rearm_observation(const struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans);
+
+
+/**
+ * @brief Current window of outstanding CON requests of the handle
+ *
+ * @param handle - coap handle
+ *
+ * @return count of requests
+ */
+uint32_t
+ucoap_window(const struct ucoap_handle * const handle);
+
+
+/**
+ * @brief Shrink the window of outstanding requests after a timeout, or
+ *        widen it after a timely ACK (AIMD).
+ *
+ * @param handle - coap handle
+ * @param congested - the ACK has timed out
+ *
+ */
+void
+ucoap_update_window(struct ucoap_handle * const handle, const bool congested);
+
+
+/**
+ * @brief Finish the transaction without response: pass the reason to the
+ *        callback (if any) and stop waiting.
+ *
+ * @param handle - coap handle
+ * @param trans - transaction to finish
+ * @param err - reason of failure
+ *
+ */
+void
+ucoap_fail_transaction(struct ucoap_handle * const handle,
+        struct ucoap_transaction * const trans,
+        const enum ucoap_error err);
+
+
+/**
+ * @brief Send the assembled request of the transaction. With UCOAP_TX_DATAV
+ *        the payload is passed to 'ucoap_tx_datav' by reference.
+ *
+ * @param handle - coap handle
+ * @param trans - transaction with assembled request
+ *
+ * @return status of operation
+ */
+enum ucoap_error
+ucoap_tx_request(struct ucoap_handle * const handle,
+        const struct ucoap_transaction * const trans);
 
 
 /**
@@ -109,4 +389,21 @@ decoding_options(const ucoap_data * const response,
 uint32_t fill_payload(uint8_t * const buf, const ucoap_data * const payload);
 
 
+/**
+ * @brief Add payload to the request: the whole payload, or only its marker
+ *        if the payload is sent by reference (UCOAP_TX_DATAV)
+ *
+ * @param buf - pointer on packet buffer
+ * @param payload - data with payload
+ *
+ * @return length of data that was added to the buffer
+ */
+uint32_t fill_request_payload(uint8_t * const buf, const ucoap_data * const payload);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
 #endif /* _UCOAP_UCOAP_UTILS_H_ */